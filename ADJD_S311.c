@@ -28,39 +28,154 @@
 
 
 
+/******** Variables of the colour measurement ****************************
+**************************************************************************/
+
+// phases of the measurement, each one is a message on the TWI queue
+#define ADJD_S311_PHASE_TRIGGER 0   // write GSSR to CTRL
+#define ADJD_S311_PHASE_POLL    1   // read CTRL until GSSR is cleared
+#define ADJD_S311_PHASE_READ    2   // read the data registers
+
+static TWI_Msg_t            adjd_s311_meas_msg;
+static ADJD_S311_Data_t     *adjd_s311_meas_data;
+static uint8_t              adjd_s311_meas_phase;
+static uint8_t              adjd_s311_meas_ctrl;
+static volatile uint8_t     adjd_s311_meas_poll;    // read CTRL on the next tick
+volatile uint8_t            adjd_s311_meas_state = ADJD_S311_MEAS_IDLE;
+
+
+// the bus is idle between two reads of CTRL, so a running measurement is
+// either queued or waiting for the next tick
+#define ADJD_S311_Meas_Running() \
+    (ADJD_S311_Meas_Busy() && (TWI_Master_Transceiver_Busy() || adjd_s311_meas_poll))
+
 /*****************************************************************************
-   Function:        ADJD_S311_Data_Get
+   Function:        ADJD_S311_Meas_Next
+   Parameters:      message that is done
+
+   Return value:    none
+
+   Purpose: Callback of the measurement message (TWI interrupt). Queues the
+            message again for the next phase of the measurement. The CTRL
+            read is left to ADJD_S311_Meas_Tick(): a conversion takes some
+            ms, reading CTRL back to back would hold off the other messages.
+
+******************************************************************************/
+static void
+ADJD_S311_Meas_Next(TWI_Msg_t *msg)
+{
+    if (msg->err)
+    {
+        adjd_s311_meas_state = ADJD_S311_MEAS_ERROR;
+        return;
+    }
+
+    switch (adjd_s311_meas_phase)
+    {
+    case ADJD_S311_PHASE_TRIGGER:
+    case ADJD_S311_PHASE_POLL:
+        msg->hdr_cnt = 1;
+        msg->tx_cnt = 0;
+        if (adjd_s311_meas_phase == ADJD_S311_PHASE_POLL
+                && !(adjd_s311_meas_ctrl & _BV(ADJD_S311_BIT_GSSR)))
+        {
+            // conversion done: read the data registers to the callers struct
+            adjd_s311_meas_phase = ADJD_S311_PHASE_READ;
+            msg->hdr[0] = ADJD_S311_REG_DATA;
+            msg->rx_buf = (uint8_t *)adjd_s311_meas_data;
+            msg->rx_cnt = sizeof(ADJD_S311_Data_t);
+        }
+        else
+        {
+            // (still) converting: read back the CTRL register on the next tick
+            adjd_s311_meas_phase = ADJD_S311_PHASE_POLL;
+            msg->hdr[0] = ADJD_S311_REG_CTRL;
+            msg->rx_buf = &adjd_s311_meas_ctrl;
+            msg->rx_cnt = 1;
+            adjd_s311_meas_poll = 1;
+            break;
+        }
+        if (TWI_Master_Enqueue(msg))
+            adjd_s311_meas_state = ADJD_S311_MEAS_ERROR;
+        break;
+
+    case ADJD_S311_PHASE_READ:
+        adjd_s311_meas_state = ADJD_S311_MEAS_DONE;
+        break;
+    }
+}
+
+/*****************************************************************************
+   Function:        ADJD_S311_Meas_Tick
+   Parameters:      none
+
+   Return value:    none
+
+   Purpose: Called by the timer0 ISR every ms, queues the pending read of
+            the CTRL register of a running measurement.
+
+******************************************************************************/
+void
+ADJD_S311_Meas_Tick(void)
+{
+    if (!adjd_s311_meas_poll)
+        return;
+    adjd_s311_meas_poll = 0;
+    if (TWI_Master_Enqueue(&adjd_s311_meas_msg))
+        adjd_s311_meas_state = ADJD_S311_MEAS_ERROR;
+}
+
+/*****************************************************************************
+   Function:        ADJD_S311_Meas_Start
    Parameters:      pointer to ADJD_S311_Data_t
 
    Return value:    error
 
-   Purpose: Initialise the Color driver.
+   Purpose: Starts a colour measurement and returns at once (see ADJD_S311.h).
 
 ******************************************************************************/
-void ADJD_S311_Data_Get(ADJD_S311_Data_t *SensorData)
+uint8_t
+ADJD_S311_Meas_Start(ADJD_S311_Data_t *SensorData)
 {
-    uint8_t buffer[3],ui8_i,ui8_temp;
+    TWI_Msg_t *msg = &adjd_s311_meas_msg;
+    uint8_t err;
+
+    // only one measurement at a time (a busy measurement keeps the twi busy)
+    while (ADJD_S311_Meas_Running());
 
     // write a 1 (GSSR-bit) into the CTRL-register of the ADJD-S311 to initiate
     // a coulor - measurement (integration of photo current and ad-conversion)
+    adjd_s311_meas_data = SensorData;
+    adjd_s311_meas_phase = ADJD_S311_PHASE_TRIGGER;
+    msg->sla = ADJD_S311_ADDRESS;
+    msg->hdr[0] = ADJD_S311_REG_CTRL;
+    msg->hdr[1] = _BV(ADJD_S311_BIT_GSSR);
+    msg->hdr_cnt = 2;
+    msg->tx_cnt = 0;
+    msg->rx_cnt = 0;
+    msg->callback = ADJD_S311_Meas_Next;
+
+    adjd_s311_meas_poll = 0;
+    adjd_s311_meas_state = ADJD_S311_MEAS_BUSY;
+    if ((err = TWI_Master_Enqueue(msg)))
+        adjd_s311_meas_state = ADJD_S311_MEAS_ERROR;
+    return err;
+}
 
-    ADJD_S311_Sensor_Start();
+/*****************************************************************************
+   Function:        ADJD_S311_Data_Get
+   Parameters:      pointer to ADJD_S311_Data_t
 
-    // read back the value of the CTRL register
-    // when CTRL is 0, data is ready for readout
+   Return value:    error
 
-    while(ADJD_S311_Reg_Get(ADJD_S311_REG_CTRL));
+   Purpose: Blocking colour measurement (ADJD_S311_Meas_Start() and wait).
 
-    // now measurement is done so let`s read data from ADJD-S311
-    // address the first ADJD-S311 data register...
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_WRITE;
-    buffer[1] = ADJD_S311_REG_DATA;
-    TWI_Master_Transceive_Message(buffer,2);
-
-    //...and copy the data to the struct SensorData
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_READ;
-    TWI_Master_Transceive_Message(buffer,sizeof(ADJD_S311_Data_t));
-    TWI_Master_Get_Transceiver_Data(SensorData,sizeof(ADJD_S311_Data_t));
+******************************************************************************/
+void ADJD_S311_Data_Get(ADJD_S311_Data_t *SensorData)
+{
+    ADJD_S311_Meas_Start(SensorData);
+    while (ADJD_S311_Meas_Running());
+    adjd_s311_meas_state = ADJD_S311_MEAS_IDLE;
 };
 
 /*****************************************************************************
@@ -87,15 +202,11 @@ ADJD_S311_Offset_Get(ADJD_S311_Offset_t *SensorOffset)
 
 
     // now measurement is done so let`s read data from ADJD-S311
-    // address the first ADJD-S311 data register...
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_WRITE;
-    buffer[1] = ADJD_S311_REG_OFFSET;
-    TWI_Master_Transceive_Message(buffer,2);
-
-    //...and copy the data to the struct SensorData
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_READ;
-    TWI_Master_Transceive_Message(buffer,sizeof(ADJD_S311_Offset_t));
-    TWI_Master_Get_Transceiver_Data(SensorOffset,sizeof(ADJD_S311_Offset_t));
+    // address the first ADJD-S311 offset register and read the data to the
+    // struct SensorOffset (repeated start)
+    buffer[0] = ADJD_S311_REG_OFFSET;
+    TWI_Master_Write_Read(ADJD_S311_ADDRESS,buffer,1,
+                          (uint8_t *)SensorOffset,sizeof(ADJD_S311_Offset_t));
 }
 
 /*****************************************************************************
@@ -110,18 +221,11 @@ ADJD_S311_Offset_Get(ADJD_S311_Offset_t *SensorOffset)
 
 void ADJD_S311_Param_Set(ADJD_S311_Param_t *SensorParam)
 {
-    uint8_t buffer[(sizeof(ADJD_S311_Param_t)+2)],ui8_i;
-    uint8_t * p_byte = SensorParam;
-
-    buffer[0] = (ADJD_S311_ADDRESS<<1)| TW_WRITE;
-    buffer[1] = ADJD_S311_REG_PARAM;
-
-    for (ui8_i=0; ui8_i<(sizeof(ADJD_S311_Param_t)); ui8_i++)
-        //buffer[ui8_i+2] = (*(((uint8_t*)SensorParam)+ui8_i));
-        buffer[ui8_i+2] = p_byte[ui8_i];
-
-    TWI_Master_Transceive_Message(buffer,(sizeof(ADJD_S311_Param_t)+2));
+    uint8_t reg = ADJD_S311_REG_PARAM;
 
+    // the parameters are streamed directly from *SensorParam (no copy)
+    TWI_Master_Post(ADJD_S311_ADDRESS,&reg,1,
+                    (uint8_t *)SensorParam,sizeof(ADJD_S311_Param_t));
 }
 
 /*****************************************************************************
@@ -174,15 +278,7 @@ ADJD_S311_Offset_Clear(void)
 void
 ADJD_S311_Reg_Set(uint8_t reg,uint8_t value)
 {
-    uint8_t buffer[3];
-
-    // write a 1 (GSSR-bit) into the CTRL-register of the ADJD-S311 to initiate
-    // a coulor - measurement (integration of photo current and ad-conversion)
-
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_WRITE;
-    buffer[1] = reg;
-    buffer[2] = value;
-    TWI_Master_Transceive_Message(buffer,3);
+    TWI_Master_Write_Register(reg,value,ADJD_S311_ADDRESS);
 }
 
 /*****************************************************************************
@@ -198,17 +294,6 @@ ADJD_S311_Reg_Set(uint8_t reg,uint8_t value)
 uint8_t
 ADJD_S311_Reg_Get(uint8_t reg)
 {
-    uint8_t buffer[2],value;
-
-    // write a 1 (GSSR-bit) into the CTRL-register of the ADJD-S311 to initiate
-    // a coulor - measurement (integration of photo current and ad-conversion)
-
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_WRITE;
-    buffer[1] = reg;
-    TWI_Master_Transceive_Message(buffer,2);
-
-    buffer[0] = (ADJD_S311_ADDRESS << 1) | TW_READ;
-    TWI_Master_Transceive_Message(buffer,1);
-    TWI_Master_Get_Transceiver_Data(&value,1);
-    return value;
+    // address the register and read it back within one transaction
+    return TWI_Master_Read_Register(reg,ADJD_S311_ADDRESS);
 }
@@ -44,6 +44,12 @@
 #define ADJD_S311_REG_PARAM     0x06
 #define ADJD_S311_REG_OFFSET    0x48
 
+// states of the colour measurement (ADJD_S311_Meas_Start())
+#define ADJD_S311_MEAS_IDLE     0   // nothing started (or the result was taken)
+#define ADJD_S311_MEAS_BUSY     1   // conversion or readout running
+#define ADJD_S311_MEAS_DONE     2   // data is valid
+#define ADJD_S311_MEAS_ERROR    3   // twi error, data is not valid
+
 
 
 
@@ -85,12 +91,56 @@ typedef struct ADJD_S311_Offset_s{
 
    Return value:    error
 
-   Purpose: Initialise the Color driver.
+   Purpose: Blocking colour measurement (ADJD_S311_Meas_Start() and wait).
 
 ******************************************************************************/
     extern void
 ADJD_S311_Data_Get(ADJD_S311_Data_t *SensorData);
 
+/*****************************************************************************
+   Function:        ADJD_S311_Meas_Start
+   Parameters:      pointer to ADJD_S311_Data_t
+
+   Return value:    error (TWI_ERR_QUEUE_FULL)
+
+   Purpose: Starts a colour measurement and returns at once. The CTRL register
+            is polled once per ms (ADJD_S311_Meas_Tick()) until the conversion
+            is done, then the TWI interrupt reads the data to *SensorData,
+            which belongs to the driver until ADJD_S311_Meas_Busy() returns 0.
+
+******************************************************************************/
+    extern uint8_t
+ADJD_S311_Meas_Start(ADJD_S311_Data_t *SensorData);
+
+/*****************************************************************************
+   Function:        ADJD_S311_Meas_Tick
+   Parameters:      none
+
+   Return value:    none
+
+   Purpose: Called by the timer0 ISR every ms, queues the pending read of
+            the CTRL register of a running measurement.
+
+******************************************************************************/
+    extern void
+ADJD_S311_Meas_Tick(void);
+
+/*****************************************************************************
+   Makro:           ADJD_S311_Meas_Busy
+   Parameters:      none
+
+   Return value:    1 while the measurement is running, 0 else
+
+   Purpose: Use ADJD_S311_Meas_State() to tell a valid result from an error.
+
+******************************************************************************/
+#define ADJD_S311_Meas_Busy() \
+    (adjd_s311_meas_state == ADJD_S311_MEAS_BUSY)
+
+#define ADJD_S311_Meas_State() (adjd_s311_meas_state)
+
+extern volatile uint8_t adjd_s311_meas_state;
+
 /*****************************************************************************
    Function: ADJD_S311_Offset_Get
    Parameters:      pointer to ADJD_S311_Offset_t
@@ -110,7 +160,9 @@ ADJD_S311_Offset_Get(ADJD_S311_Offset_t *SensorOffset);
 
    Return value:    none
 
-   Purpose: Initialise the Color driver.
+   Purpose: Write the sensor parameters. The ISR reads them directly from
+            *SensorParam, so don't change it before the next read from the
+            sensor (or TWI_Master_Flush()).
 
 ******************************************************************************/
 
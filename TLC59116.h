@@ -80,7 +80,8 @@ TLC59116_Init(void);
                 uint8_t blocksize   size of block
    Return value: none
 
-   Purpose: Sets PWM block.
+   Purpose: Sets PWM block. The values are read directly from block by the
+            ISR, so don't change it before TWI_Master_Flush() / the next read.
 
 ******************************************************************************/
 extern void
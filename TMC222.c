@@ -21,9 +21,23 @@
 
 
 #include <stddef.h>
+#include <avr/pgmspace.h>
 #include "twi_master.h"
 #include "TMC222.h"
 
+// full steps / s for VMax 0..15 (data sheet)
+static const uint16_t PROGMEM tmc222_vmax[16] =
+{
+    99, 136, 167, 197, 213, 228, 243, 273, 303, 334, 364, 395, 456, 546, 729, 973
+};
+
+// full steps / s^2 for Acc 0..15 (data sheet)
+static const uint16_t PROGMEM tmc222_acc[16] =
+{
+    49, 218, 1004, 3609, 6228, 8848, 11409, 13970,
+    16531, 19092, 21886, 24447, 27008, 29570, 34925, 40047
+};
+
 /*****************************************************************************
    Function: GetFullStatus1()
    Parameters:
@@ -37,21 +51,13 @@ uint8_t
 TMC222_GetFullStatus1      (TMC222_Status_t *TMC222Status,
                             uint8_t  address)
 {
-    uint8_t data[8];
-    uint8_t err;
+    uint8_t cmd;
 
-    // configuration
-    data[0] = (address << 1) | TWI_WRITE_BIT;       // number of transmitted byte
-    data[1] = 0x81;                        // Set command byte for GetFullStatus1
-    if((err=TWI_Master_Transceive_Message((uint8_t *)data,2))) 	// send buffer
-        return err;
-    //while (err = TWI_Master_Get_State()); 				// wait till sent
-
-    data[0] = (address << 1) | TWI_READ_BIT;
-    if ((err=TWI_Master_Transceive_Message((uint8_t *)data,8)))
-        return err;
-    err=TWI_Master_Get_Transceiver_Data((uint8_t *)TMC222Status,7);
-    return err;
+    // send command byte for GetFullStatus1 and read the answer (repeated start)
+    // directly into *TMC222Status
+    cmd = 0x81;
+    return TWI_Master_Write_Read(address,&cmd,1,
+                                 (uint8_t *)TMC222Status,sizeof(TMC222_Status_t));
 }
 
 
@@ -79,18 +85,9 @@ TMC222_GetFullStatus2      (int16_t*ActualPosition,
     uint8_t data[13];
     uint8_t  err;
 
-    // configuration
-    data[0] = (address << 1) | TWI_WRITE_BIT;       // number of transmitted byte
-    data[1] = 0xfc;      // Set command byte for GetFullStatus2
-
-    if((err=TWI_Master_Transceive_Message((uint8_t *)data,2))) 	// send buffer
-        return err;
-    //while (err = TWI_Master_Get_State()); 				// wait till sent
-
-    data[0] = (address << 1) | TWI_READ_BIT;
-    if((err=TWI_Master_Transceive_Message((uint8_t *)data,9)))
-        return err;
-    if((err=TWI_Master_Get_Transceiver_Data((uint8_t *)data,9)))
+    // send command byte for GetFullStatus2 and read the answer (repeated start)
+    data[0] = 0xfc;
+    if((err=TWI_Master_Write_Read(address,data,1,data,9)))
         return err;
 
     if(ActualPosition!=NULL) *ActualPosition=(data[1]<<8) | data[2];
@@ -139,27 +136,24 @@ GetOTPParam                         (uint8_t address)
 
    Return value: twi-error
 
-   Purpose: Set the TMC222 motor parameters.
+   Purpose: Set the TMC222 motor parameters. The ISR reads them directly from
+            *TMC222Parameters, so don't change it before the next read from
+            the TMC222 (or TWI_Master_Flush()).
 ******************************************************************************/
 uint8_t
 TMC222_SetMotorParameters                     (TMC222_Parameters_t *TMC222Parameters,
         uint8_t address)
 {
-    uint8_t data[9];
-    uint8_t i;
-    uint8_t  err;
+    uint8_t data[3];
 
     // configuration
-    data[0] = (address << 1) | TWI_WRITE_BIT;       // number of transmitted byte
-    data[1]=0x89;  //Command byte for SetMotorParameters (0x89)
+    data[0]=0x89;  //Command byte for SetMotorParameters (0x89)
+    data[1]=0xff;
     data[2]=0xff;
-    data[3]=0xff;
-
-    for(i=0; i<(sizeof(TMC222_Parameters_t)); i++)
-        data[i+4] = *(((uint8_t *) TMC222Parameters)+i);
 
-    err=TWI_Master_Transceive_Message((uint8_t *)data,9);// send buffer
-    return err;
+    // the parameters are streamed directly from *TMC222Parameters (no copy)
+    return TWI_Master_Post(address,data,3,
+                           (uint8_t *)TMC222Parameters,sizeof(TMC222_Parameters_t));
 }
 
 
@@ -175,20 +169,17 @@ TMC222_SetMotorParameters                     (TMC222_Parameters_t *TMC222Parame
 uint8_t
 TMC222_SetPosition(int16_t Position,uint8_t address)
 {
-    uint8_t data[6];
-    uint8_t  err;
+    uint8_t data[5];
 
     // configuration
-    data[0] = (address << 1) | TWI_WRITE_BIT;     //adrdress byte with dir bit
-    data[1] = 0x8b;                         //Command byte for SetPosition (0x8b)
+    data[0] = 0x8b;                         //Command byte for SetPosition (0x8b)
+    data[1] = 0xff;
     data[2] = 0xff;
-    data[3] = 0xff;
-    data[4] = (uint8_t) (Position >> 8);
-    data[5] = (uint8_t) Position & 0xff;
+    data[3] = (uint8_t) (Position >> 8);
+    data[4] = (uint8_t) Position & 0xff;
 
     //Start TWI communication
-    err=TWI_Master_Transceive_Message((uint8_t *)data,6);// send buffer
-    return err;
+    return TWI_Master_Post(address,data,5,NULL,0);
 }
 
 
@@ -258,22 +249,25 @@ TMC222_ResetToDefault(uint8_t address)
 uint8_t
 TMC222_RunInit(uint8_t VMin, uint8_t VMax, int16_t Position1, int16_t Position2,uint8_t address)
 {
-    uint8_t data[9],err;
+    static uint8_t positions[4];
+    uint8_t data[4];
+
+    // positions are streamed from the static buffer: wait until the last
+    // RunInit has left it
+    TWI_Master_Flush();
 
     //Send RunInit command and the data
-    data[0] = (address << 1) | TWI_WRITE_BIT;     //adrdress byte with dir bit
-    data[1]=0x88;  //Command byte for RunInit (0x88)
+    data[0]=0x88;  //Command byte for RunInit (0x88)
+    data[1]=0xff;
     data[2]=0xff;
-    data[3]=0xff;
-    data[4]=(VMax << 4) | (VMin & 0x0f);
-    data[5]=BYTE1(Position1);
-    data[6]=BYTE0(Position1);
-    data[7]=BYTE1(Position2);
-    data[8]=BYTE0(Position2);
+    data[3]=(VMax << 4) | (VMin & 0x0f);
+    positions[0]=BYTE1(Position1);
+    positions[1]=BYTE0(Position1);
+    positions[2]=BYTE1(Position2);
+    positions[3]=BYTE0(Position2);
 
     //Start TWI communication
-    err=TWI_Master_Transceive_Message((uint8_t *)data,9);// send buffer
-    return err;
+    return TWI_Master_Post(address,data,4,positions,4);
 }
 
 
@@ -367,3 +361,95 @@ uint8_t TMC222_GetMotionStatus(TMC222_Status_t * TMC222Status,uint8_t address)
     TMC222_GetFullStatus1(TMC222Status,address);
     return ((uint8_t)TMC222Status->Motion);
 }
+
+
+/*****************************************************************************
+   Function: TMC222_Isqrt()
+   Parameters: x
+
+   Return value: integer square root of x
+
+   Purpose: helper of TMC222_Move_Time()
+******************************************************************************/
+static uint16_t
+TMC222_Isqrt(uint32_t x)
+{
+    uint32_t root = 0, bit = 1UL << 30;
+
+    while(bit > x)
+        bit >>= 2;
+    while(bit)
+    {
+        if(x >= root + bit)
+        {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+        bit >>= 2;
+    }
+    return (uint16_t)root;
+}
+
+
+/*****************************************************************************
+   Function: TMC222_Move_Time()
+   Parameters TMC222Parameters: motor parameters of the move
+              Distance: microsteps (in the StepMode of the parameters)
+
+   Return value: predicted duration of the move in ms
+
+   Purpose: Computes the duration of a move from the data sheet tables. With
+            AccShape = 1 the motor runs with VMin all the way, else it starts
+            with VMin, accelerates with Acc up to VMax (or only to the middle
+            of a short move) and brakes down to VMin again.
+            Valid for any Distance: v <= 973 * 16 keeps v^2 below 2^28, the
+            triangle (a * Distance < v^2 - v0^2) can't overflow 32 bit. Slow
+            long moves (more than 65.5 s) saturate at 0xFFFF.
+******************************************************************************/
+uint16_t
+TMC222_Move_Time(const TMC222_Parameters_t *TMC222Parameters, uint16_t Distance)
+{
+    uint8_t  mstep = 2 << TMC222Parameters->StepMode;
+    uint32_t v = (uint32_t)pgm_read_word(&tmc222_vmax[TMC222Parameters->VMax]) * mstep;
+    uint32_t a = (uint32_t)pgm_read_word(&tmc222_acc[TMC222Parameters->Acc]) * mstep;
+    uint32_t v0 = v;            // VMin = 0 runs with VMax
+    uint32_t t;
+
+    if(!Distance)
+        return 0;
+    if(TMC222Parameters->VMin)
+        v0 = v * TMC222Parameters->VMin / 32;
+    if(TMC222Parameters->AccShape)
+        t = Distance * 1000UL / v0;
+    else if(Distance >= (v * v - v0 * v0) / a)
+        // reaches VMax: t = d / v + (v - v0)^2 / (a * v)
+        t = Distance * 1000UL / v + (v - v0) * (v - v0) / v * 1000 / a;
+    else
+        // triangle up to vp^2 = v0^2 + a * d and down again
+        t = (TMC222_Isqrt(v0 * v0 + a * Distance) - v0) * 2000UL / a;
+    return t > 0xFFFF ? 0xFFFF : (uint16_t)t;
+}
+
+/*****************************************************************************
+   Function: TMC222_Stop_Time()
+   Parameters TMC222Parameters: motor parameters of the move
+
+   Return value: predicted duration of a SoftStop from VMax in ms
+
+   Purpose: Computes the braking from VMax down to VMin with Acc, no bus
+            access. With AccShape = 1 the motor stops at once.
+******************************************************************************/
+uint16_t
+TMC222_Stop_Time(const TMC222_Parameters_t *TMC222Parameters)
+{
+    uint32_t v = pgm_read_word(&tmc222_vmax[TMC222Parameters->VMax]);
+    uint32_t a = pgm_read_word(&tmc222_acc[TMC222Parameters->Acc]);
+
+    if(TMC222Parameters->AccShape)
+        return 0;
+    if(TMC222Parameters->VMin)
+        v -= v * TMC222Parameters->VMin / 32;
+    return (uint16_t)(v * 1000 / a);
+}
@@ -97,11 +97,11 @@ TMC222_GetFullStatus1      (TMC222_Status_t *TMC222Status,
 
 /*****************************************************************************
    Function: GetFullStatus2()
-   Parameters:  *TargetPosition:Pointer to variable for the target position
+   Parameters:  *ActualPosition:Pointer to variable for the actual position
                                 or NULL.
-                *SecurePosition:Pointer to variable for the secure position
+                *TargetPosition:Pointer to variable for the target position
                                 or NULL.
-                *ActualPosition:Pointer to variable for the actual position
+                *SecurePosition:Pointer to variable for the secure position
                                 or NULL.
 
    Return value: twi-error
@@ -111,9 +111,9 @@ TMC222_GetFullStatus1      (TMC222_Status_t *TMC222Status,
 ******************************************************************************/
 
 uint8_t
-TMC222_GetFullStatus2      (int16_t*TargetPosition,
+TMC222_GetFullStatus2      (int16_t*ActualPosition,
+                            int16_t*TargetPosition,
                             int16_t*SecurePosition,
-                            int16_t*ActualPosition,
                             uint8_t address);
 
 
@@ -138,7 +138,9 @@ GetOTPParam     (uint8_t address);*/
 
    Return value: twi-error
 
-   Purpose: Set the TMC222 motor parameters.
+   Purpose: Set the TMC222 motor parameters. The ISR reads them directly from
+            *TMC222Parameters, so don't change it before the next read from
+            the TMC222 (or TWI_Master_Flush()).
 ******************************************************************************/
 extern uint8_t
 TMC222_SetMotorParameters       (TMC222_Parameters_t *TMC222Parameters,
@@ -268,4 +270,32 @@ extern uint8_t TMC222_GetMotorParameters(TMC222_Parameters_t *TMC222Parameters,u
 ******************************************************************************/
 extern uint8_t TMC222_GetMotionStatus(TMC222_Status_t *TMC222Status,uint8_t address);
 
+
+/*****************************************************************************
+   Function: TMC222_Move_Time()
+   Parameters TMC222Parameters: motor parameters of the move
+              Distance: microsteps (in the StepMode of the parameters)
+
+   Return value: predicted duration of the move in ms
+
+   Purpose: Computes the duration of a move from the VMax, VMin, Acc, AccShape
+            and StepMode tables of the data sheet (trapezoidal ramp, or a
+            constant VMin run with AccShape = 1). No bus access.
+            Any Distance is valid, the result saturates at 0xFFFF ms.
+******************************************************************************/
+extern uint16_t TMC222_Move_Time(const TMC222_Parameters_t *TMC222Parameters,
+                                 uint16_t Distance);
+
+
+/*****************************************************************************
+   Function: TMC222_Stop_Time()
+   Parameters TMC222Parameters: motor parameters of the move
+
+   Return value: predicted duration of a SoftStop from VMax in ms
+
+   Purpose: Computes the braking ramp from VMax down to VMin (0 with
+            AccShape = 1). No bus access.
+******************************************************************************/
+extern uint16_t TMC222_Stop_Time(const TMC222_Parameters_t *TMC222Parameters);
+
 #endif //_TMC222_H
@@ -28,6 +28,8 @@
 #include <avr/pgmspace.h>
 #include <util/twi.h>
 #include <util/delay.h>
+#include <util/crc16.h>
+#include <avr/eeprom.h>
 
 #include "uart.h"
 #include "twi_master.h"
@@ -38,6 +40,7 @@
 #include "color_sensor.h"
 
 #include "smarties.h"
+#include "motion_controll.h"
 
 // #define CS_DEBUG 0 //debug in debug.h en-/disabled
 
@@ -49,6 +52,17 @@ CS_Sensor_LED_t     cs_sensor_led;
 ADJD_S311_Data_t    cs_sensor_data;
 ADJD_S311_Param_t   cs_sensor_param;
 
+uint16_t            cs_led_settle_ms = CS_LED_SETTLE_MS;
+uint16_t            cs_led_settle_last;
+volatile uint16_t   cs_led_settle_timer;
+
+ADJD_S311_Data_t    cs_white_ref;
+
+static CS_Calib_t EEMEM cs_calib_ee;
+
+uint8_t             cs_led_addapt_conv;
+uint16_t            cs_led_addapt_ms;
+
 
 /******** CS_Init *********************************************************
 Function: CS_Init()
@@ -67,86 +81,103 @@ Function:   CS_Gain_Addapt()
 Purpose:    Call this function to addapt the sensor gain.
             It´s thougt to be called when only passive light reaches the
             sensor area, which should be placed over a referecne white!
-            According to the ambient light, this function will decrease
-            the sensitivity until every color channel is beyond a given
-            threshold
+            With the capacitor counts of CS_GAIN_CAP_xxx, this function
+            searches the longest integration time of every channel (up to
+            CS_GAIN_INT_MAX) whose offset stays below the given threshold.
+            All channels are searched at the same time by successive
+            approximation on one offset conversion per bit.
+            The result is left in *p_parameter and written to the sensor,
+            CS_Gain_Restore() reuses it without a new search.
 Input:      pointer to Sensor_Param_t,threshold
 Returns:    none
 **************************************************************************/
 void
 CS_Gain_Addapt(ADJD_S311_Param_t *p_parameter,uint8_t dark_max)
 {
-    //ADJD_S311_Offset_t cs_offset;
-    uint16_t temp_int16 = 0x00F0;
-    int8_t offset_clear;    // no real signed value: (no two´s complement)
-    // MSB as signed bit is sufficent for comparison...
-
-    // Set number of integration capacitors to max (for maximum Integration time)
-    // Set the integraton time to usefull maximum.
-    p_parameter->CapRed     = 0xF;
-    p_parameter->CapGreen   = 0xF;
-    p_parameter->CapBlue    = 0xF;
-    p_parameter->CapClear   = 0xF;
-    p_parameter->IntRed     = temp_int16;
-    p_parameter->IntGreen   = temp_int16;
-    p_parameter->IntBlue    = temp_int16;
-    p_parameter->IntClear   = temp_int16;
+    ADJD_S311_Offset_t cs_offset;
+    uint8_t int_slots[4] = {0, 0, 0, 0};
+    uint8_t try_slots[4];
+    uint8_t bit = 0x80, ch;
 
-    ADJD_S311_Param_Set(p_parameter);
-
-    //Switch off LED lightsource
-    // TLC59116_GRP_PWM_Set(0);
+    p_parameter->CapRed     = CS_GAIN_CAP_RED;
+    p_parameter->CapGreen   = CS_GAIN_CAP_GREEN;
+    p_parameter->CapBlue    = CS_GAIN_CAP_BLUE;
+    p_parameter->CapClear   = CS_GAIN_CAP_CLEAR;
 
     // switch off offset and sleep function of color sensor
     ADJD_S311_Reg_Set(ADJD_S311_REG_CONFIG,0);
+
     do
     {
-        // do offset measurement
-        ADJD_S311_Offset_Clear();
-        // get offset values
-        while(ADJD_S311_Reg_Get(ADJD_S311_REG_CTRL));
+        // try the next bit on all channels
+        for(ch = 0; ch < 4; ch++)
+        {
+            try_slots[ch] = int_slots[ch] | bit;
+            if(try_slots[ch] > CS_GAIN_INT_MAX)
+                try_slots[ch] = int_slots[ch];
+        }
+        p_parameter->IntRed     = try_slots[0];
+        p_parameter->IntGreen   = try_slots[1];
+        p_parameter->IntBlue    = try_slots[2];
+        p_parameter->IntClear   = try_slots[3];
+        ADJD_S311_Param_Set(p_parameter);
 
-        offset_clear = ADJD_S311_Reg_Get(0x4B); //ADJD_S311_REG_OFFSET_CLEAR);
-#if CS_DEBUG
-        uart_puts_P("\rOffset: ");
-        uart_put_uint16(offset_clear);
-        uart_putc(' ');
-        uart_puts_P("Integration time slots: ");
-        uart_put_uint16(temp_int16);
-#endif
+        // do offset measurement and get offset values
+        ADJD_S311_Offset_Clear();
+        ADJD_S311_Offset_Get(&cs_offset);
 
-        if(offset_clear >= dark_max)    // no real signed value: (no two´s complement)
-            // MSB as signed bit is sufficent for comparison...
+        // no real signed value: (no two´s complement)
+        // MSB as signed bit is sufficent for comparison...
+        for(ch = 0; ch < 4; ch++)
         {
-            temp_int16 --;
-            p_parameter->IntRed     =temp_int16;
-            p_parameter->IntRed     =temp_int16;
-            p_parameter->IntGreen   =temp_int16;
-            p_parameter->IntBlue    =temp_int16;
-            p_parameter->IntClear   =temp_int16;
-
-            ADJD_S311_Param_Set(p_parameter);
+            if(((int8_t *)&cs_offset)[ch] < dark_max)
+                int_slots[ch] = try_slots[ch];
         }
+        bit >>= 1;
     }
-    while(offset_clear >= dark_max);
+    while(bit);
+
+    p_parameter->IntRed     = int_slots[0];
+    p_parameter->IntGreen   = int_slots[1];
+    p_parameter->IntBlue    = int_slots[2];
+    p_parameter->IntClear   = int_slots[3] >> 1;
 
 #if CS_DEBUG
     uart_puts_P("\nI-Timeslots:");
-    uart_put_uint16(temp_int16);
+    for(ch = 0; ch < 4; ch++)
+    {
+        uart_putc(' ');
+        uart_put_uint16(int_slots[ch]);
+    }
 #endif
-    p_parameter->IntClear >>=1;
     ADJD_S311_Param_Set(p_parameter);
+}
 
-
+/********** CS_Gain_Restore ***********************************************
+Function:   CS_Gain_Restore()
+Purpose:    Writes a parameter set found by CS_Gain_Addapt() to the sensor
+            again (e.g. after a reset of the sensor).
+Input:      pointer to Sensor_Param_t
+Returns:    none
+**************************************************************************/
+void
+CS_Gain_Restore(ADJD_S311_Param_t *p_parameter)
+{
+    ADJD_S311_Reg_Set(ADJD_S311_REG_CONFIG,0);
+    ADJD_S311_Param_Set(p_parameter);
 }
 /********** CS_LED_Addapt *************************************************
 Function:   CS_LED_Addapt()
 Purpose:    Call this function to addapt the light to the sensetivity.
             It´s thougt to be called when only passive light reaches the
             sensor area, which should be placed over a referecne white!
-            According to the sensitivity and ambient light, this function
-            will decrease PWM values of the single LED until every color
-            channel is beyond a given threshold
+            Finds the highest PWM value of every LED that keeps its color
+            channel below the given threshold. Every channel is measured
+            with only its own LED lit, the others at 0. The channels are
+            searched by successive approximation (one bit per conversion,
+            MSB first) and take turns, so it takes 3*8 conversions.
+            The number of conversions and the time taken are left in
+            cs_led_addapt_conv and cs_led_addapt_ms.
 Input:      pointer to LED-PWM-Values,threshold
 Returns:    none
 **************************************************************************/
@@ -154,124 +185,409 @@ void
 CS_LED_Addapt(CS_Sensor_LED_t *p_sensor_led,
               uint16_t sensor_val_max)
 {
+    // TLC59116 channel of the red, green and blue LED
+    static const uint8_t led_channel[3] = {4, 2, 0};
     ADJD_S311_Data_t rgbw_data;
-    uint8_t sensor_led_tmp=255;
+    uint8_t pwm[3] = {0, 0, 0};
+    uint16_t value;
+    uint8_t bit = 0x80;
+    uint8_t i;
+    uint16_t t_start;
 
     TLC59116_GRP_PWM_Set(0xFF);
     _delay_ms(500);
 
+    t_start = MC_Ticks_Get();
+    cs_led_addapt_conv = 0;
 
-    p_sensor_led->Red0   =sensor_led_tmp;
+    p_sensor_led->Red0   =0;
     p_sensor_led->Red1   =0;
     p_sensor_led->Green0 =0;
     p_sensor_led->Green1 =0;
     p_sensor_led->Blue0  =0;
     p_sensor_led->Blue1  =0;
-    TLC59116_Set_PWM_Block(p_sensor_led,0,6);
+    TLC59116_Set_PWM_Block((uint8_t *)p_sensor_led,0,6);
 
-
-    // Addapt Red channel
-    ADJD_S311_Data_Get(&rgbw_data);
-    while(rgbw_data.Red > sensor_val_max)
+    do
     {
-        sensor_led_tmp --;
-        TLC59116_Set_PWM_Channel(4,sensor_led_tmp);
-        ADJD_S311_Data_Get(&rgbw_data);
+        for(i = 0; i < 3; i++)
+        {
+            // try the next bit with only this LED lit
+            TLC59116_Set_PWM_Channel(led_channel[i],pwm[i] | bit);
+            ADJD_S311_Data_Get(&rgbw_data);
+            TLC59116_Set_PWM_Channel(led_channel[i],0);
+            cs_led_addapt_conv++;
+
+            if(i == 0)
+                value = rgbw_data.Red;
+            else if(i == 1)
+                value = rgbw_data.Green;
+            else
+                value = rgbw_data.Blue;
+
+            // keep it where the channel is still below the threshold
+            if(value <= sensor_val_max)
+                pwm[i] |= bit;
+        }
+        bit >>= 1;
     }
-    p_sensor_led->Red0 = sensor_led_tmp;
-    TLC59116_Set_PWM_Channel(4,0);
+    while(bit);
+
+    p_sensor_led->Red0   = pwm[0];
+    p_sensor_led->Green0 = pwm[1];
+    p_sensor_led->Blue0  = pwm[2];
+    cs_led_addapt_ms = MC_Ticks_Get() - t_start;
+
 #if CS_DEBUG
     uart_puts_P("\nPWM-Red:");
-    uart_put_uint16(sensor_led_tmp);
+    uart_put_uint16(pwm[0]);
+    uart_puts_P("\tPWM-Green:");
+    uart_put_uint16(pwm[1]);
+    uart_puts_P("\tPWM-Blue:");
+    uart_put_uint16(pwm[2]);
+    uart_puts_P("\tConversions:");
+    uart_put_uint16(cs_led_addapt_conv);
+    uart_puts_P("\tms:");
+    uart_put_uint16(cs_led_addapt_ms);
 #endif
-//Addapt Green channel
-    sensor_led_tmp = 255;
-    TLC59116_Set_PWM_Channel(2,sensor_led_tmp);
+    // write addapted channel values (saved @ p_sensor_led) to the TLC59116
+
+    TLC59116_Set_PWM_Block((uint8_t *)p_sensor_led,0,6);
+    TLC59116_GRP_PWM_Set(0x00);
+}
+
+
+/********** CS_Calib_CRC **************************************************
+Function:   CS_Calib_CRC()
+Purpose:    CRC-CCITT over a calibration without its CRC field
+Input:      pointer to CS_Calib_t
+Returns:    CRC
+**************************************************************************/
+static uint16_t
+CS_Calib_CRC(CS_Calib_t *p_calib)
+{
+    uint8_t *p = (uint8_t *)p_calib;
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+
+    for(i = 0; i < offsetof(CS_Calib_t, CRC); i++)
+        crc = _crc_ccitt_update(crc, p[i]);
+    return crc;
+}
+
+/********** CS_Calib_Store ************************************************
+Function:   CS_Calib_Store()
+Purpose:    Stores the actual calibration (cs_sensor_param, cs_sensor_led,
+            cs_led_settle_ms and cs_white_ref) with stamp and CRC to the
+            EEPROM.
+Input:      none
+Returns:    none
+**************************************************************************/
+void
+CS_Calib_Store(void)
+{
+    CS_Calib_t calib;
+
+    calib.Stamp     = CS_CALIB_STAMP;
+    calib.Param     = cs_sensor_param;
+    calib.LED       = cs_sensor_led;
+    calib.SettleMs  = cs_led_settle_ms;
+    calib.White     = cs_white_ref;
+    calib.CRC       = CS_Calib_CRC(&calib);
 
-    ADJD_S311_Data_Get(&rgbw_data);
-    while(rgbw_data.Green > sensor_val_max)
+    eeprom_busy_wait();
+    eeprom_update_block((const void*)&calib,(void*)&cs_calib_ee,sizeof(CS_Calib_t));
+}
+
+/********** CS_Calib_Restore **********************************************
+Function:   CS_Calib_Restore()
+Purpose:    Reads the calibration from the EEPROM. When stamp and CRC are
+            valid, it is taken over and written to the sensor and the LED
+            driver.
+Input:      none
+Returns:    1 if the calibration was valid, 0 else
+**************************************************************************/
+uint8_t
+CS_Calib_Restore(void)
+{
+    CS_Calib_t calib;
+
+    eeprom_busy_wait();
+    eeprom_read_block((void*)&calib,(const void*)&cs_calib_ee,sizeof(CS_Calib_t));
+
+    if(calib.Stamp != CS_CALIB_STAMP || calib.CRC != CS_Calib_CRC(&calib))
     {
-        sensor_led_tmp --;
-        TLC59116_Set_PWM_Channel(2,sensor_led_tmp);
-        ADJD_S311_Data_Get(&rgbw_data);
+#if CS_DEBUG
+        uart_puts_P("\nCalibration invalid");
+#endif
+        return 0;
     }
-    p_sensor_led->Green0 = sensor_led_tmp;
-    TLC59116_Set_PWM_Channel(2,0);
+
+    cs_sensor_param     = calib.Param;
+    cs_sensor_led       = calib.LED;
+    cs_led_settle_ms    = calib.SettleMs;
+    cs_white_ref        = calib.White;
+
+    CS_Gain_Restore(&cs_sensor_param);
+    TLC59116_Set_PWM_Block((uint8_t *)&cs_sensor_led,0,6);
+    TLC59116_GRP_PWM_Set(0x00);
+    return 1;
+}
+
+/********** CS_White_Drift ************************************************
+Function:   CS_White_Drift()
+Purpose:    Compares a measurement of the reference white with
+            cs_white_ref.
+Input:      pointer to the measurement of the white
+Returns:    1 if a channel differs by more than 1/2^CS_WHITE_DRIFT_EXP,
+            0 else
+**************************************************************************/
+uint8_t
+CS_White_Drift(ADJD_S311_Data_t *p_white)
+{
+    uint16_t ref[3], val[3];
+    uint8_t ch;
+
+    ref[0] = cs_white_ref.Red;
+    ref[1] = cs_white_ref.Green;
+    ref[2] = cs_white_ref.Blue;
+    val[0] = p_white->Red;
+    val[1] = p_white->Green;
+    val[2] = p_white->Blue;
+
 #if CS_DEBUG
-    uart_puts_P("\tPWM-Green:");
-    uart_put_uint16(sensor_led_tmp);
+    uart_puts_P("\nWhite check:");
 #endif
-// Addapt Blue channel
-    sensor_led_tmp = 255;
-    TLC59116_Set_PWM_Channel(0,sensor_led_tmp);
+    for(ch = 0; ch < 3; ch++)
+    {
+#if CS_DEBUG
+        uart_putc(' ');
+        uart_put_uint16(val[ch]);
+        uart_putc('/');
+        uart_put_uint16(ref[ch]);
+#endif
+        if(abs((int16_t)(val[ch] - ref[ch])) > (ref[ch] >> CS_WHITE_DRIFT_EXP))
+            return 1;
+    }
+    return 0;
+}
+
+
+/******** Variables of the average measurement ***************************
+**************************************************************************/
+
+static ADJD_S311_Data_t     *cs_average_result;
+static ADJD_S311_Data_t     cs_average_sample;
+static uint16_t             cs_average_sum[4];
+static uint8_t              cs_average_cnt;
+static uint8_t              cs_average_started;     // first measurement started
+static uint8_t              cs_average_retries;     // repetitions of the current measurement
+static uint16_t             cs_led_on_ticks;
+
+uint16_t                    cs_empty_clear = 0;
+uint8_t                     cs_average_empty;
+uint8_t                     cs_average_error;
+
+
+/********** CS_LED_Settle_Measure *****************************************
+Function:   CS_LED_Settle_Measure()
+Purpose:    Characterises the warm-up of the LEDs over a referecne white:
+            measures the settled light after CS_LED_SETTLE_MS and then
+            how long it takes from switching on until every channel is
+            within CS_LED_SETTLE_TOL_EXP of it. Sets cs_led_settle_ms to
+            this time plus CS_LED_SETTLE_MARGIN.
+Input:      none
+Returns:    the new settle time [ms]
+**************************************************************************/
+uint16_t
+CS_LED_Settle_Measure(void)
+{
+    ADJD_S311_Data_t reference, rgbw_data;
+    uint16_t t_on, t_conv;
+
+    // reference: the light after the full (old fixed) warm-up time
+    TLC59116_GRP_PWM_Set(0xFF);
+    _delay_ms(CS_LED_SETTLE_MS);
+    ADJD_S311_Data_Get(&reference);
+    TLC59116_GRP_PWM_Set(0);
+    _delay_ms(CS_LED_SETTLE_MS);
 
-    ADJD_S311_Data_Get(&rgbw_data);
-    while(rgbw_data.Blue > sensor_val_max)
+    // switch on and measure back to back until the light is settled
+    TLC59116_GRP_PWM_Set(0xFF);
+    t_on = MC_Ticks_Get();
+    do
     {
-        sensor_led_tmp --;
-        TLC59116_Set_PWM_Channel(0,sensor_led_tmp);
+        t_conv = MC_Ticks_Get() - t_on;
         ADJD_S311_Data_Get(&rgbw_data);
     }
-    p_sensor_led->Blue0 = sensor_led_tmp;
-    TLC59116_Set_PWM_Channel(2,0);
+    while(t_conv < CS_LED_SETTLE_MS
+            && (rgbw_data.Red + (reference.Red >> CS_LED_SETTLE_TOL_EXP) < reference.Red
+                || rgbw_data.Green + (reference.Green >> CS_LED_SETTLE_TOL_EXP) < reference.Green
+                || rgbw_data.Blue + (reference.Blue >> CS_LED_SETTLE_TOL_EXP) < reference.Blue));
+    TLC59116_GRP_PWM_Set(0);
+
+    // the sample that reached the reference started its integration at t_conv
+    cs_led_settle_ms = t_conv + CS_LED_SETTLE_MARGIN;
+    if (cs_led_settle_ms > CS_LED_SETTLE_MS)
+        cs_led_settle_ms = CS_LED_SETTLE_MS;
+
 #if CS_DEBUG
-    uart_puts_P("\tPWM-Blue:");
-    uart_put_uint16(sensor_led_tmp);
+    uart_puts_P("\nLED settle time [ms]:");
+    uart_put_uint16(cs_led_settle_ms);
 #endif
-    // write addapted channel values (saved @ p_sensor_led) to the TLC59116
-
-    TLC59116_Set_PWM_Block(p_sensor_led,0,6);
-    TLC59116_GRP_PWM_Set(0x00);
+    return cs_led_settle_ms;
 }
 
-
-/********** CS_Color_Avarerage_Get ****************************************
-Function:   CS_Color_Avarerage_Get()
-Purpose:    Call this function to get an avarage color of a smartie
-            This function switches on the LED...
-            makes a dfined number of measurements wich are summed to an
-            avg value
-Input:      pointer to Sensor_Data_t
+/********** CS_Color_Average_Start ****************************************
+Function:   CS_Color_Average_Start()
+Purpose:    Call this function to start the measurement of an avarage
+            color of a smartie.
+            This function switches on the LED and starts the first of
+            CS_MEASURE_CNTS measurements, call CS_Color_Average_Poll()
+            until it returns 1.
+Input:      pointer to Sensor_Data_t (valid when the measurement is done)
 Returns:    none
 **************************************************************************/
 void
-CS_Color_Average_Get(ADJD_S311_Data_t* p_smartie_color)
+CS_Color_Average_Start(ADJD_S311_Data_t* p_smartie_color)
 {
-    ADJD_S311_Data_t color_data_sum= {0},color_data_temp;
-    uint8_t ui8_tmp;
+    uint8_t sreg;
+
+    cs_average_result = p_smartie_color;
+    cs_average_sum[0] = cs_average_sum[1] = 0;
+    cs_average_sum[2] = cs_average_sum[3] = 0;
+    cs_average_cnt = 0;
+    cs_average_empty = 0;
+    cs_average_error = 0;
+    cs_average_started = 0;
+    cs_average_retries = 0;
+
     //switch on LED
     TLC59116_GRP_PWM_Set(0xFF);
-    _delay_ms(200);
-    _delay_ms(200);
-    _delay_ms(200);
 
+    // the timer0 ISR counts the warm-up down, CS_Color_Average_Poll()
+    // starts the first measurement when it is over
+    sreg = SREG;
+    cli();
+    cs_led_on_ticks = mc_ticks;
+    cs_led_settle_timer = cs_led_settle_ms;
+    SREG = sreg;
+}
 
-    for (ui8_tmp = 0; ui8_tmp<CS_MEASURE_CNTS; ui8_tmp++)
+/********** CS_Color_Average_Poll *****************************************
+Function:   CS_Color_Average_Poll()
+Purpose:    Call this function to continue the measurement started with
+            CS_Color_Average_Start(). It never waits for the LED or the
+            sensor: it sums up a finished measurement and starts the next one.
+            When all are done, it stores the avarage and switches off
+            the LED. A measurement with a twi error is repeated, after
+            CS_MEASURE_RETRIES it gives up with cs_average_error set.
+Input:      none
+Returns:    1 when the avarage color is done (valid unless
+            cs_average_error), 0 else
+**************************************************************************/
+uint8_t
+CS_Color_Average_Poll(void)
+{
+    uint16_t settle_timer;
+    uint8_t sreg;
+
+    if (cs_average_cnt >= CS_MEASURE_CNTS)
+        return 1;
+    // the ISR counts it down: read both bytes at once
+    sreg = SREG;
+    cli();
+    settle_timer = cs_led_settle_timer;
+    SREG = sreg;
+    if (settle_timer || ADJD_S311_Meas_Busy())
+        return 0;
+    if (!cs_average_started)
     {
-        ADJD_S311_Data_Get(&color_data_temp);
-        color_data_sum.Red    += color_data_temp.Red;
-        color_data_sum.Green  += color_data_temp.Green;
-        color_data_sum.Blue   += color_data_temp.Blue;
-        color_data_sum.Clear  += color_data_temp.Clear;
+        // the LED has settled (not started from the ISR: Meas_Start may
+        // wait for the TWI)
+        cs_led_settle_last = MC_Ticks_Get() - cs_led_on_ticks;
+        cs_average_started = 1;
+        ADJD_S311_Meas_Start(&cs_average_sample);
+        return 0;
+    }
+    if (ADJD_S311_Meas_State() == ADJD_S311_MEAS_ERROR)
+    {
+        // the sample is stale: neither sum it up nor check it for empty
+        if (cs_average_retries < CS_MEASURE_RETRIES)
+        {
+            cs_average_retries++;
+            ADJD_S311_Meas_Start(&cs_average_sample);
+            return 0;
+        }
+        cs_average_cnt = CS_MEASURE_CNTS;
+        cs_average_error = 1;
+#if CS_DEBUG
+        uart_puts_P("\nmeasurement failed");
+#endif
+        TLC59116_GRP_PWM_Set(0);
+        return 1;
+    }
+
+    cs_average_retries = 0;
+    cs_average_sum[0] += cs_average_sample.Red;
+    cs_average_sum[1] += cs_average_sample.Green;
+    cs_average_sum[2] += cs_average_sample.Blue;
+    cs_average_sum[3] += cs_average_sample.Clear;
+
+    // an empty slot needs no average (and no classification). It still
+    // pays the LED warm-up and one integration: a reading taken earlier,
+    // while the light rises, is darker and would take a smartie for empty
+    if (!cs_average_cnt && cs_average_sample.Clear < cs_empty_clear)
+    {
+        cs_average_cnt = CS_MEASURE_CNTS;
+        cs_average_empty = 1;
+        *cs_average_result = cs_average_sample;
+    }
+    else if (++cs_average_cnt < CS_MEASURE_CNTS)
+    {
+        ADJD_S311_Meas_Start(&cs_average_sample);
+        return 0;
+    }
+    else
+    {
+        cs_average_result->Red    = cs_average_sum[0] >> CS_MEASURE_EXP;
+        cs_average_result->Green  = cs_average_sum[1] >> CS_MEASURE_EXP;
+        cs_average_result->Blue   = cs_average_sum[2] >> CS_MEASURE_EXP;
+        cs_average_result->Clear  = cs_average_sum[3] >> CS_MEASURE_EXP;
     }
-    p_smartie_color->Red    = color_data_sum.Red >> CS_MEASURE_EXP;
-    p_smartie_color->Green  = color_data_sum.Green >> CS_MEASURE_EXP;
-    p_smartie_color->Blue   = color_data_sum.Blue >> CS_MEASURE_EXP;
-    p_smartie_color->Clear  = color_data_sum.Clear >> CS_MEASURE_EXP;
 
 #if CS_DEBUG
     uart_puts_P("\nred\tgreen\tblue\tclear\n:");
-    uart_put_uint16((uint16_t)p_smartie_color->Red);
+    uart_put_uint16((uint16_t)cs_average_result->Red);
     uart_puts_P("\t:");
-    uart_put_uint16((uint16_t)p_smartie_color->Green);
+    uart_put_uint16((uint16_t)cs_average_result->Green);
     uart_puts_P("\t:");
-    uart_put_uint16((uint16_t)p_smartie_color->Blue);
+    uart_put_uint16((uint16_t)cs_average_result->Blue);
     uart_puts_P("\t:");
-    uart_put_uint16((uint16_t)p_smartie_color->Clear);
+    uart_put_uint16((uint16_t)cs_average_result->Clear);
+    uart_puts_P("\tsettle:");
+    uart_put_uint16(cs_led_settle_last);
+    if (cs_average_empty)
+        uart_puts_P("\tempty");
 #endif
 
-    _delay_ms(10);
-
     //switch off LED
     TLC59116_GRP_PWM_Set(0);
+    return 1;
+}
+
+/********** CS_Color_Avarerage_Get ****************************************
+Function:   CS_Color_Avarerage_Get()
+Purpose:    Call this function to get an avarage color of a smartie
+            This function switches on the LED...
+            makes a dfined number of measurements wich are summed to an
+            avg value (blocking version of CS_Color_Average_Start/Poll)
+Input:      pointer to Sensor_Data_t
+Returns:    none
+**************************************************************************/
+void
+CS_Color_Average_Get(ADJD_S311_Data_t* p_smartie_color)
+{
+    CS_Color_Average_Start(p_smartie_color);
+    while (!CS_Color_Average_Poll());
 }
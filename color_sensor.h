@@ -41,10 +41,23 @@
 #define CS_MEASURE_CNTS     (1<<CS_MEASURE_EXP) //
 #define CS_MEASURE_EXP       2                   //Bitte eintragen!! 0->1 time
 // 1-> 2times; 2->4times
+#define CS_MEASURE_RETRIES  2       // a measurement with a twi error is repeated this often
 
 #define CS_MIN_VAL      31      // This value is the maximum value at dark measurement
 #define CS_MAX_VAL      600     // This value is achived at single channel LED addapttion
 
+// parameters of the gain addaption (CS_Gain_Addapt())
+#define CS_GAIN_CAP_RED     0xF     // number of integration capacitors per channel
+#define CS_GAIN_CAP_GREEN   0xF
+#define CS_GAIN_CAP_BLUE    0xF
+#define CS_GAIN_CAP_CLEAR   0xF
+#define CS_GAIN_INT_MAX     0xF0    // usefull maximum of the integration time slots
+
+// LED warm-up before a measurement (timer0 deadline, see CS_LED_Settle_Measure())
+#define CS_LED_SETTLE_MS        600 // default and upper limit of the settle time [ms]
+#define CS_LED_SETTLE_MARGIN    2   // added to the characterised settle time [ms]
+#define CS_LED_SETTLE_TOL_EXP   5   // settled when within reference/32 of the reference
+
 
 typedef struct CS_Sensor_LED_s
 {
@@ -57,6 +70,21 @@ typedef struct CS_Sensor_LED_s
 } CS_Sensor_LED_t;
 
 
+// calibration of the sensor in the EEPROM (CS_Calib_Store/_Restore())
+#define CS_CALIB_STAMP      0x5343  // "CS", changes when CS_Calib_t changes
+#define CS_WHITE_DRIFT_EXP  4       // recalibrate when white drifts > 1/16
+
+typedef struct CS_Calib_s
+{
+    uint16_t            Stamp;      // CS_CALIB_STAMP when written
+    ADJD_S311_Param_t   Param;      // result of CS_Gain_Addapt()
+    CS_Sensor_LED_t     LED;        // result of CS_LED_Addapt()
+    uint16_t            SettleMs;   // result of CS_LED_Settle_Measure()
+    ADJD_S311_Data_t    White;      // reference white with these settings
+    uint16_t            CRC;        // CRC-CCITT of all fields above
+} CS_Calib_t;
+
+
 /******** global variables of the color sensor ***************************
 **************************************************************************/
 
@@ -64,6 +92,19 @@ extern CS_Sensor_LED_t     cs_sensor_led;
 extern ADJD_S311_Data_t    cs_sensor_data;
 extern ADJD_S311_Param_t   cs_sensor_param;
 
+extern uint16_t            cs_led_settle_ms;       // LED warm-up [ms]
+extern uint16_t            cs_led_settle_last;     // warm-up of the last measurement [ms]
+extern volatile uint16_t   cs_led_settle_timer;    // counted down by the timer0 ISR
+
+extern ADJD_S311_Data_t    cs_white_ref;           // reference white of the calibration
+
+extern uint16_t            cs_empty_clear;         // clear below: empty slot (0: no check)
+extern uint8_t             cs_average_empty;       // last average stopped at an empty slot
+extern uint8_t             cs_average_error;       // last average failed, the result is not valid
+
+extern uint8_t             cs_led_addapt_conv;     // conversions of the last CS_LED_Addapt()
+extern uint16_t            cs_led_addapt_ms;       // time of the last CS_LED_Addapt() [ms]
+
 
 /*************************************************************************
 Function: CS_Init()
@@ -79,24 +120,37 @@ Function:   CS_Gain_Addapt()
 Purpose:    Call this function to addapt the sensor gain.
             It´s thougt to be called when only passive light reaches the
             sensor area, which should be placed over a referecne white!
-            According to the ambient light, this function will decrease
-            the sensitivity until every color channel is beyond a given
-            threshold
+            With the capacitor counts of CS_GAIN_CAP_xxx, this function
+            searches the longest integration time of every channel (up to
+            CS_GAIN_INT_MAX) whose offset stays below the given threshold.
+            It takes 8 offset conversions.
+            The result is left in *p_parameter and written to the sensor.
 Input:      pointer to Sensor_Param_t,threshold
 Returns:    none
 **************************************************************************/
 extern void
 CS_Gain_Addapt(ADJD_S311_Param_t *p_parameter,uint8_t dark_max);
 
+/*************************************************************************
+Function:   CS_Gain_Restore()
+Purpose:    Writes a parameter set found by CS_Gain_Addapt() to the sensor
+            again (e.g. after a reset of the sensor).
+Input:      pointer to Sensor_Param_t
+Returns:    none
+**************************************************************************/
+extern void
+CS_Gain_Restore(ADJD_S311_Param_t *p_parameter);
+
 
 /*************************************************************************
 Function:   CS_LED_Addapt()
 Purpose:    Call this function to addapt the light to the sensetivity.
             It´s thougt to be called when only passive light reaches the
             sensor area, which should be placed over a referecne white!
-            According to the sensitivity and ambient light, this function
-            will decrease PWM values of the single LED until every color
-            channel is beyond a given threshold
+            Finds the highest PWM value of every LED that keeps its color
+            channel below the given threshold, measured with only this
+            LED lit. The channels take turns in a successive approximation,
+            so it takes 3*8 conversions (see cs_led_addapt_conv/_ms).
 Input:      pointer to LED-PWM-Values,threshold
 Returns:    none
 **************************************************************************/
@@ -104,6 +158,85 @@ extern void
 CS_LED_Addapt(CS_Sensor_LED_t *p_sensor_led,
               uint16_t sensor_val_max);
 
+/*************************************************************************
+Function:   CS_Calib_Store()
+Purpose:    Stores the actual calibration (cs_sensor_param, cs_sensor_led,
+            cs_led_settle_ms and cs_white_ref) with stamp and CRC to the
+            EEPROM.
+Input:      none
+Returns:    none
+**************************************************************************/
+extern void
+CS_Calib_Store(void);
+
+/*************************************************************************
+Function:   CS_Calib_Restore()
+Purpose:    Reads the calibration from the EEPROM. When stamp and CRC are
+            valid, it is taken over and written to the sensor and the LED
+            driver.
+Input:      none
+Returns:    1 if the calibration was valid, 0 else
+**************************************************************************/
+extern uint8_t
+CS_Calib_Restore(void);
+
+/*************************************************************************
+Function:   CS_White_Drift()
+Purpose:    Compares a measurement of the reference white with
+            cs_white_ref.
+Input:      pointer to the measurement of the white
+Returns:    1 if a channel differs by more than 1/2^CS_WHITE_DRIFT_EXP,
+            0 else
+**************************************************************************/
+extern uint8_t
+CS_White_Drift(ADJD_S311_Data_t *p_white);
+
+/*************************************************************************
+Function:   CS_LED_Settle_Measure()
+Purpose:    Characterises the warm-up of the LEDs over a referecne white:
+            measures the settled light after CS_LED_SETTLE_MS and then
+            how long it takes from switching on until every channel is
+            within CS_LED_SETTLE_TOL_EXP of it. Sets cs_led_settle_ms to
+            this time plus CS_LED_SETTLE_MARGIN.
+            Call it after CS_LED_Addapt(), it blocks for about 1.2 s.
+Input:      none
+Returns:    the new settle time [ms]
+**************************************************************************/
+extern uint16_t
+CS_LED_Settle_Measure(void);
+
+/*************************************************************************
+Function:   CS_Color_Average_Start()
+Purpose:    Call this function to start the measurement of an avarage
+            color of a smartie.
+            This function switches on the LED and returns. The first of
+            CS_MEASURE_CNTS measurements is started by
+            CS_Color_Average_Poll() cs_led_settle_ms later (counted by
+            the timer0 ISR), call it until it returns 1.
+Input:      pointer to Sensor_Data_t (valid when the measurement is done)
+Returns:    none
+**************************************************************************/
+extern void
+CS_Color_Average_Start(ADJD_S311_Data_t* p_smartie_color);
+
+/*************************************************************************
+Function:   CS_Color_Average_Poll()
+Purpose:    Call this function to continue the measurement started with
+            CS_Color_Average_Start(). It never waits for the sensor.
+            If the clear channel of the first measurement is below
+            cs_empty_clear, the slot is empty: it stops at once with this
+            measurement as result and sets cs_average_empty (after the
+            warm-up and one integration, like any other slot).
+            A measurement with a twi error is repeated up to
+            CS_MEASURE_RETRIES times, then it gives up and sets
+            cs_average_error.
+Input:      none
+Returns:    1 when the avarage color is done (valid unless
+            cs_average_error), 0 else
+**************************************************************************/
+extern uint8_t
+CS_Color_Average_Poll(void);
+
 /*************************************************************************
 Function:   CS_Color_Avarerage_Get()
 Purpose:    Call this function to get an avarage color of a smartie
@@ -23,5 +23,17 @@
 #define FSM_DEBUG 0     //Debugschalter für die state machine (fsm.c)
 #endif
 
+#ifndef SCH_ACCOUNTING
+#define SCH_ACCOUNTING 0 //Läufe, mittlere Laufzeit und CPU-Last je Task, 'k' (scheduler.c, 8 Byte RAM je Task)
+#endif
+
+#ifndef FSM_LATENCY
+#define FSM_LATENCY 1   //Latenz der Stufen jedes Smarties, 't' und LCD (fsm.c, 98 Byte RAM), 0 nur für einen abgespeckten Build
+#endif
+
+#ifndef FSM_TRACE
+#define FSM_TRACE 0     //Trace der Zustandswechsel im RAM, 'F' gibt ihn aus (fsm.c, 164 Byte RAM)
+#endif
+
 
 #endif // _DEBUG_H
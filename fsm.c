@@ -17,6 +17,7 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -32,6 +33,7 @@
 #include "debug.h"
 #include "motion_controll.h"
 #include "fsm.h"
+#include "scheduler.h"
 
 #include "twi_lcd.h"
 #include "twi_mmi.h"
@@ -41,34 +43,139 @@
 
 //#define FSM_DEBUG 1 //defined @ debug.h
 
+#define FSM_CATCHER_RELEASE     100     // microsteps (~95 ms), see cond_all_done
+
 volatile uint8_t fsm_pause=1;
 
 enum fsm_mode cur_mode = md_init;
 
-enum fsm_state { st_reset,
-                 st_init_catcher,   //blocking
-                 st_init_conveyor,   //blocking
-                 st_move_conveyor_wht,
-                 st_init_cs,         //blocking
+/* The states in the order of the rows of fsm_table (see FSM_TABLE), the
+ * row index is computed from this order at compile time. */
+#define FSM_STATES(X) \
+    X(st_reset) \
+    X(st_homing)                /* catcher and conveyor in parallel */ \
+    X(st_homing_failed) \
+    X(st_move_conveyor_wht) \
+    X(st_check_cs) \
+    X(st_init_cs)               /* blocking */ \
+    X(st_cs_valid) \
+    \
+    X(st_init_done) \
+    X(st_enter_md_running) \
+    X(st_enter_md_pause) \
+    \
+    X(st_eject_smartie) \
+    X(st_move_catcher) \
+    X(st_get_color) \
+    X(st_attach_color) \
+    X(st_slot_empty)            /* the silo didn't deliver */ \
+    X(st_await_new_smartie) \
+    X(st_move_conveyor) \
+    \
+    X(st_enter_md_learning) \
+    X(st_learn_color)           /* waits for FSM_Learn_Key() */ \
+    X(st_correct_color) \
+    X(st_leave_md_learning)
+
+#define FSM_STATE_ENUM(state)   state,
+
+enum fsm_state { FSM_STATES(FSM_STATE_ENUM)
+                 st_max              // number of states
+               };
+enum fsm_state cur_state = st_reset, next_state = st_reset;
 
-                 st_init_done,
-                 st_enter_md_running,
-                 st_enter_md_learning,
-                 st_enter_md_pause,
+/**** FSM events **********************************************************
+posted by the drivers and the timer0 ISR, each event is queued once until
+FSM_Check_State() takes it (so the queue can't overflow)
+**************************************************************************/
 
-                 st_leave_md_learning,
+static uint8_t          fsm_ev_queue[ev_max] = {ev_entry};
+static uint8_t          fsm_ev_head = 0;
+static volatile uint8_t fsm_ev_cnt = 1;
+static volatile uint8_t fsm_ev_pending = FSM_EV(ev_entry);
+static SCH_Task_t       fsm_timer;
 
-                 st_eject_smartie,
-                 st_move_catcher,
-                 st_get_color,
-                 st_attach_color,
+/*************************************************************************
+Function: FSM_Event_Post()
+Purpose:  queues an event for the FSM (also from an ISR), an event that
+          is already queued is not queued again
+Input:    enum fsm_event
+Returns:  none
+**************************************************************************/
+void
+FSM_Event_Post(uint8_t event)
+{
+    uint8_t sreg = SREG;
 
-                 st_learn_color,
+    cli();
+    if(!(fsm_ev_pending & FSM_EV(event)))
+    {
+        fsm_ev_pending |= FSM_EV(event);
+        fsm_ev_queue[(fsm_ev_head + fsm_ev_cnt) % ev_max] = event;
+        fsm_ev_cnt++;
+    }
+    SREG = sreg;
+}
+
+/*************************************************************************
+Function: FSM_Event_Get()
+Purpose:  takes the oldest event from the queue
+Input:    none
+Returns:  enum fsm_event, ev_max if the queue is empty
+**************************************************************************/
+static uint8_t
+FSM_Event_Get(void)
+{
+    uint8_t sreg, event = ev_max;
+
+    // nothing to do in most loops: don't hold off the timer0 ISR then
+    if(!fsm_ev_cnt)
+        return ev_max;
+    sreg = SREG;
+    cli();
+    {
+        event = fsm_ev_queue[fsm_ev_head];
+        fsm_ev_head = (fsm_ev_head + 1) % ev_max;
+        fsm_ev_cnt--;
+        fsm_ev_pending &= ~FSM_EV(event);
+    }
+    SREG = sreg;
+    return event;
+}
+
+static void
+FSM_Timer_Expired(void)
+{
+    FSM_Event_Post(ev_timer);
+}
+
+/*************************************************************************
+Function: FSM_Timer_Start()
+Purpose:  posts ev_timer after the given time (one-shot task of the
+          scheduler, a running timer is restarted)
+Input:    ms (> 0)
+Returns:  none
+**************************************************************************/
+static void
+FSM_Timer_Start(uint16_t ms)
+{
+    if(!fsm_timer.run)
+        SCH_Task_Add(&fsm_timer,PSTR("fsm timer"),FSM_Timer_Expired,SCH_ONCE,0);
+    SCH_Task_Start(&fsm_timer,ms);
+}
+
+/*************************************************************************
+Function: FSM_Tick()
+Purpose:  called by the timer0 ISR every ms: posts ev_tick
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+FSM_Tick(void)
+{
+    FSM_Event_Post(ev_tick);
+}
 
-                 st_await_new_smartie,
-                 st_move_conveyor,
-               };
-enum fsm_state cur_state = st_reset, next_state = st_reset;
 
 /****** FSM conditions ***************************************************
 *************************************************************************/
@@ -84,9 +191,18 @@ static uint8_t cond_conveyor_idle(void)
 {
     return MC_Is_Conveyor_Idle();
 }
-static uint8_t cond_catcher_idle(void)
+
+static uint8_t fsm_homing;
+
+static uint8_t cond_homing_done(void)
+{
+    fsm_homing = MC_Homing_Poll();
+    return (fsm_homing == MC_HOMING_DONE) ? 1 : 0 ;
+}
+static uint8_t cond_homing_failed(void)
 {
-    return MC_Is_Catcher_Idle();
+    // result of the poll in cond_homing_done
+    return (fsm_homing == MC_HOMING_TIMEOUT) ? 1 : 0 ;
 }
 static uint8_t cond_md_init(void)
 {
@@ -94,7 +210,7 @@ static uint8_t cond_md_init(void)
 }
 static uint8_t cond_md_run(void)
 {
-    return (cur_mode == md_running) ? 1 : 0 ;
+    return (cur_mode == md_running || cur_mode == md_pipelined) ? 1 : 0 ;
 }
 static uint8_t cond_md_learn(void)
 {
@@ -109,15 +225,85 @@ static uint8_t cond_md_pause(void)
     return (cur_mode == md_pause)   ? 1 : 0 ;
 }
 
+static uint8_t fsm_learn_color = COLOR_MAX;     // COLOR_MAX: not typed yet
+
+static uint8_t cond_learn_key(void)
+{
+    return (fsm_learn_color != COLOR_MAX) ? 1 : 0 ;
+}
+
+/*************************************************************************
+Function: FSM_Learn_Key()
+Purpose:  passes the colour the user typed for the smartie shown at
+          "Is Color:" to the FSM (md_learning)
+Input:    enum COLOR
+Returns:  1 if the FSM waits for it, 0 if not (the key is another command)
+**************************************************************************/
+uint8_t
+FSM_Learn_Key(uint8_t color)
+{
+    if(cur_state != st_learn_color || color >= COLOR_MAX)
+        return 0;
+    fsm_learn_color = color;
+    FSM_Event_Post(ev_key);
+    return 1;
+}
+
+static uint8_t cond_color_done(void)
+{
+    return CS_Color_Average_Poll();
+}
+static uint8_t cond_slot_empty(void)
+{
+    if(!CS_Color_Average_Poll()) return 0;
+    return cs_average_empty && !cs_average_error;
+}
+
+static uint8_t fsm_cs_calib_valid;
+
+static uint8_t cond_cs_drift(void)
+{
+    // no valid calibration in the EEPROM, or the white check failed
+    if(!fsm_cs_calib_valid) return 1;
+    if(!CS_Color_Average_Poll()) return 0;
+    return cs_average_error || CS_White_Drift(&cs_sensor_data);
+}
+
+static uint8_t cond_cs_valid(void)
+{
+    if(!fsm_cs_calib_valid) return 0;
+    if(!CS_Color_Average_Poll()) return 0;
+    return !cs_average_error && !CS_White_Drift(&cs_sensor_data);
+}
+
 static uint8_t cond_all_done(void)
 {
-    if(!(MC_Is_Smartie_Ejected()))return 0;
-    if(!(MC_Is_Catcher_Idle()))return 0;
+    // pipelined: the conveyor only waits until the smartie has fallen,
+    // the solenoid recovers during the move (see cond_eject_ready)
+    if(cur_mode == md_pipelined)
+    {
+        if(!(MC_Is_Smartie_Loaded()))return 0;
+    }
+    else if(!(MC_Is_Smartie_Ejected()))return 0;
+    // the smartie falls half way through the conveyor move (> 120 ms),
+    // so the catcher may still be arriving when the conveyor starts
+    if(!(MC_Is_Near_Target(MC_AXIS_CATCHER,FSM_CATCHER_RELEASE)))
+    {
+        // look again half way to the predicted stop (ev_axis when idle)
+        FSM_Timer_Start(MC_Time_To_Idle(MC_AXIS_CATCHER)/2 + 1);
+        return 0;
+    }
     if(fsm_pause) return 0;
     // ??? if(!(SM_Is_Color_Attached))
     return 1;
 }
 
+static uint8_t cond_eject_ready(void)
+{
+    if(!(MC_Is_Smartie_Ejected()))return 0;
+    return MC_Is_Conveyor_Idle();
+}
+
 
 /**** FSM state table *****************************************************
 **************************************************************************/
@@ -127,45 +313,238 @@ struct fsm_s
     enum fsm_state  cur_state;
     enum fsm_state  next_state;
     uint8_t         (*condition)(void);
+    uint8_t         events;     // FSM_EV() of the events that may change the condition
 };
 
+#define EV_TICK     FSM_EV(ev_tick)
+#define EV_TIMER    FSM_EV(ev_timer)
+#define EV_AXIS     FSM_EV(ev_axis)
+#define EV_SOLENOID FSM_EV(ev_solenoid)
+#define EV_MODE     FSM_EV(ev_mode)
+#define EV_KEY      FSM_EV(ev_key)
+
+/* The condition of a row is evaluated when the state is entered and when
+ * one of the events of the row arrives. Conditions that poll a driver
+ * (homing, colour measurement) run on the 1 ms tick.
+ * The rows of a state are tried in table order, the rows have to be sorted
+ * by the actual state in the order of FSM_STATES (checked at compile time).
+ * X(arg, actual state, next state, condition, events) */
+#define FSM_TABLE(X,a) \
+    X(a, st_reset,              st_homing,              cond_true,          0) \
+    X(a, st_homing,             st_move_conveyor_wht,   cond_homing_done,   EV_TICK) \
+    X(a, st_homing,             st_homing_failed,       cond_homing_failed, EV_TICK) \
+    X(a, st_homing_failed,      st_homing,              cond_md_init,       EV_MODE) \
+    X(a, st_move_conveyor_wht,  st_check_cs,            cond_conveyor_idle, EV_AXIS) \
+    X(a, st_check_cs,           st_init_cs,             cond_cs_drift,      EV_TICK) \
+    X(a, st_check_cs,           st_cs_valid,            cond_cs_valid,      EV_TICK) \
+    X(a, st_init_cs,            st_init_done,           cond_true,          0) \
+    X(a, st_cs_valid,           st_init_done,           cond_true,          0) \
+    \
+    X(a, st_init_done,          st_enter_md_running,    cond_md_run,        EV_MODE) \
+    X(a, st_init_done,          st_enter_md_learning,   cond_md_learn,      EV_MODE) \
+    X(a, st_init_done,          st_enter_md_pause,      cond_md_pause,      EV_MODE) \
+    \
+    /* md_running: */ \
+    X(a, st_enter_md_running,   st_eject_smartie,       cond_true,          0) \
+    \
+    X(a, st_eject_smartie,      st_move_catcher,        cond_true,          0) \
+    X(a, st_move_catcher,       st_get_color,           cond_md_run,        EV_MODE) \
+    X(a, st_move_catcher,       st_learn_color,         cond_md_learn,      EV_MODE) \
+    X(a, st_get_color,          st_slot_empty,          cond_slot_empty,    EV_TICK) \
+    X(a, st_get_color,          st_attach_color,        cond_color_done,    EV_TICK) \
+    X(a, st_attach_color,       st_await_new_smartie,   cond_true,          0) \
+    X(a, st_slot_empty,         st_await_new_smartie,   cond_true,          0) \
+    X(a, st_await_new_smartie,  st_move_conveyor,       cond_all_done, \
+                                        EV_SOLENOID | EV_AXIS | EV_TIMER | EV_MODE) \
+    X(a, st_move_conveyor,      st_eject_smartie,       cond_eject_ready,   EV_SOLENOID | EV_AXIS) \
+    \
+    /* md_learning: */ \
+    X(a, st_enter_md_learning,  st_eject_smartie,       cond_true,          0) \
+    X(a, st_learn_color,        st_correct_color,       cond_learn_key,     EV_KEY) \
+    X(a, st_learn_color,        st_leave_md_learning,   cond_md_not_learn,  EV_MODE) \
+    X(a, st_correct_color,      st_get_color,           cond_md_learn,      EV_MODE) \
+    X(a, st_correct_color,      st_leave_md_learning,   cond_md_not_learn,  EV_MODE) \
+    X(a, st_leave_md_learning,  st_get_color,           cond_true,          0)
+
+#define FSM_ROW(a,cur,next,cond,ev)     {cur, next, cond, ev},
+
 const struct fsm_s PROGMEM fsm_table[]  =
 {
-    // actual state         next state              condition
-    //
-    {st_reset,              st_init_catcher,        cond_true},
-    {st_init_catcher,       st_init_conveyor,       cond_catcher_idle},
-    {st_init_conveyor,      st_move_conveyor_wht,   cond_conveyor_idle},
-    {st_move_conveyor_wht,  st_init_cs,             cond_conveyor_idle},
-    {st_init_cs,            st_init_done,           cond_true},
+    FSM_TABLE(FSM_ROW,0)
+};
 
-    {st_init_done,          st_enter_md_running,    cond_md_run},
-    {st_init_done,          st_enter_md_learning,   cond_md_learn},
-    {st_init_done,          st_enter_md_pause,      cond_md_pause},
+#define FSM_ROWS    (sizeof(fsm_table)/sizeof(struct fsm_s))
 
-    /* md_running:*/
-    {st_enter_md_running,   st_eject_smartie,       cond_true},
+/**** FSM row index *******************************************************
+rows fsm_table[fsm_row_first[state]] .. fsm_table[fsm_row_first[state+1]-1]
+belong to the state. The first row of a state is the number of rows of
+the states before it, a constant expression summed up over FSM_TABLE.
+**************************************************************************/
 
-    {st_eject_smartie,      st_move_catcher,        cond_true},
-    {st_move_catcher,       st_get_color,          cond_md_run},
-    {st_get_color,         st_attach_color,       cond_true},
-    {st_attach_color,      st_await_new_smartie,   cond_true},
-    {st_await_new_smartie,  st_move_conveyor,       cond_all_done},
-    {st_move_conveyor,      st_eject_smartie,       cond_conveyor_idle},
+#define FSM_BELOW(state,cur,next,cond,ev)   + ((cur) < (state))
+#define FSM_FIRST(state)                    (0 FSM_TABLE(FSM_BELOW,state))
+#define FSM_STATE_FIRST(state)              fsm_first_##state = FSM_FIRST(state),
 
-    /*md_learning:*/
-    {st_enter_md_learning,  st_eject_smartie,       cond_true},
+enum { FSM_STATES(FSM_STATE_FIRST) };
 
+const uint8_t PROGMEM fsm_row_first[st_max+1] =
+{
+#define FSM_ROW_FIRST(state)    fsm_first_##state,
+    FSM_STATES(FSM_ROW_FIRST)
+    FSM_ROWS
+};
 
-    {st_move_catcher,       st_learn_color,        cond_md_learn},
-    {st_learn_color,       st_get_color,          cond_md_learn},
-    {st_learn_color,       st_leave_md_learning,   cond_md_not_learn},
-    {st_leave_md_learning,  st_get_color,          cond_true},
+/* sorted when every row is at or after the first row of its state,
+ * __COUNTER__ - base - 1 is the index of the row */
+enum { fsm_sorted_base = __COUNTER__ };
+#define FSM_UNSORTED(base,cur,next,cond,ev) \
+    + (fsm_first_##cur > __COUNTER__ - (base) - 1)
+_Static_assert((0 FSM_TABLE(FSM_UNSORTED,fsm_sorted_base)) == 0,
+               "fsm_table: rows not sorted by the actual state (FSM_STATES)");
 
 
-};
 
 
+/**** throughput counter ************************************************
+**************************************************************************/
+
+static uint16_t fsm_startup_ms;     // ticks at st_init_done
+static uint16_t fsm_sorted_cnt;
+static uint16_t fsm_empty_cnt;      // slots the silo didn't fill
+static uint16_t fsm_sorted_ticks;   // time of the last sorted smartie
+static uint32_t fsm_sorted_ms;      // time from the first to the last one
+
+static void
+FSM_Throughput_Count(void)
+{
+    uint16_t ticks = MC_Ticks_Get();
+
+    if(fsm_sorted_cnt)
+        fsm_sorted_ms += (uint16_t)(ticks - fsm_sorted_ticks);
+    fsm_sorted_ticks = ticks;
+    fsm_sorted_cnt++;
+}
+
+/*************************************************************************
+Function: FSM_Throughput_Get()
+Purpose:  sorting rate since the sorter was started (md_running or
+          md_pipelined), counted from the first to the last sorted smartie
+Input:    pointer for the number of sorted smarties (or NULL)
+Returns:  smarties per minute
+**************************************************************************/
+uint16_t
+FSM_Throughput_Get(uint16_t *p_count)
+{
+    if(p_count)
+        *p_count = fsm_sorted_cnt;
+    if(fsm_sorted_cnt < 2 || !fsm_sorted_ms)
+        return 0;
+    return (uint16_t)((fsm_sorted_cnt - 1) * 60000UL / fsm_sorted_ms);
+}
+
+
+/*************************************************************************
+Function: FSM_Empty_Get()
+Purpose:  number of empty slots since the sorter was started, they are
+          neither classified nor sorted
+Input:    none
+Returns:  count
+**************************************************************************/
+uint16_t
+FSM_Empty_Get(void)
+{
+    return fsm_empty_cnt;
+}
+
+
+/*************************************************************************
+Function: FSM_Startup_Get()
+Purpose:  time from the reset until the sorter was ready (st_init_done)
+Input:    none
+Returns:  ms, 0 while still initialising
+**************************************************************************/
+uint16_t
+FSM_Startup_Get(void)
+{
+    return fsm_startup_ms;
+}
+
+
+/**** stage latency ******************************************************
+the stages are taken from the timestamps of the conveyor slots. Only slots
+the silo was seen to load (fsm_lat_slots) add to eject, transport, drop and
+total, the percentiles are estimated by steps of 1/64 towards each sample.
+Only with FSM_LATENCY (debug.h).
+**************************************************************************/
+#if FSM_LATENCY
+
+typedef struct fsm_latency_s
+{
+    uint16_t    cnt;
+    uint32_t    avg16;          // rolling average * 16
+    uint16_t    p50, p90, max;
+} fsm_latency_t;
+
+static fsm_latency_t    fsm_latency[sg_max];
+static uint16_t         fsm_lat_slots;      // bit per slot index
+
+static uint16_t
+FSM_Latency_Step(uint16_t q, uint16_t ms, uint8_t up, uint16_t max)
+{
+    uint16_t step = (q >> 6) + 1;
+
+    if(ms > q)
+    {
+        step *= up;
+        q = (max - q < step) ? max : q + step;
+    }
+    else if(ms < q)
+        q = (q > step) ? q - step : 0;
+    return q;
+}
+
+static void
+FSM_Latency_Add(uint8_t stage, uint16_t ms)
+{
+    fsm_latency_t *lat = &fsm_latency[stage];
+
+    if(!lat->cnt)
+    {
+        lat->avg16 = (uint32_t)ms << 4;
+        lat->p50 = lat->p90 = lat->max = ms;
+    }
+    else
+    {
+        lat->avg16 -= lat->avg16 >> 4;
+        lat->avg16 += ms;
+        if(ms > lat->max)
+            lat->max = ms;
+        lat->p50 = FSM_Latency_Step(lat->p50, ms, 1, lat->max);
+        lat->p90 = FSM_Latency_Step(lat->p90, ms, 9, lat->max);
+    }
+    if(lat->cnt < 0xFFFF)
+        lat->cnt++;
+}
+
+/*************************************************************************
+Function: FSM_Latency_Get()
+Purpose:  latency of a stage of the smarties sorted since the sorter was
+          started (md_running or md_pipelined)
+Input:    enum fsm_stage, pointer for the result [ms]
+Returns:  none
+**************************************************************************/
+void
+FSM_Latency_Get(uint8_t stage, FSM_Latency_t *p_lat)
+{
+    fsm_latency_t *lat = &fsm_latency[stage];
+
+    p_lat->cnt = lat->cnt;
+    p_lat->avg = (uint16_t)(lat->avg16 >> 4);
+    p_lat->p50 = lat->p50;
+    p_lat->p90 = lat->p90;
+    p_lat->max = lat->max;
+}
+#endif // FSM_LATENCY
 
 
 /*************************************************************************
@@ -178,37 +557,68 @@ void
 FSM_Execute(enum fsm_state state)
 {
     enum COLOR temp_col=0;
+#if FSM_LATENCY
     uint16_t temp_ui16 = 0;
+#endif
+    MC_Slot_t *temp_slot;
     {
         switch (state)
         {
         case st_reset:
             break;
-        case st_init_catcher:
-            MC_Catcher_Init();
+        case st_homing:
+            MC_Homing_Start(_BV(MC_AXIS_CATCHER) | _BV(MC_AXIS_CONVEYOR));
             break;
-        case st_init_conveyor:
-            MC_Conveyor_Init();
+        case st_homing_failed:
+            // wait for the operator, 'b' sets md_init again and retries
+            cur_mode = md_idle;
+            uart_puts_P("\n\rHoming timeout, 'b' to retry");
             break;
         case st_move_conveyor_wht:
             // TODO: implement a clearer positioning for the conveyor
             MC_Conveyor_Set_Position(-1);
             break;
+        case st_check_cs:
+            // restore the calibration and check it on the white
+            fsm_cs_calib_valid = CS_Calib_Restore();
+            if(fsm_cs_calib_valid)
+                CS_Color_Average_Start(&cs_sensor_data);
+            break;
         case st_init_cs:
             CS_Gain_Addapt(&cs_sensor_param,CS_MIN_VAL);
             CS_LED_Addapt(&cs_sensor_led,CS_MAX_VAL);
+            CS_LED_Settle_Measure();
+            CS_Color_Average_Get(&cs_white_ref);
+            CS_Calib_Store();
+            MC_Conveyor_Set_Position(+1);
+            break;
+        case st_cs_valid:
             MC_Conveyor_Set_Position(+1);
             break;
+        case st_init_done:
+            fsm_startup_ms = MC_Ticks_Get();
+            break;
+        case st_enter_md_pause:
+            break;
 
         case st_enter_md_running:
-            for(uint8_t ui8 = 0; ui8 < MC_CONVEYOR_SLOTS; ui8 ++)
-                mc_smartie_table[ui8] = 0;      //Unknown;cs_sensor_data$
-            mc_conveyor_position_index = 0;
+            MC_Slots_Clear();
+            cs_empty_clear = SM_Empty_Clear();
+            fsm_sorted_cnt = 0;
+            fsm_empty_cnt = 0;
+            fsm_sorted_ms = 0;
+#if FSM_LATENCY
+            memset(fsm_latency,0,sizeof(fsm_latency));
+            fsm_lat_slots = 0;
+#endif
             break;
         case st_enter_md_learning:
+            // every slot gets a colour from the user, even an empty one
+            cs_empty_clear = 0;
             break;
         case st_leave_md_learning:
             SM_Colors_Store();
+            cs_empty_clear = SM_Empty_Clear();
         case st_eject_smartie:
 #if FSM_DEBUG
             uart_puts_P("\n C-Pos:");
@@ -217,65 +627,259 @@ FSM_Execute(enum fsm_state state)
             MC_Eject_Smartie();
             break;
         case st_move_catcher:
-            temp_col = (mc_smartie_table[((mc_conveyor_position_index+4)%MC_CONVEYOR_SLOTS)]);
-            MC_Catcher_Set_Position(temp_col);
+            // plan the catcher for the slots up to the sensor, do the first move
+            temp_col = MC_Catcher_Plan();
+            if(temp_col != COLOR_MAX)
+            {
+                MC_Catcher_Count(temp_col);
+                MC_Catcher_Set_Position(temp_col);
+#if FSM_LATENCY
+                FSM_Latency_Add(sg_catcher,mc_catcher_plan[0].ms);
+#endif
+            }
 #if FSM_DEBUG
             uart_puts_P("\tColor C:");
             uart_put_uint16(temp_col);
 #endif
             break;
         case st_learn_color:
+            // the slot measured before the last conveyor move, the console
+            // passes the answer with FSM_Learn_Key()
+            temp_slot = MC_Slot_Get(MC_SLOT_SENSOR+1);
             uart_puts_P("\n Is Color:");
-            uart_put_uint16(mc_smartie_table[(mc_conveyor_position_index+9)%10]);
-            while((temp_ui16 = uart_getc())==UART_NO_DATA);
-            temp_col = ((uint8_t)temp_ui16)-'0';
-            mc_smartie_table[(mc_conveyor_position_index+9)%10]=temp_col;
-            SM_Color_Correct(&cs_sensor_data,temp_col);
+            uart_put_uint16(temp_slot->color);
+            fsm_learn_color = COLOR_MAX;
+            break;
+        case st_correct_color:
+            temp_slot = MC_Slot_Get(MC_SLOT_SENSOR+1);
+            temp_col = fsm_learn_color;
+            temp_slot->color = temp_col;
+            MC_Slot_Set_State(temp_slot,MC_SLOT_CLASSIFIED);
+            SM_Color_Correct(&temp_slot->rgbw,temp_col);
             break;
         case st_get_color:
-            CS_Color_Average_Get(&cs_sensor_data);
+            // the measurement runs in the background (cond_color_done)
+            temp_slot = MC_Slot_Get(MC_SLOT_SENSOR);
+#if FSM_LATENCY
+            temp_ui16 = _BV(MC_Slot_Index(MC_SLOT_SENSOR));
+            if(temp_slot->state == MC_SLOT_TRANSPORT)
+                fsm_lat_slots |= temp_ui16;
+            else
+                fsm_lat_slots &= ~temp_ui16;
+#endif
+            MC_Slot_Set_State(temp_slot,MC_SLOT_MEASURING);
+            CS_Color_Average_Start(&cs_sensor_data);
             break;
         case st_attach_color:
+            temp_slot = MC_Slot_Get(MC_SLOT_SENSOR);
+            temp_slot->rgbw = cs_sensor_data;
+            MC_Slot_Set_State(temp_slot,MC_SLOT_MEASURED);
+            // no valid colour after a failed measurement: reject it
+            temp_col = cs_average_error ? Unknown : SM_Color_Attach(&temp_slot->rgbw);
+            temp_slot->color = temp_col;
+            MC_Slot_Set_State(temp_slot,MC_SLOT_CLASSIFIED);
+            if(temp_col != Unknown)
+                FSM_Throughput_Count();
+#if FSM_LATENCY
+            if(fsm_lat_slots & _BV(MC_Slot_Index(MC_SLOT_SENSOR)))
+            {
+                FSM_Latency_Add(sg_eject,
+                                MC_Slot_Ms(temp_slot,MC_SLOT_LOADED,MC_SLOT_TRANSPORT));
+                FSM_Latency_Add(sg_transport,
+                                MC_Slot_Ms(temp_slot,MC_SLOT_TRANSPORT,MC_SLOT_MEASURING));
+            }
+            temp_ui16 = MC_Slot_Ms(temp_slot,MC_SLOT_MEASURING,MC_SLOT_MEASURED);
+            FSM_Latency_Add(sg_settle,cs_led_settle_last);
+            FSM_Latency_Add(sg_integrate,temp_ui16 > cs_led_settle_last ?
+                            temp_ui16 - cs_led_settle_last : 0);
+            FSM_Latency_Add(sg_classify,
+                            MC_Slot_Ms(temp_slot,MC_SLOT_MEASURED,MC_SLOT_CLASSIFIED));
+#endif
 #if FSM_DEBUG
             uart_puts_P("\tColor S:");
-            uart_put_uint16(mc_smartie_table[mc_conveyor_position_index] = SM_Color_Attach(&cs_sensor_data));
-#else
-            mc_smartie_table[mc_conveyor_position_index] = SM_Color_Attach(&cs_sensor_data);
+            uart_put_uint16(temp_col);
+#endif
+            break;
+        case st_slot_empty:
+            // no colour: the planner leaves the catcher where it is
+            temp_slot = MC_Slot_Get(MC_SLOT_SENSOR);
+            temp_slot->rgbw = cs_sensor_data;
+            MC_Slot_Set_State(temp_slot,MC_SLOT_EMPTY);
+            fsm_empty_cnt++;
+#if FSM_DEBUG
+            uart_puts_P("\tempty");
 #endif
             break;
         case st_await_new_smartie:
             break;
         case st_move_conveyor:
             MC_Conveyor_Set_Position(+2);
+#if FSM_LATENCY
+            // the slot that drops during this move
+            temp_slot = MC_Slot_Get(MC_SLOT_DROP+1);
+            temp_ui16 = _BV(MC_Slot_Index(MC_SLOT_DROP+1));
+            if(temp_slot->state == MC_SLOT_DROPPED && (fsm_lat_slots & temp_ui16))
+            {
+                FSM_Latency_Add(sg_drop,
+                                MC_Slot_Ms(temp_slot,MC_SLOT_CLASSIFIED,MC_SLOT_DROPPED));
+                FSM_Latency_Add(sg_total,
+                                MC_Slot_Ms(temp_slot,MC_SLOT_LOADED,MC_SLOT_DROPPED));
+            }
+            fsm_lat_slots &= ~temp_ui16;
+#endif
 #if FSM_DEBUG
             uart_puts_P("\t nPos:");
             uart_put_uint16(mc_conveyor_position_index);
 #endif
             break;
+        case st_max:
+            break;
         }
     }
 }
 
+/**** FSM transition trace ***********************************************
+the last FSM_TRACE_LEN transitions with their time, in RAM until
+FSM_Trace_Dump() prints them (printing each one would distort the timing),
+only with FSM_TRACE (debug.h)
+**************************************************************************/
+#if FSM_TRACE
+
+#define FSM_TRACE_LEN   32          // power of 2
+
+typedef struct fsm_trace_s
+{
+    uint16_t    ticks;              // MC_Ticks_Get() at the transition
+    uint8_t     from;               // enum fsm_state
+    uint8_t     to;
+    uint8_t     event;              // enum fsm_event the condition was evaluated on
+} fsm_trace_t;
+
+static fsm_trace_t  fsm_trace[FSM_TRACE_LEN];
+static uint8_t      fsm_trace_head;     // next entry written
+static uint8_t      fsm_trace_cnt;      // entries since the last dump
+static uint16_t     fsm_trace_lost;     // overwritten since the last dump
+
+static void
+FSM_Trace(uint8_t from, uint8_t to, uint8_t event)
+{
+    fsm_trace_t *t = &fsm_trace[fsm_trace_head];
+
+    t->ticks = MC_Ticks_Get();
+    t->from = from;
+    t->to = to;
+    t->event = event;
+    fsm_trace_head = (fsm_trace_head + 1) & (FSM_TRACE_LEN - 1);
+    if(fsm_trace_cnt < FSM_TRACE_LEN)
+        fsm_trace_cnt++;
+    else
+        fsm_trace_lost++;
+}
+
+/*************************************************************************
+Function: FSM_Trace_Dump()
+Purpose:  prints the transitions traced since the last dump as CSV
+          (ms,from,to,event; the states and events as numbers of their
+          enums) followed by the number of lost ones, and clears the trace
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+FSM_Trace_Dump(void)
+{
+    fsm_trace_t *t;
+    char buffer[8];
+    uint8_t ui8 = (fsm_trace_head - fsm_trace_cnt) & (FSM_TRACE_LEN - 1);
+
+    uart_puts_P("\nms,from,to,event\n");
+    for(; fsm_trace_cnt; fsm_trace_cnt--)
+    {
+        t = &fsm_trace[ui8];
+        uart_puts(utoa(t->ticks,buffer,10));
+        uart_putc(',');
+        uart_puts(utoa(t->from,buffer,10));
+        uart_putc(',');
+        uart_puts(utoa(t->to,buffer,10));
+        uart_putc(',');
+        uart_puts(utoa(t->event,buffer,10));
+        uart_putc('\n');
+        ui8 = (ui8 + 1) & (FSM_TRACE_LEN - 1);
+    }
+    uart_puts_P("lost,");
+    uart_puts(utoa(fsm_trace_lost,buffer,10));
+    uart_putc('\n');
+    fsm_trace_lost = 0;
+}
+#endif // FSM_TRACE
+
+
+/**** main loop rate ****************************************************
+**************************************************************************/
+
+static uint32_t fsm_loop_cnt;
+static uint32_t fsm_loop_rate;      // FSM_Check_State() calls per second
+static uint16_t fsm_loop_ticks;
+
+/*************************************************************************
+Function: FSM_Loop_Rate_Get()
+Purpose:  iterations of the main loop (calls of FSM_Check_State()),
+          averaged over about a second
+Input:    none
+Returns:  iterations per second
+**************************************************************************/
+uint32_t
+FSM_Loop_Rate_Get(void)
+{
+    return fsm_loop_rate;
+}
+
 /*************************************************************************
 Function: FSM_Check_State()
-Purpose:
+Purpose:  takes the next event and evaluates the rows of the actual state
+          (only those, see fsm_row_first) that wait for it. Executes the first
+          transition found, entering the new state posts ev_entry.
 Input:    none
 Returns:  none
 **************************************************************************/
 void
 FSM_Check_State(void)
 {
-    for(uint8_t ui8=0; ui8<sizeof(fsm_table)/sizeof(struct fsm_s); ui8++)
+    const struct fsm_s *row;
+    uint8_t event, last;
+    uint16_t ms;
+
+    // look at the clock only every 256 loops, it costs more than the loop
+    if(!(uint8_t)(++fsm_loop_cnt))
     {
-        if(cur_state == pgm_read_byte(&fsm_table[ui8].cur_state))
+        ms = MC_Ticks_Get() - fsm_loop_ticks;
+        if(ms >= 1000)
         {
-            if(((uint8_t (*)(void))pgm_read_word(&fsm_table[ui8].condition))())
-            {
-                cur_state=pgm_read_byte(&fsm_table[ui8].next_state);
+            fsm_loop_rate = fsm_loop_cnt * 1000 / ms;
+            fsm_loop_cnt = 0;
+            fsm_loop_ticks += ms;
+        }
+    }
 
-                FSM_Execute(cur_state);
-                break;
-            }
+    if((event = FSM_Event_Get()) == ev_max)
+        return;
+
+    last = pgm_read_byte(&fsm_row_first[cur_state+1]);
+    for(row = &fsm_table[pgm_read_byte(&fsm_row_first[cur_state])];
+        row < &fsm_table[last]; row++)
+    {
+        if(event != ev_entry && !(pgm_read_byte(&row->events) & FSM_EV(event)))
+            continue;
+        if(((uint8_t (*)(void))pgm_read_word(&row->condition))())
+        {
+            next_state=pgm_read_byte(&row->next_state);
+#if FSM_TRACE
+            FSM_Trace(cur_state,next_state,event);
+#endif
+            cur_state=next_state;
+
+            FSM_Execute(cur_state);
+            FSM_Event_Post(ev_entry);
+            break;
         }
     }
 }
@@ -29,10 +29,73 @@ enum fsm_mode { md_idle=0,
                 md_init,
                 md_learning,
                 md_running,
-                md_pause
+                md_pause,
+                md_pipelined    // md_running with overlapped eject and conveyor move
               };
 extern enum fsm_mode cur_mode;
 
+// events that make the FSM evaluate its conditions (see fsm_table)
+enum fsm_event { ev_entry=0,     // the actual state was entered
+                 ev_tick,        // 1 ms, for conditions that poll a driver
+                 ev_timer,       // the one-shot timer of the FSM expired
+                 ev_axis,        // a motor stopped
+                 ev_solenoid,    // the solenoid switched
+                 ev_mode,        // cur_mode or fsm_pause changed
+                 ev_key,         // the colour of a learned smartie was typed
+                 ev_max
+               };
+#define FSM_EV(ev)      (1<<(ev))
+
+// stages of a smartie from the eject to the drop (see FSM_Latency_Get())
+enum fsm_stage { sg_eject=0,     // solenoid pulled .. conveyor starts
+                 sg_transport,   // conveyor start .. measurement starts
+                 sg_settle,      // LED warm-up
+                 sg_integrate,   // sensor conversions (measurement - warm-up)
+                 sg_classify,    // measured .. colour attached
+                 sg_catcher,     // catcher move (predicted)
+                 sg_drop,        // colour attached .. falls into the bin
+                 sg_total,       // eject .. falls into the bin
+                 sg_max
+               };
+
+typedef struct FSM_Latency_s
+{
+    uint16_t    cnt;            // samples since the sorter was started
+    uint16_t    avg;            // rolling average over about 16 samples
+    uint16_t    p50;            // estimated median
+    uint16_t    p90;            // estimated 90th percentile
+    uint16_t    max;
+} FSM_Latency_t;
+
+/*************************************************************************
+Function: FSM_Event_Post()
+Purpose:  queues an event for the FSM (also from an ISR), an event that
+          is already queued is not queued again
+Input:    enum fsm_event
+Returns:  none
+**************************************************************************/
+extern void
+FSM_Event_Post(uint8_t event);
+
+/*************************************************************************
+Function: FSM_Learn_Key()
+Purpose:  passes the colour the user typed for the smartie shown at
+          "Is Color:" to the FSM (md_learning)
+Input:    enum COLOR
+Returns:  1 if the FSM waits for it, 0 if not (the key is another command)
+**************************************************************************/
+extern uint8_t
+FSM_Learn_Key(uint8_t color);
+
+/*************************************************************************
+Function: FSM_Tick()
+Purpose:  called by the timer0 ISR every ms: posts ev_tick
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+FSM_Tick(void);
+
 
 /*************************************************************************
 Function: FSM_check_state()
@@ -43,5 +106,67 @@ Returns:  none
 extern void
 FSM_Check_State(void);
 
+/*************************************************************************
+Function: FSM_Trace_Dump()
+Purpose:  prints the transitions traced since the last dump as CSV
+          (ms,from,to,event; the states and events as numbers of their
+          enums) followed by the number of lost ones, and clears the trace
+          (only with FSM_TRACE, see debug.h)
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+FSM_Trace_Dump(void);
+
+/*************************************************************************
+Function: FSM_Loop_Rate_Get()
+Purpose:  iterations of the main loop (calls of FSM_Check_State()),
+          averaged over about a second
+Input:    none
+Returns:  iterations per second
+**************************************************************************/
+extern uint32_t
+FSM_Loop_Rate_Get(void);
+
+/*************************************************************************
+Function: FSM_Throughput_Get()
+Purpose:  sorting rate since the sorter was started (md_running or
+          md_pipelined), counted from the first to the last sorted smartie
+Input:    pointer for the number of sorted smarties (or NULL)
+Returns:  smarties per minute
+**************************************************************************/
+extern uint16_t
+FSM_Throughput_Get(uint16_t *p_count);
+
+/*************************************************************************
+Function: FSM_Empty_Get()
+Purpose:  number of empty slots since the sorter was started, they are
+          neither classified nor sorted
+Input:    none
+Returns:  count
+**************************************************************************/
+extern uint16_t
+FSM_Empty_Get(void);
+
+/*************************************************************************
+Function: FSM_Startup_Get()
+Purpose:  time from the reset until the sorter was ready (st_init_done)
+Input:    none
+Returns:  ms, 0 while still initialising
+**************************************************************************/
+extern uint16_t
+FSM_Startup_Get(void);
+
+/*************************************************************************
+Function: FSM_Latency_Get()
+Purpose:  latency of a stage of the smarties sorted since the sorter was
+          started (md_running or md_pipelined), only with FSM_LATENCY
+          (see debug.h)
+Input:    enum fsm_stage, pointer for the result [ms]
+Returns:  none
+**************************************************************************/
+extern void
+FSM_Latency_Get(uint8_t stage, FSM_Latency_t *p_lat);
+
 
 #endif
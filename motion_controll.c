@@ -22,24 +22,31 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/signal.h>
 #include <avr/pgmspace.h>
+#include <avr/eeprom.h>
 #include <util/twi.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 
 #include "uart.h"
 #include "twi_master.h"
 #include "TMC222.h"
 #include "smarties.h"
 #include "debug.h"
+#include "color_sensor.h"
 #include "motion_controll.h"
+#include "fsm.h"
 
 #define debug 1
 
 #define MC_SOLENOID_ON_TIME    400
 #define MC_SOLENOID_OFF_TIME   400
+#define MC_HOMING_TIMEOUT_MS   15000   // a turn of the catcher at vmin takes ~11 s
+#define MC_HOMING_BACKOFF      900     // > stop ramp from VMax with Acc 2 (~730)
 
 
 // defines and defaults of the parameters of the catcher motor:
@@ -70,6 +77,69 @@ int16_t mc_catcher_position_cnt = 0;
 uint8_t mc_catcher_position_index = 0;
 int16_t mc_catcher_position_table[9] = {0,356,711,1067,1422,1778,2133,2489,2844};
 
+// bin of the catcher (index of mc_catcher_position_table) for each colour
+uint8_t mc_catcher_bin[COLOR_MAX] = {0,1,2,3,4,5,6,7,8};
+
+// colour transitions of the smarties in drop order, for the bin assignment
+// (8 bit: only the ratios count, all are halved before one overflows)
+static uint8_t  mc_catcher_trans[COLOR_MAX][COLOR_MAX];
+static uint8_t  mc_catcher_last_color = COLOR_MAX;   // none since reset
+
+#define MC_BINS_STAMP           0x4D42  // "MB"
+
+typedef struct MC_Bins_s
+{
+    uint16_t    Stamp;
+    uint8_t     Bin[COLOR_MAX];
+    uint16_t    CRC;
+} MC_Bins_t;
+
+static MC_Bins_t EEMEM mc_bins_ee;
+
+/* ramps of the catcher by the distance of the move in bins (shortest way,
+ * at most 4 of the 9 bins).
+ * The shorter the move, the lower its peak speed stays and the steeper the
+ * ramp may be (the torque of the stepper falls with the speed). Entry 0 are
+ * the working parameters above, used for the homing (see MC_HOMING_BACKOFF).
+ * There is no step mode selection: the StepMode stays 3 (1/16), the position
+ * table is in its microsteps.
+ *
+ * The pairs are picked by hand with TMC222_Move_Time(), not measured on the
+ * machine. A bin is 356 microsteps = 22.25 full steps, VMin 2 starts the
+ * ramps at v/16:
+ * - VMax 8 (303 full steps/s) is the top speed of the working parameters,
+ *   moves of 1 and 2 bins don't go faster.
+ * - 1 bin: Acc 4 (6228 full steps/s^2), the steepest ramp is only used for
+ *   the shortest move, it reaches 303 after 7 full steps.
+ * - 2 bins and more: Acc 3 (3609 full steps/s^2), the ramps take 57 % of
+ *   a 2 bin move. Acc 4 would save 31 ms there.
+ * - 3 and 4 bins: one VMax step more per bin (334, 364 full steps/s), as
+ *   long as the ramps take less than half of the move (46 %, 41 %).
+ * The old ramp (entry 0) peaks at 151..300 full steps/s on these moves. */
+typedef struct MC_Profile_s
+{
+    uint8_t VMax;
+    uint8_t Acc;
+} MC_Profile_t;
+
+#define MC_CATCHER_BIN          356     // microsteps between two bins
+
+static const MC_Profile_t PROGMEM mc_catcher_profile[MC_CATCHER_PROFILES] =
+{
+    // VMax Acc         predicted move time (with entry 0)
+    {8,     2},
+    {8,     4},     //  1 bin:  115 ms  (262 ms)
+    {8,     3},     //  2 bins: 219 ms  (384 ms)
+    {9,     3},     //  3 bins: 280 ms  (479 ms)
+    {10,    3}      //  4 bins: 332 ms  (558 ms)
+};
+
+MC_Plan_t       mc_catcher_plan[MC_CATCHER_PLAN_LEN];
+
+static uint8_t  mc_catcher_move_bins;   // distance of the actual move
+static uint16_t mc_catcher_move_cnt[MC_CATCHER_PROFILES];
+static uint32_t mc_catcher_move_ms[MC_CATCHER_PROFILES];
+
 //
 
 // defines and defaults of the parameters of the catcher motor:
@@ -95,10 +165,83 @@ TMC222_Parameters_t conveyor_parameters=
 .AccShape =0;
 .NA2      =0;*/
 
+#define MC_CONVEYOR_CNT_LIMIT   16000   // reset the position counter beyond
+
 TMC222_Status_t mc_conveyor_status;
 int16_t mc_conveyor_position_cnt = 0;
 uint8_t mc_conveyor_position_index = 0;
-enum COLOR mc_smartie_table[MC_CONVEYOR_SLOTS];
+static uint8_t mc_conveyor_half_steps = 0;      // position in steps of 18°
+static MC_Slot_t mc_slot[MC_CONVEYOR_SLOTS];
+
+// MC_Slots_Age() holds the age of a state above every saturated step
+// (0xFF << MC_SLOT_SHIFT_DROPPED) and far below the wrap of the ticks
+#define MC_SLOT_AGE_MAX         0x4000  // [ms]
+#define MC_SLOT_AGE_MS          1000
+#define MC_SLOT_BACK_MAX        0x1000  // stamps back-dated by a move [ms]
+
+static const uint8_t PROGMEM mc_slot_shift[MC_SLOT_STATES-MC_SLOT_TRANSPORT] =
+{
+    MC_SLOT_SHIFT_TRANSPORT, MC_SLOT_SHIFT_MEASURING, MC_SLOT_SHIFT_MEASURED,
+    MC_SLOT_SHIFT_CLASSIFIED, MC_SLOT_SHIFT_DROPPED
+};
+
+/*************************************************************************
+Function: MC_Slot_Stamp()
+Purpose:  sets the state of a slot and stores the time since the state
+          before in its units, saturating at 0xFF and rounded below (a
+          time up to MC_SLOT_BACK_MAX before the state before counts 0)
+Input:    slot, enum MC_slot_state, MC_Ticks_Get() entering the state
+Returns:  none
+**************************************************************************/
+static void
+MC_Slot_Stamp(MC_Slot_t *slot, uint8_t state, uint16_t ticks)
+{
+    uint16_t elapsed = ticks - slot->since;
+    uint8_t ui8 = state - MC_SLOT_TRANSPORT, shift;
+
+    if(state >= MC_SLOT_TRANSPORT)
+    {
+        // back-dated to the start of a move before the state before
+        if((uint16_t)(slot->since - ticks) <= MC_SLOT_BACK_MAX)
+            elapsed = 0;
+        shift = pgm_read_byte(&mc_slot_shift[ui8]);
+        if(elapsed >= (0xFFu << shift))
+            slot->step[ui8] = 0xFF;
+        else
+            slot->step[ui8] = (elapsed + ((1u << shift) >> 1)) >> shift; // rounded
+    }
+    else
+        memset(slot->step,0,sizeof(slot->step));
+    slot->state = state;
+    slot->since = ticks;
+}
+
+/*************************************************************************
+Function: MC_Slots_Age()
+Purpose:  keeps the time since the state of every slot below
+          MC_SLOT_AGE_MAX, so a long pause saturates its step instead of
+          wrapping the 16 bit ticks. Checks once per MC_SLOT_AGE_MS.
+Input:    none
+Returns:  none
+**************************************************************************/
+static void
+MC_Slots_Age(void)
+{
+    static uint16_t last;
+    uint16_t now = MC_Ticks_Get();
+
+    if((uint16_t)(now - last) < MC_SLOT_AGE_MS)
+        return;
+    last = now;
+    for(uint8_t ui8=0; ui8<MC_CONVEYOR_SLOTS; ui8++)
+    {
+        // a stamp dated ahead (the drop half way through a move) is young
+        if((uint16_t)(mc_slot[ui8].since - now) <= MC_SLOT_BACK_MAX)
+            continue;
+        if((uint16_t)(now - mc_slot[ui8].since) > MC_SLOT_AGE_MAX)
+            mc_slot[ui8].since = now - MC_SLOT_AGE_MAX;
+    }
+}
 
 //
 
@@ -108,7 +251,7 @@ enum COLOR mc_smartie_table[MC_CONVEYOR_SLOTS];
 /*************************************************************************
 variables defines and enums for the small MC-Statemachine
 **************************************************************************/
-enum MC_states {SOLENOID_IDLE=0,SOLENOID_BUSY};
+enum MC_states {SOLENOID_IDLE=0,SOLENOID_BUSY,SOLENOID_RECOVER};
 enum MC_states MC_State = SOLENOID_IDLE;
 
 enum MC_events {NO_EVENT = 0,SOLENOID_IS_ON,SOLENOID_IS_OFF,ACTIVATE_SOLENOID};
@@ -117,44 +260,405 @@ enum MC_events MC_Event = NO_EVENT;
 
 volatile uint8_t    mc_solenoid_status=0;
 volatile uint16_t   mc_solenoid_off_timer = 0, mc_solenoid_on_timer = 0;
-#define TIMER0_RELOAD  67//(UINT8_MAX-(F_CPU / 64 / 1000)) // should be 67
+volatile uint16_t   mc_ticks = 0;
 
-void
-MC_Catcher_Init(void)
+// output image of the IO expander (inputs are always written as 1)
+uint8_t             mc_io_expander_out = 0xFF;
+static uint8_t      mc_io_expander_written = 0xFF;
+static uint8_t      mc_io_expander_in = 0xFF;    // port at the last read
+#define TIMER0_RELOAD  (256 - MC_CLOCKS_PER_MS)//(UINT8_MAX-(F_CPU / 64 / 1000)) // should be 67
+
+/*************************************************************************
+Function: MC_Catcher_Distance()
+Purpose:  move of the catcher between two bins, the shortest way round
+          (never more than half a turn)
+Input:    bins (enum COLOR)
+Returns:  microsteps, signed
+**************************************************************************/
+static int16_t
+MC_Catcher_Distance(uint8_t from, uint8_t to)
+{
+    int16_t diff = mc_catcher_position_table[to] - mc_catcher_position_table[from];
+
+    if (diff > 1600)
+        diff -= 3200;
+    else if (diff < -1600)
+        diff += 3200;
+    return diff;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Profile()
+Purpose:  loads the ramp for a move over the given number of bins into
+          catcher_parameters (waits for a post still streaming from it)
+Input:    distance in bins (0: working parameters)
+Returns:  1 if the parameters changed and have to be written, 0 else
+**************************************************************************/
+static uint8_t
+MC_Catcher_Profile(uint8_t bins)
 {
-    // GetFullStatus1 to reset the errors
-    TMC222_GetFullStatus1(&mc_catcher_status,CATCHER_ADDRESS);
+    uint8_t vmax, acc;
+
+    if(bins >= MC_CATCHER_PROFILES)
+        bins = 0;
+    mc_catcher_move_bins = bins;
+    vmax = pgm_read_byte(&mc_catcher_profile[bins].VMax);
+    acc = pgm_read_byte(&mc_catcher_profile[bins].Acc);
+    if(catcher_parameters.VMax == vmax && catcher_parameters.Acc == acc)
+        return 0;
+    // a posted TMC222_SetMotorParameters() may still stream from it
+    TWI_Master_Flush();
+    catcher_parameters.VMax = vmax;
+    catcher_parameters.Acc = acc;
+    return 1;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Move_Stat_Get()
+Purpose:  average time of the catcher moves over the given number of bins
+          (from the start of the move until the TMC222 reported idle)
+Input:    distance in bins (1..MC_CATCHER_PROFILES-1), pointers for the
+          number of moves and the predicted time with the working
+          parameters (or NULL)
+Returns:  ms, 0 if there was no such move
+**************************************************************************/
+uint16_t
+MC_Catcher_Move_Stat_Get(uint8_t bins, uint16_t *p_cnt, uint16_t *p_default)
+{
+    TMC222_Parameters_t param = catcher_parameters;
+
+    if(bins >= MC_CATCHER_PROFILES)
+        return 0;
+    if(p_cnt)
+        *p_cnt = mc_catcher_move_cnt[bins];
+    if(p_default)
+    {
+        param.VMax = pgm_read_byte(&mc_catcher_profile[0].VMax);
+        param.Acc = pgm_read_byte(&mc_catcher_profile[0].Acc);
+        *p_default = TMC222_Move_Time(&param,bins * MC_CATCHER_BIN);
+    }
+    if(!mc_catcher_move_cnt[bins])
+        return 0;
+    return (uint16_t)(mc_catcher_move_ms[bins] / mc_catcher_move_cnt[bins]);
+}
 
-    // disable acceleration and run with vmin
-    catcher_parameters.AccShape = 1;
-    catcher_parameters.IRun = 10; // reduce current for slow motion
+/*************************************************************************
+motion status cache: the end of a move is predicted from the distance and
+the motor parameters, the TMC222 is only asked near that time
+**************************************************************************/
+#define MC_MOTION_POLL_AHEAD    3       // ms before the predicted end
+#define MC_MOTION_POLL_MS       2       // min. ms between two polls
 
-    // set motorparameters
-    TMC222_SetMotorParameters(&catcher_parameters,CATCHER_ADDRESS);
+typedef struct MC_Motion_s
+{
+    uint8_t             moving;         // until the TMC222 reported idle
+    uint8_t             address;
+    TMC222_Parameters_t *param;
+    TMC222_Status_t     *status;
+    uint16_t            start;          // ticks at the start of the move
+    uint16_t            duration;       // predicted ms of the move
+    uint16_t            poll;           // ticks of the last poll
+} MC_Motion_t;
+
+static MC_Motion_t mc_motion[2] =
+{
+    {0, CATCHER_ADDRESS, &catcher_parameters, &mc_catcher_status, 0, 0, 0},
+    {0, CONVEYOR_ADDRESS, &conveyor_parameters, &mc_conveyor_status, 0, 0, 0}
+};
+
+/*************************************************************************
+Function: MC_Motion_Start()
+Purpose:  notes a new move of the axis in the cache
+Input:    axis, distance in microsteps (0: unknown, poll at once)
+Returns:  none
+**************************************************************************/
+static void
+MC_Motion_Start(MC_Motion_t *m, int16_t distance)
+{
+    m->start = MC_Ticks_Get();
+    m->duration = TMC222_Move_Time(m->param,(uint16_t)abs(distance));
+    m->poll = m->start - MC_MOTION_POLL_MS;
+    m->moving = 1;
+}
+
+/*************************************************************************
+Function: MC_Motion_Stop()
+Purpose:  notes a SoftStop of the axis in the cache
+Input:    axis
+Returns:  none
+**************************************************************************/
+static void
+MC_Motion_Stop(MC_Motion_t *m)
+{
+    m->start = MC_Ticks_Get();
+    m->duration = TMC222_Stop_Time(m->param);
+    m->poll = m->start - MC_MOTION_POLL_MS;
+    m->moving = 1;
+}
+
+/*************************************************************************
+Function: MC_Motion_Update()
+Purpose:  polls the TMC222 if the predicted end of the move is near (at
+          most every MC_MOTION_POLL_MS)
+Input:    axis
+Returns:  predicted ms until the axis is idle, 0 if it is idle
+**************************************************************************/
+static uint16_t
+MC_Motion_Update(MC_Motion_t *m)
+{
+    uint16_t now, elapsed;
+
+    if(!m->moving)
+        return 0;
+    now = MC_Ticks_Get();
+    elapsed = now - m->start;
+    if(elapsed + MC_MOTION_POLL_AHEAD >= m->duration
+            && (uint16_t)(now - m->poll) >= MC_MOTION_POLL_MS)
+    {
+        m->poll = now;
+        if(!TMC222_GetMotionStatus(m->status,m->address))
+        {
+            m->moving = 0;
+            FSM_Event_Post(ev_axis);
+            if(m == &mc_motion[MC_AXIS_CATCHER] && mc_catcher_move_bins)
+            {
+                mc_catcher_move_cnt[mc_catcher_move_bins]++;
+                mc_catcher_move_ms[mc_catcher_move_bins] += elapsed;
+            }
+            return 0;
+        }
+    }
+    // overdue: still moving, but the end can't be far
+    return (elapsed < m->duration) ? m->duration - elapsed : 1;
+}
+
+/*************************************************************************
+homing of the catcher and the conveyor: both axes search their reference
+mark at the same time, each with its own small statemachine.
+The catcher first turns with its working speed until the mark passes, backs
+off and approaches the mark again with vmin, so the reference is the same
+as with the slow search only.
+**************************************************************************/
+enum MC_homing_states {HOMING_IDLE=0,HOMING_SEEK,HOMING_SEEK_STOP,HOMING_BACKOFF,
+                       HOMING_SEARCH,HOMING_STOP,HOMING_DONE,HOMING_TIMEOUT};
+
+typedef struct MC_Homing_s
+{
+    uint8_t             state;
+    uint8_t             address;
+    uint8_t             ref_bit;        // light barrier at the IO expander
+    int16_t             backoff;        // fast seek first, then back off (0: slow only)
+    TMC222_Parameters_t *param;
+    TMC222_Status_t     *status;
+    MC_Motion_t         *motion;        // the moves are waited for in the cache
+    int16_t             *position_cnt;
+    uint8_t             *position_index;
+    uint16_t            start;          // ticks at MC_Homing_Start()
+    uint16_t            ms;             // duration of the last homing
+} MC_Homing_t;
+
+static MC_Homing_t mc_homing[2] =
+{
+    {HOMING_IDLE, CATCHER_ADDRESS, MC_IO_EXPANDER_BIT_CATCHER, MC_HOMING_BACKOFF,
+     &catcher_parameters, &mc_catcher_status, &mc_motion[MC_AXIS_CATCHER],
+     &mc_catcher_position_cnt, &mc_catcher_position_index, 0, 0},
+    // the conveyor has a mark on every slot, that's found slowly as well
+    {HOMING_IDLE, CONVEYOR_ADDRESS, MC_IO_EXPANDER_BIT_CONVEYOR, 0,
+     &conveyor_parameters, &mc_conveyor_status, &mc_motion[MC_AXIS_CONVEYOR],
+     &mc_conveyor_position_cnt, NULL, 0, 0}
+};
+
+/*************************************************************************
+Function: MC_Homing_Slow()
+Purpose:  starts the search of the reference mark with vmin
+Input:    axis
+Returns:  none
+**************************************************************************/
+static void
+MC_Homing_Slow(MC_Homing_t *h)
+{
+    // disable acceleration and run with vmin (the last post may still
+    // stream from the parameters)
+    TWI_Master_Flush();
+    h->param->AccShape = 1;
+    h->param->IRun = 10; // reduce current for slow motion
+    TMC222_SetMotorParameters(h->param,h->address);
 
     // Reset actual position for easy ref search
-    TMC222_ResetPosition(CATCHER_ADDRESS);
+    TMC222_ResetPosition(h->address);
 
-    // initiate a single turn of the catcher to find the reference mark
-    TMC222_SetPosition(3200,CATCHER_ADDRESS);
+    // initiate a single turn to find the reference mark
+    TMC222_SetPosition(3200,h->address);
+    MC_Motion_Start(h->motion,3200);
+    h->state = HOMING_SEARCH;
+}
 
-    // wait for the reference mark to pass the light barrier
-    while(MC_Catcher_Off_Reference());
+/*************************************************************************
+Function: MC_Homing_Start()
+Purpose:  starts the search of the reference marks of the given axes,
+          the search is done by MC_Homing_Poll()
+Input:    _BV(MC_AXIS_CATCHER) | _BV(MC_AXIS_CONVEYOR)
+Returns:  none
+**************************************************************************/
+void
+MC_Homing_Start(uint8_t axes)
+{
+    MC_Homing_t *h;
 
-    // Stop the stepper and reset the position counter when stopped
+    // the fast seek of the catcher runs with the working parameters
+    if(axes & _BV(MC_AXIS_CATCHER))
+        MC_Catcher_Profile(0);
 
-    TMC222_SoftStop(CATCHER_ADDRESS);
+    for(uint8_t ui8=0; ui8<2; ui8++)
+    {
+        if(!(axes & _BV(ui8)))
+            continue;
+        h = &mc_homing[ui8];
 
-    while(TMC222_GetMotionStatus(&mc_catcher_status,CATCHER_ADDRESS)!=0);
+        // GetFullStatus1 to reset the errors
+        TMC222_GetFullStatus1(h->status,h->address);
+        h->start = MC_Ticks_Get();
 
-    mc_catcher_position_index=0;
-    mc_catcher_position_cnt=0;
-    TMC222_ResetPosition(CATCHER_ADDRESS);
+        if(h->backoff)
+        {
+            // turn with the working parameters until the mark passes
+            TWI_Master_Flush();
+            h->param->AccShape = 0;
+            h->param->IRun = 15;
+            TMC222_SetMotorParameters(h->param,h->address);
+            TMC222_ResetPosition(h->address);
+            TMC222_SetPosition(3200,h->address);
+            MC_Motion_Start(h->motion,3200);
+            h->state = HOMING_SEEK;
+        }
+        else
+            MC_Homing_Slow(h);
+    }
+}
 
-    // enable accelerated motion
-    catcher_parameters.AccShape = 0;
-    catcher_parameters.IRun = 15;
-    TMC222_SetMotorParameters(&catcher_parameters,CATCHER_ADDRESS);
+/*************************************************************************
+Function: MC_Homing_Step()
+Purpose:  one step of the homing statemachine of an axis
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR
+Returns:  none
+**************************************************************************/
+static void
+MC_Homing_Step(uint8_t axis)
+{
+    MC_Homing_t *h = &mc_homing[axis];
+    uint16_t elapsed = MC_Ticks_Get() - h->start;
+
+    switch(h->state)
+    {
+    case HOMING_SEEK:
+        if(MC_Inputs_Get() & _BV(h->ref_bit))
+        {
+            // a whole turn without the mark (too fast): search slowly
+            if(!MC_Motion_Update(h->motion))
+                MC_Homing_Slow(h);
+            break;
+        }
+        TMC222_SoftStop(h->address);
+        MC_Motion_Stop(h->motion);
+        h->state = HOMING_SEEK_STOP;
+        break;
+    case HOMING_SEEK_STOP:
+        if(MC_Motion_Update(h->motion))
+            break;
+        // the ramp overshot the mark: go back in front of it
+        TMC222_ResetPosition(h->address);
+        TMC222_SetPosition(-h->backoff,h->address);
+        MC_Motion_Start(h->motion,-h->backoff);
+        h->state = HOMING_BACKOFF;
+        break;
+    case HOMING_BACKOFF:
+        if(!MC_Motion_Update(h->motion))
+            MC_Homing_Slow(h);
+        break;
+    case HOMING_SEARCH:
+        // wait for the reference mark to pass the light barrier
+        if(MC_Inputs_Get() & _BV(h->ref_bit))
+            break;
+        // Stop the stepper and reset the position counter when stopped
+        TMC222_SoftStop(h->address);
+        MC_Motion_Stop(h->motion);
+        h->state = HOMING_STOP;
+        break;
+    case HOMING_STOP:
+        if(MC_Motion_Update(h->motion))
+            break;
+        if(h->position_index)
+            *h->position_index = 0;
+        *h->position_cnt = 0;
+        TMC222_ResetPosition(h->address);
+
+        // enable accelerated motion
+        TWI_Master_Flush();
+        h->param->AccShape = 0;
+        h->param->IRun = 15;
+        TMC222_SetMotorParameters(h->param,h->address);
+        h->ms = elapsed;
+        h->state = HOMING_DONE;
+        return;
+    default:
+        return;
+    }
+    if(elapsed > MC_HOMING_TIMEOUT_MS)
+    {
+        // no reference mark: light barrier or motor broken
+        TMC222_HardStop(h->address);
+        h->motion->moving = 0;
+        h->ms = elapsed;
+        h->state = HOMING_TIMEOUT;
+    }
+}
+
+/*************************************************************************
+Function: MC_Homing_Poll()
+Purpose:  runs the homing of both axes, never blocks
+Input:    none
+Returns:  MC_HOMING_BUSY while an axis searches its reference,
+          MC_HOMING_TIMEOUT if an axis did not find it, MC_HOMING_DONE else
+**************************************************************************/
+uint8_t
+MC_Homing_Poll(void)
+{
+    uint8_t result = MC_HOMING_DONE;
+
+    for(uint8_t ui8=0; ui8<2; ui8++)
+    {
+        MC_Homing_Step(ui8);
+        if(mc_homing[ui8].state > HOMING_IDLE && mc_homing[ui8].state < HOMING_DONE)
+            result = MC_HOMING_BUSY;
+        else if(mc_homing[ui8].state == HOMING_TIMEOUT && result != MC_HOMING_BUSY)
+            result = MC_HOMING_TIMEOUT;
+    }
+    return result;
+}
+
+/*************************************************************************
+Function: MC_Homing_Time_Get()
+Purpose:  duration of the last homing of an axis
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR
+Returns:  ms
+**************************************************************************/
+uint16_t
+MC_Homing_Time_Get(uint8_t axis)
+{
+    return mc_homing[axis].ms;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Init()
+Purpose:  searches the reference mark of the catcher (blocking)
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+MC_Catcher_Init(void)
+{
+    MC_Homing_Start(_BV(MC_AXIS_CATCHER));
+    while(MC_Homing_Poll() == MC_HOMING_BUSY);
 }
 
 
@@ -168,31 +672,242 @@ void
 MC_Catcher_Set_Position(enum COLOR new_position)
 {
     int16_t position_difference_cnt;
+    uint8_t bin = mc_catcher_bin[(uint8_t)new_position];
 
-    if ((uint8_t)new_position != mc_catcher_position_index)
+    if (bin != mc_catcher_position_index)
     {
-        //new_position %= 9;
-        // get differnce to destination
+        // get differnce to destination, the shortest way
         position_difference_cnt =
-            mc_catcher_position_table[(uint8_t)new_position] - mc_catcher_position_table[mc_catcher_position_index];
-        // decide which way to go (of course the shortest one)
-        if (position_difference_cnt > 1800)
-        {
-            position_difference_cnt -= 3200;
-        }
-        else if (position_difference_cnt < -1800)
-        {
-            position_difference_cnt += 3200;
-        }
+            MC_Catcher_Distance(mc_catcher_position_index,bin);
+        // ramp by the distance
+        if(MC_Catcher_Profile((abs(position_difference_cnt) + MC_CATCHER_BIN/2) / MC_CATCHER_BIN))
+            TMC222_SetMotorParameters(&catcher_parameters,CATCHER_ADDRESS);
         // set stepper position to the computed value
         mc_catcher_position_cnt += position_difference_cnt;
         // save actual position index!!
-        mc_catcher_position_index = new_position;
+        mc_catcher_position_index = bin;
 
         TMC222_SetPosition(mc_catcher_position_cnt,CATCHER_ADDRESS);
+        MC_Motion_Start(&mc_motion[MC_AXIS_CATCHER],position_difference_cnt);
+    }
+
+
+}
+
+/*************************************************************************
+Function: MC_Catcher_Count()
+Purpose:  counts the transition from the colour dropped before, for
+          MC_Catcher_Bins_Optimize(). The first drop after reset only
+          sets the colour.
+Input:    colour of the smartie that drops
+Returns:  none
+**************************************************************************/
+void
+MC_Catcher_Count(enum COLOR color)
+{
+    uint8_t *p;
+
+    if (mc_catcher_last_color != COLOR_MAX)
+    {
+        p = &mc_catcher_trans[mc_catcher_last_color][(uint8_t)color];
+        // halve all counts before one overflows
+        if (*p == UINT8_MAX)
+        {
+            for (uint8_t ui8=0; ui8<COLOR_MAX*COLOR_MAX; ui8++)
+                (&mc_catcher_trans[0][0])[ui8] >>= 1;
+        }
+        (*p)++;
+    }
+    mc_catcher_last_color = (uint8_t)color;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Plan()
+Purpose:  plans the moves of the catcher for all classified slots between
+          the drop point and the colour sensor, in the order they drop.
+          Each move takes the shortest way from the bin of the slot before
+          and gets the time predicted with its ramp.
+Input:    none
+Returns:  colour of the slot that drops next (first move of the plan),
+          COLOR_MAX if that slot isn't classified
+**************************************************************************/
+enum COLOR
+MC_Catcher_Plan(void)
+{
+    uint8_t from = mc_catcher_position_index, to, bins;
+    MC_Slot_t *slot;
+    TMC222_Parameters_t param = catcher_parameters;
+
+    for(uint8_t ui8=0; ui8<MC_CATCHER_PLAN_LEN; ui8++)
+    {
+        slot = MC_Slot_Get(MC_SLOT_DROP - ui8);
+        mc_catcher_plan[ui8].slot = MC_Slot_Index(MC_SLOT_DROP - ui8);
+        // nothing known drops from the slot: the catcher stays
+        if(slot->state == MC_SLOT_CLASSIFIED)
+        {
+            mc_catcher_plan[ui8].color = slot->color;
+            to = mc_catcher_bin[slot->color];
+        }
+        else
+        {
+            mc_catcher_plan[ui8].color = COLOR_MAX;
+            to = from;
+        }
+        mc_catcher_plan[ui8].steps = MC_Catcher_Distance(from,to);
+        bins = (abs(mc_catcher_plan[ui8].steps) + MC_CATCHER_BIN/2) / MC_CATCHER_BIN;
+        param.VMax = pgm_read_byte(&mc_catcher_profile[bins].VMax);
+        param.Acc = pgm_read_byte(&mc_catcher_profile[bins].Acc);
+        mc_catcher_plan[ui8].ms = TMC222_Move_Time(&param,abs(mc_catcher_plan[ui8].steps));
+        from = to;
+    }
+    return (enum COLOR)mc_catcher_plan[0].color;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Bins_Cost()
+Purpose:  catcher travel of the counted transitions with a bin assignment
+Input:    bin for each colour
+Returns:  sum of the transitions weighted with their distance in bins
+**************************************************************************/
+static uint32_t
+MC_Catcher_Bins_Cost(const uint8_t *bin)
+{
+    uint32_t cost = 0;
+    uint8_t  dist;
+
+    for(uint8_t a=0; a<COLOR_MAX; a++)
+    {
+        for(uint8_t b=0; b<COLOR_MAX; b++)
+        {
+            dist = (bin[a] > bin[b]) ? bin[a] - bin[b] : bin[b] - bin[a];
+            if(dist > COLOR_MAX/2)
+                dist = COLOR_MAX - dist;
+            cost += (uint32_t)mc_catcher_trans[a][b] * dist;
+        }
     }
+    return cost;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Bins_Optimize()
+Purpose:  searches a bin assignment that puts colours which often follow
+          each other on neighbouring bins: starting with the actual one,
+          the best swap of two colours is done until no swap shortens the
+          travel of the counted transitions any more
+Input:    pointer for the new bin of each colour, pointers for the mean
+          travel per smartie in microsteps with the actual and the new
+          assignment (or NULL)
+Returns:  number of counted transitions
+**************************************************************************/
+uint16_t
+MC_Catcher_Bins_Optimize(uint8_t *bin, uint16_t *p_now, uint16_t *p_new)
+{
+    uint32_t cost, best, n = 0;
+    uint8_t  a, b, best_a, best_b, tmp;
+
+    for(a=0; a<COLOR_MAX; a++)
+    {
+        bin[a] = mc_catcher_bin[a];
+        for(b=0; b<COLOR_MAX; b++)
+            n += mc_catcher_trans[a][b];
+    }
+    best = MC_Catcher_Bins_Cost(bin);
+    if(p_now)
+        *p_now = n ? (uint16_t)(best * MC_CATCHER_BIN / n) : 0;
+
+    do
+    {
+        best_a = best_b = 0;
+        for(a=0; a<COLOR_MAX; a++)
+        {
+            for(b=a+1; b<COLOR_MAX; b++)
+            {
+                tmp = bin[a]; bin[a] = bin[b]; bin[b] = tmp;
+                cost = MC_Catcher_Bins_Cost(bin);
+                if(cost < best)
+                {
+                    best = cost;
+                    best_a = a;
+                    best_b = b;
+                }
+                tmp = bin[a]; bin[a] = bin[b]; bin[b] = tmp;
+            }
+        }
+        tmp = bin[best_a]; bin[best_a] = bin[best_b]; bin[best_b] = tmp;
+    }
+    while(best_a != best_b);
+
+    if(p_new)
+        *p_new = n ? (uint16_t)(best * MC_CATCHER_BIN / n) : 0;
+    return (n > UINT16_MAX) ? UINT16_MAX : (uint16_t)n;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Bins_CRC()
+Purpose:  CRC over the bin record without the CRC itself
+Input:    record
+Returns:  CRC-CCITT
+**************************************************************************/
+static uint16_t
+MC_Catcher_Bins_CRC(const MC_Bins_t *rec)
+{
+    uint16_t crc = 0xFFFF;
+
+    for(uint8_t ui8=0; ui8<offsetof(MC_Bins_t,CRC); ui8++)
+        crc = _crc_ccitt_update(crc,((const uint8_t*)rec)[ui8]);
+    return crc;
+}
+
+/*************************************************************************
+Function: MC_Catcher_Bins_Store()
+Purpose:  stores a bin assignment to the EEPROM. It is taken over with the
+          next reset (MC_Catcher_Bins_Restore()), when the bins are empty.
+Input:    bin for each colour
+Returns:  none
+**************************************************************************/
+void
+MC_Catcher_Bins_Store(const uint8_t *bin)
+{
+    MC_Bins_t rec;
+
+    rec.Stamp = MC_BINS_STAMP;
+    for(uint8_t ui8=0; ui8<COLOR_MAX; ui8++)
+        rec.Bin[ui8] = bin[ui8];
+    rec.CRC = MC_Catcher_Bins_CRC(&rec);
 
+    eeprom_busy_wait();
+    eeprom_update_block((const void*)&rec,(void*)&mc_bins_ee,sizeof(MC_Bins_t));
+}
 
+/*************************************************************************
+Function: MC_Catcher_Bins_Restore()
+Purpose:  reads the bin assignment from the EEPROM, it is taken over if
+          stamp and CRC are valid and every bin is used once
+Input:    none
+Returns:  1 if the assignment was valid, 0 else (mc_catcher_bin unchanged)
+**************************************************************************/
+uint8_t
+MC_Catcher_Bins_Restore(void)
+{
+    MC_Bins_t rec;
+    uint16_t used = 0;
+
+    eeprom_busy_wait();
+    eeprom_read_block((void*)&rec,(const void*)&mc_bins_ee,sizeof(MC_Bins_t));
+
+    if(rec.Stamp != MC_BINS_STAMP || rec.CRC != MC_Catcher_Bins_CRC(&rec))
+        return 0;
+    for(uint8_t ui8=0; ui8<COLOR_MAX; ui8++)
+    {
+        if(rec.Bin[ui8] >= COLOR_MAX)
+            return 0;
+        used |= _BV(rec.Bin[ui8]);
+    }
+    if(used != (1 << COLOR_MAX) - 1)
+        return 0;
+    for(uint8_t ui8=0; ui8<COLOR_MAX; ui8++)
+        mc_catcher_bin[ui8] = rec.Bin[ui8];
+    return 1;
 }
 
 /*************************************************************************
@@ -217,71 +932,138 @@ Returns:  1 if catcher is idle,0 else
 uint8_t
 MC_Is_Catcher_Idle(void)
 {
-    if(TMC222_GetMotionStatus(&mc_catcher_status,CATCHER_ADDRESS))return 0;
-    else return 1;
+    return MC_Motion_Update(&mc_motion[MC_AXIS_CATCHER]) ? 0 : 1;
 }
 
 
 /*************************************************************************
 Function: MC_Conveyor_Init()
-Purpose:  Sets working parameters of the TMC222 for the catcher stepper.
-          When Done the Motor searches the reference mark on the catcher,
-          and resets the position counter.
+Purpose:  searches the next reference mark of the conveyor (blocking)
 Input:    none
-Returns:  error
+Returns:  none
 **************************************************************************/
 void
 MC_Conveyor_Init(void)
 {
-    // GetFullStatus1 to reset the errors
-    TMC222_GetFullStatus1(&mc_conveyor_status,CONVEYOR_ADDRESS);
-
-    // disable acceleration and run with vmin
-    conveyor_parameters.AccShape = 1;
-    conveyor_parameters.IRun = 10; // reduce current for slow motion
-
-    // set motorparameters
-    TMC222_SetMotorParameters(&conveyor_parameters,CONVEYOR_ADDRESS);
+    MC_Homing_Start(_BV(MC_AXIS_CONVEYOR));
+    while(MC_Homing_Poll() == MC_HOMING_BUSY);
+}
 
-    // Reset actual position for easy ref search
-    TMC222_ResetPosition(CONVEYOR_ADDRESS);
+/*************************************************************************
+Function: MC_Conveyor_Set_Position()
+Purpose:  used to move the conveyor back or forward (in steps of 18°,
+          two steps per slot)
+Input:    steps
+Returns:  none
+**************************************************************************/
+void
+MC_Conveyor_Set_Position(int8_t step)
+{
+    MC_Slot_t *slot;
 
-    // initiate a turn of 36° to find the next reference mark on the conveyor
-    TMC222_SetPosition(3200,CONVEYOR_ADDRESS);
+    // wait until the stepper is ready with last job
+    while (!MC_Is_Conveyor_Idle());
+    // keep the 16 bit position counter of the TMC222 away from overflow
+    // (the conveyor stands at a slot here, so nothing gets lost)
+    if(mc_conveyor_position_cnt > MC_CONVEYOR_CNT_LIMIT
+            || mc_conveyor_position_cnt < -MC_CONVEYOR_CNT_LIMIT)
+    {
+        TMC222_ResetPosition(CONVEYOR_ADDRESS);
+        mc_conveyor_position_cnt = 0;
+    }
+    mc_conveyor_position_cnt += 160*step;
+    TMC222_SetPosition(mc_conveyor_position_cnt,CONVEYOR_ADDRESS);
+    MC_Motion_Start(&mc_motion[MC_AXIS_CONVEYOR],160*step);
 
-    // wait for the reference mark to pass the light barrier
-    while(MC_Conveyor_Off_Reference());
+    // follow the full slots, the smartie falls half way through the move
+    mc_conveyor_half_steps = (mc_conveyor_half_steps + 2*MC_CONVEYOR_SLOTS + step)
+                             % (2*MC_CONVEYOR_SLOTS);
+    while(mc_conveyor_position_index != (mc_conveyor_half_steps>>1))
+    {
+        if(step > 0)
+        {
+            slot = MC_Slot_Get(MC_SLOT_SILO);
+            if(slot->state == MC_SLOT_LOADED)
+                MC_Slot_Stamp(slot,MC_SLOT_TRANSPORT,mc_motion[MC_AXIS_CONVEYOR].start);
+            slot = MC_Slot_Get(MC_SLOT_DROP);
+            if(slot->state != MC_SLOT_EMPTY)
+                MC_Slot_Stamp(slot,MC_SLOT_DROPPED,mc_motion[MC_AXIS_CONVEYOR].start
+                                                   + mc_motion[MC_AXIS_CONVEYOR].duration/2);
+            mc_conveyor_position_index++;
+        }
+        else
+            mc_conveyor_position_index += MC_CONVEYOR_SLOTS - 1;
+        mc_conveyor_position_index %= MC_CONVEYOR_SLOTS;
+    }
+}
 
-    // Stop the stepper and reset the position counter when stopped
+/*************************************************************************
+Function: MC_Slot_Index()
+Purpose:  number of the slot at a station (0..MC_CONVEYOR_SLOTS-1)
+Input:    station, slots downstream of the sensor
+Returns:  index of the slot
+**************************************************************************/
+uint8_t
+MC_Slot_Index(int8_t station)
+{
+    // the index of the slot under the sensor counts up with each move
+    return (uint8_t)(mc_conveyor_position_index + MC_CONVEYOR_SLOTS - station)
+           % MC_CONVEYOR_SLOTS;
+}
 
-    TMC222_SoftStop(CONVEYOR_ADDRESS);
+/*************************************************************************
+Function: MC_Slot_Get()
+Purpose:  slot of the conveyor at a station
+Input:    station, slots downstream of the sensor
+Returns:  pointer to the slot
+**************************************************************************/
+MC_Slot_t *
+MC_Slot_Get(int8_t station)
+{
+    return &mc_slot[MC_Slot_Index(station)];
+}
 
-    while(TMC222_GetMotionStatus(&mc_conveyor_status,CONVEYOR_ADDRESS)!=0);
+/*************************************************************************
+Function: MC_Slot_Set_State()
+Purpose:  sets the state of a slot and notes the time since the state
+          before (MC_SLOT_LOADED starts over)
+Input:    slot, enum MC_slot_state
+Returns:  none
+**************************************************************************/
+void
+MC_Slot_Set_State(MC_Slot_t *slot, uint8_t state)
+{
+    MC_Slot_Stamp(slot,state,MC_Ticks_Get());
+}
 
-    mc_conveyor_position_cnt=0;
-    TMC222_ResetPosition(CONVEYOR_ADDRESS);
+/*************************************************************************
+Function: MC_Slot_Ms()
+Purpose:  time of a slot from entering one state to entering a later one,
+          in the units of the steps in between (see MC_SLOT_SHIFT_...)
+Input:    slot, enum MC_slot_state from (>= MC_SLOT_LOADED) and to
+Returns:  ms
+**************************************************************************/
+uint16_t
+MC_Slot_Ms(const MC_Slot_t *slot, uint8_t from, uint8_t to)
+{
+    uint16_t ms = 0;
 
-    // enable accelerated motion
-    conveyor_parameters.AccShape = 0;
-    conveyor_parameters.IRun = 15;
-    TMC222_SetMotorParameters(&conveyor_parameters,CONVEYOR_ADDRESS);
+    for(uint8_t ui8=from+1-MC_SLOT_TRANSPORT; ui8<=to-MC_SLOT_TRANSPORT; ui8++)
+        ms += (uint16_t)slot->step[ui8] << pgm_read_byte(&mc_slot_shift[ui8]);
+    return ms;
 }
 
 /*************************************************************************
-Function: MC_Catcher_Set_Position()
-Purpose:  used to move the conveyor back or forward (in steps of 18°)
+Function: MC_Slots_Clear()
+Purpose:  marks all slots of the conveyor as empty
 Input:    none
-Returns:  enum COLOR
+Returns:  none
 **************************************************************************/
 void
-MC_Conveyor_Set_Position(int8_t step)
+MC_Slots_Clear(void)
 {
-    // wait until the stepper is ready with last job
-    while (TMC222_GetMotionStatus(&mc_conveyor_status,CONVEYOR_ADDRESS));
-    mc_conveyor_position_cnt += 160*step;
-    mc_conveyor_position_index += (step>>1);
-    mc_conveyor_position_index %= MC_CONVEYOR_SLOTS;
-    TMC222_SetPosition(mc_conveyor_position_cnt,CONVEYOR_ADDRESS);
+    for(uint8_t ui8=0; ui8<MC_CONVEYOR_SLOTS; ui8++)
+        MC_Slot_Set_State(&mc_slot[ui8],MC_SLOT_EMPTY);
 }
 
 /*************************************************************************
@@ -293,8 +1075,100 @@ Returns:  1 if conveyor is idle, 0 else
 uint8_t
 MC_Is_Conveyor_Idle(void)
 {
-    if(TMC222_GetMotionStatus(&mc_conveyor_status,CONVEYOR_ADDRESS))return 0;
-    else return 1;
+    return MC_Motion_Update(&mc_motion[MC_AXIS_CONVEYOR]) ? 0 : 1;
+}
+
+/*************************************************************************
+Function: MC_Is_Near_Target()
+Purpose:  position trigger: the actual position of the TMC222 is read
+          (GetFullStatus2) once the predicted rest of the move gets as short
+          as the braking over the window, at most every MC_MOTION_POLL_MS
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR, window in microsteps
+Returns:  1 if the axis is idle or within the window of its target, 0 else
+**************************************************************************/
+uint8_t
+MC_Is_Near_Target(uint8_t axis, uint16_t window)
+{
+    MC_Motion_t *m = &mc_motion[axis];
+    uint16_t left = MC_Motion_Update(m), now;
+    int16_t actual, target;
+
+    if(!left)
+        return 1;
+    // unknown move (homing): only idle counts
+    if(!m->duration)
+        return 0;
+    // braking over the window takes half of a move of twice its length
+    if(left > TMC222_Move_Time(m->param,2*window) / 2 + MC_MOTION_POLL_AHEAD)
+        return 0;
+    now = MC_Ticks_Get();
+    if((uint16_t)(now - m->poll) < MC_MOTION_POLL_MS)
+        return 0;
+    m->poll = now;
+    if(TMC222_GetFullStatus2(&actual,&target,NULL,m->address))
+        return 0;
+    return ((uint16_t)abs(target - actual) <= window) ? 1 : 0;
+}
+
+/*************************************************************************
+Function: MC_Time_To_Idle()
+Purpose:  predicted time until the axis stops, from the cached motion
+          status (asks the TMC222 only near the end of the move)
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR
+Returns:  ms, 0 if the axis is idle
+**************************************************************************/
+uint16_t
+MC_Time_To_Idle(uint8_t axis)
+{
+    return MC_Motion_Update(&mc_motion[axis]);
+}
+
+/*************************************************************************
+Function: MC_Outputs_Init()
+Purpose:  reads the IO expander into the input and output image
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+MC_Outputs_Init(void)
+{
+    mc_io_expander_in = TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS);
+    mc_io_expander_out = mc_io_expander_in | MC_IO_EXPANDER_DIR_MASK;
+    mc_io_expander_written = mc_io_expander_out;
+}
+
+/*************************************************************************
+Function: MC_Inputs_Get()
+Purpose:  returns the port of the IO expander. It is only read over the
+          bus when the expander signaled a change on the INT_TWI line
+          (the read also releases the line).
+Input:    none
+Returns:  port of the IO expander
+**************************************************************************/
+uint8_t
+MC_Inputs_Get(void)
+{
+    if(TWI_Master_Int_Event(TWI_INT_EXPANDER))
+        mc_io_expander_in = TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS);
+    return mc_io_expander_in;
+}
+
+/*************************************************************************
+Function: MC_Outputs_Apply()
+Purpose:  writes the output image to the IO expander (one posted write,
+          nothing if the image did not change since the last write)
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+MC_Outputs_Apply(void)
+{
+    if(mc_io_expander_out != mc_io_expander_written)
+    {
+        mc_io_expander_written = mc_io_expander_out;
+        TWI_Master_Write_Byte(mc_io_expander_written | MC_IO_EXPANDER_DIR_MASK,
+                              MC_IO_EXPANDER_ADDRESS);
+    }
 }
 
 /*************************************************************************
@@ -306,10 +1180,8 @@ Returns:  none
 void
 MC_Solenoid_On(void)
 {
-    register uint8_t temp;
-    temp  = (TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS) | MC_IO_EXPANDER_DIR_MASK);
-    temp |= _BV(MC_IO_EXPANDER_BIT_SOLENOID);
-    TWI_Master_Write_Byte(temp,MC_IO_EXPANDER_ADDRESS);
+    MC_Output_Set(MC_IO_EXPANDER_BIT_SOLENOID);
+    MC_Outputs_Apply();
 }
 /*************************************************************************
 Makro:    MC_Solenoid_Off
@@ -320,10 +1192,8 @@ Returns:  none
 void
 MC_Solenoid_Off(void)
 {
-    register uint8_t temp;
-    temp  = (TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS) | MC_IO_EXPANDER_DIR_MASK);
-    temp &= ~_BV(MC_IO_EXPANDER_BIT_SOLENOID);
-    TWI_Master_Write_Byte(temp,MC_IO_EXPANDER_ADDRESS);
+    MC_Output_Clear(MC_IO_EXPANDER_BIT_SOLENOID);
+    MC_Outputs_Apply();
 }
 /*************************************************************************
 Makro:    MC_Vibrator_On
@@ -334,10 +1204,8 @@ Returns:  none
 void
 MC_Vibrator_On(void)
 {
-    register uint8_t temp;
-    temp  = (TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS) | MC_IO_EXPANDER_DIR_MASK);
-    temp &= ~_BV(MC_IO_EXPANDER_BIT_VIBRATOR);
-    TWI_Master_Write_Byte(temp,MC_IO_EXPANDER_ADDRESS);
+    MC_Output_Clear(MC_IO_EXPANDER_BIT_VIBRATOR);
+    MC_Outputs_Apply();
 }
 /*************************************************************************
 Makro:    MC_Vibrator_Off
@@ -348,15 +1216,14 @@ Returns:  none
 void
 MC_Vibrator_Off(void)
 {
-    register uint8_t temp;
-    temp  = (TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS) | MC_IO_EXPANDER_DIR_MASK);
-    temp |= _BV(MC_IO_EXPANDER_BIT_VIBRATOR);
-    TWI_Master_Write_Byte(temp,MC_IO_EXPANDER_ADDRESS);
+    MC_Output_Set(MC_IO_EXPANDER_BIT_VIBRATOR);
+    MC_Outputs_Apply();
 }
 
 /*************************************************************************
 Function: MC_Eject_Smartie()
-Purpose:  switch off the vibrator of the smartie silo
+Purpose:  pulls the solenoid of the smartie silo, the slot under the
+          silo gets loaded
 Input:    none
 Returns:  none
 **************************************************************************/
@@ -364,6 +1231,7 @@ void
 MC_Eject_Smartie(void)
 {
     MC_Event = ACTIVATE_SOLENOID;
+    MC_Slot_Set_State(MC_Slot_Get(MC_SLOT_SILO),MC_SLOT_LOADED);
 }
 /*************************************************************************
 Function: MC_Is_Smartie_Ejected()
@@ -378,6 +1246,20 @@ MC_Is_Smartie_Ejected(void)
     else return 0;
 }
 
+/*************************************************************************
+Function: MC_Is_Smartie_Loaded()
+Purpose:  returns 1 if the Solenoid is off again (it may still recover
+          for MC_SOLENOID_OFF_TIME), so the conveyor may move on
+Input:    none
+Returns:  1 if the smartie lies in the chamber of the conveyor
+**************************************************************************/
+uint8_t
+MC_Is_Smartie_Loaded(void)
+{
+    if(MC_State == SOLENOID_BUSY || MC_Event == ACTIVATE_SOLENOID) return 0;
+    else return 1;
+}
+
 /*************************************************************************
 ISR_Init:   MC_Timer_0Init()
 Purpose:    Initialisation of the timer0 interrupt that should occour
@@ -392,6 +1274,59 @@ MC_Timer0_Init(void)
 }
 
 
+/*************************************************************************
+Function: MC_Ticks_Get()
+Purpose:  returns the ms counter of the timer0 interrupt (wraps around
+          after 65.5 s, compare differences only)
+Input:    none
+Returns:  ms since MC_Timer0_Init()
+**************************************************************************/
+uint16_t
+MC_Ticks_Get(void)
+{
+    uint8_t sreg = SREG;
+    uint16_t ticks;
+
+    cli();
+    ticks = mc_ticks;
+    SREG = sreg;
+    return ticks;
+}
+
+
+/*************************************************************************
+Function: MC_Clock_Get()
+Purpose:  MC_Ticks_Get() and the timer0 clocks into the actual ms, for
+          measuring runtimes below 1 ms (call with interrupts enabled)
+Input:    pointer for the clocks (0..MC_CLOCKS_PER_MS-1)
+Returns:  ms since MC_Timer0_Init()
+**************************************************************************/
+uint16_t
+MC_Clock_Get(uint8_t *p_clocks)
+{
+    uint16_t ticks;
+    uint8_t cnt;
+
+    // read again if the ISR ran in between (this also catches a torn read
+    // of mc_ticks); an overflow that is still pending wraps
+    // cnt - TIMER0_RELOAD to the next ms (ticks + 1)
+    do
+    {
+        ticks = mc_ticks;
+        cnt = TCNT0;
+    }
+    while(ticks != mc_ticks);
+    cnt -= TIMER0_RELOAD;
+    if(cnt >= MC_CLOCKS_PER_MS)
+    {
+        cnt -= MC_CLOCKS_PER_MS;
+        ticks++;
+    }
+    *p_clocks = cnt;
+    return ticks;
+}
+
+
 /*************************************************************************
 ISR:      TIMER0_OVF
 Purpose:  Interrupt that should occour every ms.
@@ -401,6 +1336,16 @@ ISR(TIMER0_OVF_vect)
 {
     TCNT0 = TIMER0_RELOAD;
 
+    mc_ticks++;
+
+    FSM_Tick();
+
+    ADJD_S311_Meas_Tick();
+
+    // CS_Color_Average_Poll() starts the measurement at 0
+    if(cs_led_settle_timer)
+        cs_led_settle_timer--;
+
     if(mc_solenoid_on_timer)
     {
         mc_solenoid_on_timer--;
@@ -431,6 +1376,7 @@ MC_FSM_Execute(void)
             mc_solenoid_on_timer = MC_SOLENOID_ON_TIME;
             MC_Event = NO_EVENT;
             MC_State = SOLENOID_BUSY;
+            FSM_Event_Post(ev_solenoid);
         }
         break;
     case SOLENOID_BUSY:
@@ -439,15 +1385,23 @@ MC_FSM_Execute(void)
             MC_Solenoid_Off();
             mc_solenoid_off_timer = MC_SOLENOID_OFF_TIME;
             MC_Event = NO_EVENT;
-            MC_State = SOLENOID_BUSY;
+            MC_State = SOLENOID_RECOVER;
+            FSM_Event_Post(ev_solenoid);
         }
-        else if(MC_Event == SOLENOID_IS_OFF)
+        break;
+    case SOLENOID_RECOVER:
+        if(MC_Event == SOLENOID_IS_OFF)
         {
             MC_Event = NO_EVENT;
             MC_State = SOLENOID_IDLE;
+            FSM_Event_Post(ev_solenoid);
         }
         break;
     }
+    // keep the motion cache current (polls only near the end of a move)
+    MC_Motion_Update(&mc_motion[MC_AXIS_CATCHER]);
+    MC_Motion_Update(&mc_motion[MC_AXIS_CONVEYOR]);
+    MC_Slots_Age();
 }
 
 
@@ -50,20 +50,104 @@
 
 #define MC_CONVEYOR_SLOTS               10
 
+// stations of the conveyor, in slots downstream of the colour sensor
+#define MC_SLOT_SILO                    (-1)    // gets the smartie of the next eject
+#define MC_SLOT_SENSOR                  0       // under the colour sensor
+#define MC_SLOT_DROP                    6       // drops during the next conveyor move
 
-extern enum COLOR mc_smartie_table[];
+#define MC_CATCHER_PLAN_LEN             (MC_SLOT_DROP - MC_SLOT_SENSOR)
 
+#define MC_AXIS_CATCHER                 0
+#define MC_AXIS_CONVEYOR                1
 
+#define MC_CATCHER_PROFILES             5       // ramps for 0..4 bins
 
-extern uint8_t mc_conveyor_position_index ;
+#define MC_HOMING_BUSY                  0
+#define MC_HOMING_DONE                  1
+#define MC_HOMING_TIMEOUT               2
+
+#define MC_CLOCKS_PER_MS                189     // timer0 clocks per tick (prescaler 64)
+#define MC_CLOCKS_TO_US(c)              ((uint32_t)(c) * 16 / 3)    // 64 / 12 MHz
+
+
+enum MC_slot_state {MC_SLOT_EMPTY=0,MC_SLOT_LOADED,MC_SLOT_TRANSPORT,MC_SLOT_MEASURING,
+                    MC_SLOT_MEASURED,MC_SLOT_CLASSIFIED,MC_SLOT_DROPPED,MC_SLOT_STATES};
+
+// time units of the steps of a slot [ms << shift], a step saturates at 255 units
+#define MC_SLOT_SHIFT_TRANSPORT         3       // eject:     8 ms, up to 2 s
+#define MC_SLOT_SHIFT_MEASURING         2       // transport: 4 ms, up to 1 s
+#define MC_SLOT_SHIFT_MEASURED          0       // measure:   1 ms, up to 255 ms
+#define MC_SLOT_SHIFT_CLASSIFIED        0       // classify:  1 ms, up to 255 ms
+#define MC_SLOT_SHIFT_DROPPED           6       // drop:     64 ms, up to 16 s
+
+typedef struct MC_Slot_s
+{
+    uint8_t             state;          // enum MC_slot_state
+    uint8_t             color;          // enum COLOR, valid from MC_SLOT_CLASSIFIED
+    uint16_t            since;          // MC_Ticks_Get() entering the state
+    uint8_t             step[MC_SLOT_STATES-MC_SLOT_TRANSPORT]; // time from the state before,
+                                        // MC_SLOT_SHIFT_..., read with MC_Slot_Ms()
+    ADJD_S311_Data_t    rgbw;           // raw measurement, valid from MC_SLOT_MEASURED
+} MC_Slot_t;
+
+typedef struct MC_Plan_s
+{
+    uint8_t     slot;           // slot of the conveyor
+    uint8_t     color;          // bin of the catcher
+    int16_t     steps;          // move from the bin before (shortest way)
+    uint16_t    ms;             // predicted duration of the move
+} MC_Plan_t;
+
+extern MC_Plan_t mc_catcher_plan[];     // see MC_Catcher_Plan()
+
+extern uint8_t mc_catcher_bin[];        // bin of the catcher for each colour
+
+
+
+extern uint8_t mc_conveyor_position_index ;    // slot under the colour sensor
+
+extern volatile uint16_t mc_ticks;      // ms counter of the timer0 interrupt
+
+extern uint8_t mc_io_expander_out;      // output image of the IO expander
 
 
 
+/*************************************************************************
+Function: MC_Homing_Start()
+Purpose:  Starts the search of the reference marks of the given axes.
+          Both axes may search at the same time, MC_Homing_Poll() does
+          the rest.
+Input:    _BV(MC_AXIS_CATCHER) | _BV(MC_AXIS_CONVEYOR)
+Returns:  none
+**************************************************************************/
+extern void
+MC_Homing_Start(uint8_t axes);
+
+/*************************************************************************
+Function: MC_Homing_Poll()
+Purpose:  runs the homing statemachines, stops an axis at its reference
+          mark and resets its position counter. Never blocks.
+Input:    none
+Returns:  MC_HOMING_BUSY, MC_HOMING_DONE or MC_HOMING_TIMEOUT
+**************************************************************************/
+extern uint8_t
+MC_Homing_Poll(void);
+
+/*************************************************************************
+Function: MC_Homing_Time_Get()
+Purpose:  duration of the last homing of an axis
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR
+Returns:  ms
+**************************************************************************/
+extern uint16_t
+MC_Homing_Time_Get(uint8_t axis);
+
 /*************************************************************************
 Function: MC_Catcher_Init()
 Purpose:  Sets working parameters of the TMC222 for the catcher stepper.
           When Done the Motor searches the reference mark on the catcher,
-          and resets the position counter.
+          and resets the position counter. Blocks until the homing is
+          done, the FSM uses MC_Homing_Start() instead.
 Input:    none
 Returns:  error
 **************************************************************************/
@@ -79,6 +163,59 @@ Returns:  none
 extern void
 MC_Catcher_Set_Position(enum COLOR color);
 
+/*************************************************************************
+Function: MC_Catcher_Count()
+Purpose:  counts the colour transition of a dropping smartie for
+          MC_Catcher_Bins_Optimize() (manual moves are not counted)
+Input:    enum COLOR
+Returns:  none
+**************************************************************************/
+extern void
+MC_Catcher_Count(enum COLOR color);
+
+/*************************************************************************
+Function: MC_Catcher_Plan()
+Purpose:  plans the moves of the catcher (mc_catcher_plan[]) for all
+          classified slots between the drop point and the colour sensor,
+          in the order they drop
+Input:    none
+Returns:  colour of the slot that drops next (first move of the plan)
+**************************************************************************/
+extern enum COLOR
+MC_Catcher_Plan(void);
+
+/*************************************************************************
+Function: MC_Catcher_Bins_Optimize()
+Purpose:  searches a bin assignment that puts colours which often follow
+          each other (counted at runtime) on neighbouring bins
+Input:    pointer for the new bin of each colour (COLOR_MAX), pointers for
+          the mean travel per smartie in microsteps with the actual and
+          the new assignment (or NULL)
+Returns:  number of counted transitions
+**************************************************************************/
+extern uint16_t
+MC_Catcher_Bins_Optimize(uint8_t *bin, uint16_t *p_now, uint16_t *p_new);
+
+/*************************************************************************
+Function: MC_Catcher_Bins_Store()
+Purpose:  stores a bin assignment to the EEPROM, it is taken over with the
+          next reset, when the bins are empty
+Input:    bin for each colour
+Returns:  none
+**************************************************************************/
+extern void
+MC_Catcher_Bins_Store(const uint8_t *bin);
+
+/*************************************************************************
+Function: MC_Catcher_Bins_Restore()
+Purpose:  reads the bin assignment from the EEPROM (stamp, CRC and every
+          bin used once are checked)
+Input:    none
+Returns:  1 if the assignment was valid, 0 else
+**************************************************************************/
+extern uint8_t
+MC_Catcher_Bins_Restore(void);
+
 /*************************************************************************
 Makro: MC_Catcher_Off_Reference()
 Purpose:  read out the status of the lightbarrier
@@ -86,11 +223,23 @@ Input:    none
 Returns:  1 when the light barrier is at reference mark, 0 else
 **************************************************************************/
 #define MC_Catcher_Off_Reference() \
-    ((TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS)) & _BV(MC_IO_EXPANDER_BIT_CATCHER))
+    (MC_Inputs_Get() & _BV(MC_IO_EXPANDER_BIT_CATCHER))
+
+/*************************************************************************
+Function: MC_Catcher_Move_Stat_Get()
+Purpose:  average time of the catcher moves over the given number of bins.
+          The ramp of each move is chosen by its distance.
+Input:    distance in bins (1..MC_CATCHER_PROFILES-1), pointers for the
+          number of moves and the predicted time with the working
+          parameters (or NULL)
+Returns:  ms, 0 if there was no such move
+**************************************************************************/
+extern uint16_t
+MC_Catcher_Move_Stat_Get(uint8_t bins, uint16_t *p_cnt, uint16_t *p_default);
 
 /*************************************************************************
 Function: MC_Is_Catcher_Idle()
-Purpose:  get motion status
+Purpose:  get motion status (cached, see MC_Time_To_Idle())
 Input:    none
 Returns:  1 if catcher is idle,0 else
 **************************************************************************/
@@ -101,7 +250,7 @@ MC_Is_Catcher_Idle(void);
 Function: MC_Conveyor_Init()
 Purpose:  Sets working parameters of the TMC222 for the conveyor stepper.
           When Done the Motor searches the reference mark on the conveyor,
-          and resets the position counter.
+          and resets the position counter. Blocking, see MC_Catcher_Init().
 Input:    none
 Returns:  error
 **************************************************************************/
@@ -115,27 +264,139 @@ Input:    none
 Returns:  1 when the light barrier is at reference mark, 0 else
 **************************************************************************/
 #define MC_Conveyor_Off_Reference() \
-    ((TWI_Master_Read_Byte(MC_IO_EXPANDER_ADDRESS)) & _BV(MC_IO_EXPANDER_BIT_CONVEYOR))
+    (MC_Inputs_Get() & _BV(MC_IO_EXPANDER_BIT_CONVEYOR))
 
 
 /*************************************************************************
-Function: MC_Catcher_Set_Position()
-Purpose:  used to move the conveyor back or forward (in steps of 18°)
-Input:    none
-Returns:  enum COLOR
+Function: MC_Conveyor_Set_Position()
+Purpose:  used to move the conveyor back or forward (in steps of 18°,
+          two steps per slot). The slot ring follows the full slots and
+          marks the slot passing the drop point as dropped.
+Input:    steps
+Returns:  none
 **************************************************************************/
 extern void
 MC_Conveyor_Set_Position(int8_t step);
 
+/*************************************************************************
+Function: MC_Slot_Get()
+Purpose:  slot of the conveyor at a station
+Input:    MC_SLOT_SILO, MC_SLOT_SENSOR, MC_SLOT_DROP (or any slots
+          downstream of the sensor in between)
+Returns:  pointer to the slot
+**************************************************************************/
+extern MC_Slot_t *
+MC_Slot_Get(int8_t station);
+
+/*************************************************************************
+Function: MC_Slot_Index()
+Purpose:  number of the slot at a station (0..MC_CONVEYOR_SLOTS-1)
+Input:    station, see MC_Slot_Get()
+Returns:  index of the slot
+**************************************************************************/
+extern uint8_t
+MC_Slot_Index(int8_t station);
+
+/*************************************************************************
+Function: MC_Slot_Set_State()
+Purpose:  sets the state of a slot and notes the time since the state
+          before (MC_SLOT_LOADED starts over)
+Input:    slot, enum MC_slot_state
+Returns:  none
+**************************************************************************/
+extern void
+MC_Slot_Set_State(MC_Slot_t *slot, uint8_t state);
+
+/*************************************************************************
+Function: MC_Slot_Ms()
+Purpose:  time of a slot from entering one state to entering a later one,
+          in the units of the steps in between (see MC_SLOT_SHIFT_...)
+Input:    slot, enum MC_slot_state from (>= MC_SLOT_LOADED) and to
+Returns:  ms
+**************************************************************************/
+extern uint16_t
+MC_Slot_Ms(const MC_Slot_t *slot, uint8_t from, uint8_t to);
+
+/*************************************************************************
+Function: MC_Slots_Clear()
+Purpose:  marks all slots of the conveyor as empty
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+MC_Slots_Clear(void);
+
 /*************************************************************************
 Function: MC_Is_Conveyor_Idle()
-Purpose:  get motion status
+Purpose:  get motion status (cached, see MC_Time_To_Idle())
 Input:    none
 Returns:  1 if conveyor is idle, 0 else
 **************************************************************************/
 extern uint8_t
 MC_Is_Conveyor_Idle(void);
 
+/*************************************************************************
+Function: MC_Time_To_Idle()
+Purpose:  predicted time until the axis stops. The end of a move is
+          computed from the distance and the motor parameters when it is
+          started, the TMC222 is only polled near that time.
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR
+Returns:  ms, 0 if the axis is idle
+**************************************************************************/
+extern uint16_t
+MC_Time_To_Idle(uint8_t axis);
+
+/*************************************************************************
+Function: MC_Is_Near_Target()
+Purpose:  position trigger, fires before the axis has fully stopped (to
+          start the next action early). Reads the actual position of the
+          TMC222 only near the predicted end of the move.
+Input:    MC_AXIS_CATCHER or MC_AXIS_CONVEYOR, window in microsteps
+Returns:  1 if the axis is idle or within the window of its target, 0 else
+**************************************************************************/
+extern uint8_t
+MC_Is_Near_Target(uint8_t axis, uint16_t window);
+
+/*************************************************************************
+Function: MC_Outputs_Init()
+Purpose:  reads the IO expander into the input and output image
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+MC_Outputs_Init(void);
+
+/*************************************************************************
+Function: MC_Inputs_Get()
+Purpose:  returns the port of the IO expander. It is only read over the
+          bus when the expander signaled a change on the INT_TWI line
+          (the read also releases the line).
+Input:    none
+Returns:  port of the IO expander
+**************************************************************************/
+extern uint8_t
+MC_Inputs_Get(void);
+
+/*************************************************************************
+Makro:    MC_Output_Set / MC_Output_Clear
+Purpose:  changes an output bit of the IO expander in the output image only,
+          several changes are written together by MC_Outputs_Apply()
+Input:    MC_IO_EXPANDER_BIT_xxx
+Returns:  none
+**************************************************************************/
+#define MC_Output_Set(bit)      (mc_io_expander_out |= _BV(bit))
+#define MC_Output_Clear(bit)    (mc_io_expander_out &= ~_BV(bit))
+
+/*************************************************************************
+Function: MC_Outputs_Apply()
+Purpose:  writes the output image to the IO expander (one posted write,
+          nothing if the image did not change since the last write)
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+MC_Outputs_Apply(void);
+
 /*************************************************************************
 Makro:    MC_Solenoid_On
 Purpose:  switch the solenoid of the smartie silo
@@ -190,6 +451,16 @@ Returns:  1 if smaretie should lie in the chamber of the conveyor
 extern uint8_t
 MC_Is_Smartie_Ejected(void);
 
+/*************************************************************************
+Function: MC_Is_Smartie_Loaded()
+Purpose:  returns 1 if the Solenoid is off again (it may still recover
+          for MC_SOLENOID_OFF_TIME), so the conveyor may move on
+Input:    none
+Returns:  1 if the smartie lies in the chamber of the conveyor
+**************************************************************************/
+extern uint8_t
+MC_Is_Smartie_Loaded(void);
+
 /*************************************************************************
 ISR_Init:   MC_Timer_0Init()
 Purpose:    Initialisation of the timer0 interrupt that should occour
@@ -201,5 +472,25 @@ MC_Timer0_Init(void);
 extern void
 MC_FSM_Execute(void);
 
+/*************************************************************************
+Function: MC_Ticks_Get()
+Purpose:  returns the ms counter of the timer0 interrupt (wraps around
+          after 65.5 s, compare differences only)
+Input:    none
+Returns:  ms since MC_Timer0_Init()
+**************************************************************************/
+extern uint16_t
+MC_Ticks_Get(void);
+
+/*************************************************************************
+Function: MC_Clock_Get()
+Purpose:  MC_Ticks_Get() and the timer0 clocks into the actual ms, for
+          measuring runtimes below 1 ms (call with interrupts enabled)
+Input:    pointer for the clocks (0..MC_CLOCKS_PER_MS-1)
+Returns:  ms since MC_Timer0_Init()
+**************************************************************************/
+extern uint16_t
+MC_Clock_Get(uint8_t *p_clocks);
+
 
 #endif // _MOTION_CONTROLL_H
@@ -0,0 +1,231 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  scheduler.c
+ *    Description:  cooperative scheduler on the 1 ms tick of timer0 (see scheduler.h)
+ *
+ *        Version:  1.0
+ *        Created:  17.10.2026 15:50:30
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Ignaz Laepple (mn), ignaz.laepple@gmx.de
+ *        Company:  FH-Regensburg
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "uart.h"
+#include "motion_controll.h"
+#include "scheduler.h"
+
+
+static SCH_Task_t   *sch_tasks;         // in the order they were added
+// longer runs saturate the 16 bit clocks of the max. runtime
+#define SCH_MAX_MS          (0xFFFF / MC_CLOCKS_PER_MS)
+
+#if SCH_ACCOUNTING
+static uint16_t     sch_last;           // MC_Ticks_Get() of the last pass
+static uint32_t     sch_ms;             // time since the last report [ms]
+#endif
+
+
+/*************************************************************************
+Function: SCH_Task_Add()
+Purpose:  adds a task to the scheduler, periodic and polled tasks are
+          released at once, SCH_ONCE waits for SCH_Task_Start()
+Input:    task (static), name (PSTR), function, period [ms] or SCH_POLL
+          or SCH_ONCE, deadline [ms] (0: none)
+Returns:  none
+**************************************************************************/
+void
+SCH_Task_Add(SCH_Task_t *task, PGM_P name, void (*run)(void),
+             uint16_t period, uint16_t deadline)
+{
+    SCH_Task_t *last;
+
+    task->next = NULL;
+    task->run = run;
+    task->name = name;
+    task->period = period;
+    task->deadline = deadline;
+    task->release = MC_Ticks_Get();
+    task->active = (period != SCH_ONCE);
+    task->misses = 0;
+    task->max = 0;
+#if SCH_ACCOUNTING
+    task->runs = 0;
+    task->sum = 0;
+#endif
+    if(!sch_tasks)
+        sch_tasks = task;
+    else
+    {
+        for(last = sch_tasks; last->next; last = last->next);
+        last->next = task;
+    }
+}
+
+
+/*************************************************************************
+Function: SCH_Task_Start()
+Purpose:  (re)starts a task after a delay, a periodic task keeps its
+          period from there
+Input:    task, delay [ms]
+Returns:  none
+**************************************************************************/
+void
+SCH_Task_Start(SCH_Task_t *task, uint16_t delay)
+{
+    task->release = MC_Ticks_Get() + delay;
+    task->active = 1;
+}
+
+
+/*************************************************************************
+Function: SCH_Task_Stop()
+Purpose:  the task isn't run until the next SCH_Task_Start()
+Input:    task
+Returns:  none
+**************************************************************************/
+void
+SCH_Task_Stop(SCH_Task_t *task)
+{
+    task->active = 0;
+}
+
+
+/*************************************************************************
+Function: SCH_Run()
+Purpose:  one pass of the scheduler: runs the tasks that are due, call
+          it in the main loop
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+SCH_Run(void)
+{
+    SCH_Task_t *task;
+    uint16_t now, end, release, clocks;
+    uint8_t clk, end_clk;
+
+    now = MC_Clock_Get(&clk);
+#if SCH_ACCOUNTING
+    sch_ms += (uint16_t)(now - sch_last);
+    sch_last = now;
+#endif
+
+    for(task = sch_tasks; task; task = task->next)
+    {
+        if(!task->active || (int16_t)(now - task->release) < 0)
+            continue;
+        if(task->period == SCH_ONCE)
+            task->active = 0;           // before the run, it may restart itself
+        release = task->release;
+
+        task->run();
+
+        // the end of this run is the start of the next one
+        end = MC_Clock_Get(&end_clk);
+        if((uint16_t)(end - now) >= SCH_MAX_MS)
+            clocks = 0xFFFF;
+        else
+            clocks = (uint16_t)(end - now) * MC_CLOCKS_PER_MS + end_clk - clk;
+        clk = end_clk;
+
+        if(clocks > task->max)
+            task->max = clocks;
+        if(task->deadline && (uint16_t)(end - release) > task->deadline
+                && task->misses < 0xFFFF)
+            task->misses++;
+#if SCH_ACCOUNTING
+        task->runs++;
+        task->sum += clocks;
+#endif
+        now = end;
+
+        if(task->period == SCH_POLL)
+            task->release = end;
+        else if(task->period != SCH_ONCE && task->release == release)
+        {
+            task->release += task->period;
+            // more than a period late: skip the missed runs
+            if((int16_t)(end - task->release) >= 0)
+                task->release = end + task->period;
+        }
+    }
+}
+
+
+/*************************************************************************
+Function: SCH_Report()
+Purpose:  prints the tasks with period, deadline, deadline misses and
+          longest run [us] since the last report; with SCH_ACCOUNTING also
+          runs, average run [us] and CPU load [0.1 %]. Clears the accounting
+Input:    none
+Returns:  none
+**************************************************************************/
+void
+SCH_Report(void)
+{
+    SCH_Task_t *task;
+    char buffer[11];
+#if SCH_ACCOUNTING
+    uint32_t per_mille = sch_ms * MC_CLOCKS_PER_MS / 1000;  // clocks per 0.1 %
+
+    uart_puts_P("\n\rtask\t\tperiod\tdeadl.\truns\tmisses\tavg\tmax\tload");
+#else
+    uart_puts_P("\n\rtask\t\tperiod\tdeadl.\tmisses\tmax");
+#endif
+    for(task = sch_tasks; task; task = task->next)
+    {
+        uart_puts_P("\n\r");
+        uart_puts_p(task->name);
+        uart_puts_P("\t");
+        if(strlen_P(task->name) < 8)
+            uart_puts_P("\t");
+        if(task->period == SCH_POLL)
+            uart_puts_P("poll");
+        else if(task->period == SCH_ONCE)
+            uart_puts_P("once");
+        else
+            uart_puts(utoa(task->period,buffer,10));
+        uart_puts_P("\t");
+        uart_puts(utoa(task->deadline,buffer,10));
+#if SCH_ACCOUNTING
+        uart_puts_P("\t");
+        uart_puts(ultoa(task->runs,buffer,10));
+#endif
+        uart_puts_P("\t");
+        uart_puts(utoa(task->misses,buffer,10));
+#if SCH_ACCOUNTING
+        uart_puts_P("\t");
+        uart_puts(ultoa(task->runs ? MC_CLOCKS_TO_US(task->sum / task->runs) : 0,buffer,10));
+#endif
+        uart_puts_P("\t");
+        uart_puts(ultoa(MC_CLOCKS_TO_US(task->max),buffer,10));
+#if SCH_ACCOUNTING
+        uart_puts_P("\t");
+        uart_puts(ultoa(per_mille ? task->sum / per_mille : 0,buffer,10));
+
+        task->runs = 0;
+        task->sum = 0;
+#endif
+        task->misses = 0;
+        task->max = 0;
+    }
+#if SCH_ACCOUNTING
+    uart_puts_P("\n\r[ms, us, 0.1 %] over ");
+    uart_puts(ultoa(sch_ms,buffer,10));
+    uart_puts_P(" ms");
+    sch_ms = 0;
+#else
+    uart_puts_P("\n\r[ms, us]");
+#endif
+}
@@ -0,0 +1,104 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  scheduler.h
+ *    Description:  cooperative scheduler on the 1 ms tick of timer0 (MC_Ticks_Get()).
+ *                  The tasks belong to the modules that add them, SCH_Run() runs
+ *                  every task that is due once, in the order they were added, and
+ *                  accounts their runtime. A task has to return quickly; a task
+ *                  that blocks delays all others and shows up as deadline misses.
+ *                  All globals and functions of this entity start with SCH_
+ *
+ *        Version:  1.0
+ *        Created:  17.10.2026 15:50:30
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Ignaz Laepple (mn), ignaz.laepple@gmx.de
+ *        Company:  FH-Regensburg
+ *
+ * =====================================================================================
+ */
+
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <avr/pgmspace.h>
+
+#include "debug.h"
+
+#define SCH_POLL        0           // period: runs on every pass of SCH_Run()
+#define SCH_ONCE        0xFFFF      // period: runs once after SCH_Task_Start()
+
+typedef struct SCH_Task_s
+{
+    struct SCH_Task_s   *next;
+    void                (*run)(void);
+    PGM_P               name;
+    uint16_t            period;     // [ms], SCH_POLL or SCH_ONCE
+    uint16_t            deadline;   // [ms] from the release to the end of the run, 0: none
+    uint16_t            release;    // MC_Ticks_Get() of the next run (SCH_POLL: of the last)
+    uint8_t             active;
+    // accounting since the last SCH_Report()
+    uint16_t            misses;     // runs that ended after the deadline
+    uint16_t            max;        // longest run [timer0 clocks], saturates
+#if SCH_ACCOUNTING
+    uint32_t            runs;
+    uint32_t            sum;        // all runs [timer0 clocks]
+#endif
+} SCH_Task_t;
+
+/*************************************************************************
+Function: SCH_Task_Add()
+Purpose:  adds a task to the scheduler, periodic and polled tasks are
+          released at once, SCH_ONCE waits for SCH_Task_Start()
+Input:    task (static), name (PSTR), function, period [ms] or SCH_POLL
+          or SCH_ONCE, deadline [ms] (0: none)
+Returns:  none
+**************************************************************************/
+extern void
+SCH_Task_Add(SCH_Task_t *task, PGM_P name, void (*run)(void),
+             uint16_t period, uint16_t deadline);
+
+/*************************************************************************
+Function: SCH_Task_Start()
+Purpose:  (re)starts a task after a delay, a periodic task keeps its
+          period from there
+Input:    task, delay [ms]
+Returns:  none
+**************************************************************************/
+extern void
+SCH_Task_Start(SCH_Task_t *task, uint16_t delay);
+
+/*************************************************************************
+Function: SCH_Task_Stop()
+Purpose:  the task isn't run until the next SCH_Task_Start()
+Input:    task
+Returns:  none
+**************************************************************************/
+extern void
+SCH_Task_Stop(SCH_Task_t *task);
+
+/*************************************************************************
+Function: SCH_Run()
+Purpose:  one pass of the scheduler: runs the tasks that are due, call
+          it in the main loop
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+SCH_Run(void);
+
+/*************************************************************************
+Function: SCH_Report()
+Purpose:  prints the tasks with period, deadline, deadline misses and
+          longest run [us] since the last report; with SCH_ACCOUNTING also
+          runs, average run [us] and CPU load [0.1 %]. Clears the accounting
+Input:    none
+Returns:  none
+**************************************************************************/
+extern void
+SCH_Report(void);
+
+
+#endif // _SCHEDULER_H
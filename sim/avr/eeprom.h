@@ -0,0 +1,33 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  avr/eeprom.h
+ *    Description:  Host replacement of <avr/eeprom.h> (see sim.h).
+ *                  EEMEM variables are collected in the section sim_eeprom; their
+ *                  offset in this section is the address into sim_eeprom[].
+ *                  Writes cost the 8.5 ms per byte of the ATmega32.
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_AVR_EEPROM_H
+#define _SIM_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEMEM                   __attribute__((section("sim_eeprom")))
+
+#define eeprom_busy_wait()      do {} while (0)
+#define eeprom_is_ready()       1
+
+extern void     eeprom_read_block(void *dst, const void *src, size_t n);
+extern void     eeprom_write_block(const void *src, void *dst, size_t n);
+extern void     eeprom_update_block(const void *src, void *dst, size_t n);
+extern uint8_t  eeprom_read_byte(const uint8_t *addr);
+extern void     eeprom_write_byte(uint8_t *addr, uint8_t value);
+extern void     eeprom_update_byte(uint8_t *addr, uint8_t value);
+extern uint16_t eeprom_read_word(const uint16_t *addr);
+extern void     eeprom_write_word(uint16_t *addr, uint16_t value);
+extern void     eeprom_update_word(uint16_t *addr, uint16_t value);
+
+#endif // _SIM_AVR_EEPROM_H
@@ -0,0 +1,21 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  avr/interrupt.h
+ *    Description:  Host replacement of <avr/interrupt.h> (see sim.h).
+ *                  ISRs are plain functions called by the simulation.
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_AVR_INTERRUPT_H
+#define _SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...)        void vector(void)
+#define SIGNAL(vector)          void vector(void)
+
+#define sei()                   SIM_Sei()
+#define cli()                   SIM_Cli()
+
+#endif // _SIM_AVR_INTERRUPT_H
@@ -0,0 +1,161 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  avr/io.h
+ *    Description:  Host replacement of <avr/io.h> for the ATmega32 (see sim.h).
+ *                  Every register is an lvalue that goes through SIM_IO(), which
+ *                  advances the virtual clock and runs the simulated peripherals.
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_AVR_IO_H
+#define _SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "../sim.h"
+
+#define _BV(bit)                (1 << (bit))
+#define bit_is_set(reg, bit)    ((reg) & _BV(bit))
+#define bit_is_clear(reg, bit)  (!((reg) & _BV(bit)))
+
+#define RAMEND                  0x85F
+
+#define SREG                    (*SIM_IO(SIM_SREG))
+
+/* TWI */
+#define TWBR                    (*SIM_IO(SIM_TWBR))
+#define TWSR                    (*SIM_IO(SIM_TWSR))
+#define TWAR                    (*SIM_IO(SIM_TWAR))
+#define TWDR                    (*SIM_IO(SIM_TWDR))
+#define TWCR                    (*SIM_IO(SIM_TWCR))
+
+#define TWINT                   7
+#define TWEA                    6
+#define TWSTA                   5
+#define TWSTO                   4
+#define TWWC                    3
+#define TWEN                    2
+#define TWIE                    0
+#define TWPS1                   1
+#define TWPS0                   0
+
+/* ports */
+#define PORTA                   (*SIM_IO(SIM_PORTA))
+#define DDRA                    (*SIM_IO(SIM_DDRA))
+#define PINA                    (*SIM_IO(SIM_PINA))
+#define PORTB                   (*SIM_IO(SIM_PORTB))
+#define DDRB                    (*SIM_IO(SIM_DDRB))
+#define PINB                    (*SIM_IO(SIM_PINB))
+#define PORTC                   (*SIM_IO(SIM_PORTC))
+#define DDRC                    (*SIM_IO(SIM_DDRC))
+#define PINC                    (*SIM_IO(SIM_PINC))
+#define PORTD                   (*SIM_IO(SIM_PORTD))
+#define DDRD                    (*SIM_IO(SIM_DDRD))
+#define PIND                    (*SIM_IO(SIM_PIND))
+
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+/* timer 0 */
+#define TCCR0                   (*SIM_IO(SIM_TCCR0))
+#define TCNT0                   (*SIM_IO(SIM_TCNT0))
+#define OCR0                    (*SIM_IO(SIM_OCR0))
+#define TIMSK                   (*SIM_IO(SIM_TIMSK))
+#define TIFR                    (*SIM_IO(SIM_TIFR))
+
+#define CS00                    0
+#define CS01                    1
+#define CS02                    2
+#define TOIE0                   0
+#define OCIE0                   1
+#define TOV0                    0
+#define OCF0                    1
+
+/* USART */
+#define UDR                     (*SIM_IO(SIM_UDR))
+#define UCSRA                   (*SIM_IO(SIM_UCSRA))
+#define UCSRB                   (*SIM_IO(SIM_UCSRB))
+#define UCSRC                   (*SIM_IO(SIM_UCSRC))
+#define UBRRL                   (*SIM_IO(SIM_UBRRL))
+#define UBRRH                   (*SIM_IO(SIM_UBRRH))
+
+#define RXC                     7
+#define TXC                     6
+#define UDRE                    5
+#define FE                      4
+#define DOR                     3
+#define PE                      2
+#define U2X                     1
+#define MPCM                    0
+#define RXCIE                   7
+#define TXCIE                   6
+#define UDRIE                   5
+#define RXEN                    4
+#define TXEN                    3
+#define UCSZ2                   2
+#define RXB8                    1
+#define TXB8                    0
+#define URSEL                   7
+#define UMSEL                   6
+#define UPM1                    5
+#define UPM0                    4
+#define USBS                    3
+#define UCSZ1                   2
+#define UCSZ0                   1
+#define UCPOL                   0
+
+/* external interrupts */
+#define GICR                    (*SIM_IO(SIM_GICR))
+#define GIFR                    (*SIM_IO(SIM_GIFR))
+#define MCUCR                   (*SIM_IO(SIM_MCUCR))
+#define MCUCSR                  (*SIM_IO(SIM_MCUCSR))
+
+#define INT1                    7
+#define INT0                    6
+#define INT2                    5
+#define INTF1                   7
+#define INTF0                   6
+#define INTF2                   5
+#define ISC11                   3
+#define ISC10                   2
+#define ISC01                   1
+#define ISC00                   0
+
+/* interrupt vectors (numbering of the ATmega32) */
+#define INT1_vect               __vector_2
+#define TIMER0_OVF_vect         __vector_11
+#define USART_RXC_vect          __vector_13
+#define USART_UDRE_vect         __vector_14
+#define TWI_vect                __vector_19
+
+#endif // _SIM_AVR_IO_H
@@ -0,0 +1,33 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  avr/pgmspace.h
+ *    Description:  Host replacement of <avr/pgmspace.h> (see sim.h).
+ *                  Program memory is ordinary (const) memory on the host.
+ *                  pgm_read_word() reads an object of the pointed-to type, so
+ *                  PROGMEM tables of function pointers keep working with 64 bit
+ *                  pointers. Every read is charged SIM_CYCLES_PGM.
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_AVR_PGMSPACE_H
+#define _SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define PGM_P                   const char *
+
+extern void SIM_Pgm_Read(void);
+
+#define pgm_read_byte(addr)     (SIM_Pgm_Read(), *(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (SIM_Pgm_Read(), (uintptr_t)*(addr))
+#define pgm_read_dword(addr)    (SIM_Pgm_Read(), *(const uint32_t *)(addr))
+
+#define memcpy_P                memcpy
+#define strlen_P                strlen
+#define strcat_P                strcat
+
+#endif // _SIM_AVR_PGMSPACE_H
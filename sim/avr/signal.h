@@ -0,0 +1,2 @@
+/* Host replacement of the deprecated <avr/signal.h> (see sim.h). */
+#include <avr/interrupt.h>
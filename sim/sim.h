@@ -0,0 +1,160 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim.h
+ *    Description:  Host simulation of the smarties sorter.
+ *                  The firmware sources are compiled unchanged for the host (make sim)
+ *                  against the stub headers in this directory. Every access to an
+ *                  IO register and every function entry (-finstrument-functions) is a
+ *                  hook that advances the virtual clock, runs the simulated peripherals
+ *                  (TWI, Timer0, UART) and dispatches pending interrupts.
+ *                  Everything is driven by the virtual clock only, so two runs with the
+ *                  same options give exactly the same result.
+ *                  All globals and functions of the simulation start with SIM_
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/****** Clock ***********************************************************/
+#define SIM_F_CPU               12000000UL
+#define SIM_CYCLES_IO           4       // register access incl. the surrounding code
+#define SIM_CYCLES_CALL         24      // call, prologue, epilogue and return
+#define SIM_CYCLES_ISR          12      // interrupt entry and reti
+#define SIM_CYCLES_PGM          6       // LPM incl. loading the address
+
+#define SIM_US(us)              ((uint64_t)(us) * (SIM_F_CPU / 1000000UL))
+#define SIM_MS(ms)              ((uint64_t)(ms) * (SIM_F_CPU / 1000UL))
+
+extern uint64_t sim_now;                // virtual time in cpu cycles
+extern uint64_t sim_end;                // the run ends when sim_now reaches it
+
+/****** IO registers ****************************************************/
+enum SIM_Reg { SIM_SREG = 0,
+               SIM_TWBR, SIM_TWSR, SIM_TWAR, SIM_TWDR, SIM_TWCR,
+               SIM_PORTA, SIM_DDRA, SIM_PINA,
+               SIM_PORTB, SIM_DDRB, SIM_PINB,
+               SIM_PORTC, SIM_DDRC, SIM_PINC,
+               SIM_PORTD, SIM_DDRD, SIM_PIND,
+               SIM_TCCR0, SIM_TCNT0, SIM_OCR0, SIM_TIMSK, SIM_TIFR,
+               SIM_UDR, SIM_UCSRA, SIM_UCSRB, SIM_UCSRC, SIM_UBRRL, SIM_UBRRH,
+               SIM_GICR, SIM_GIFR, SIM_MCUCR, SIM_MCUCSR,
+               SIM_REG_MAX
+             };
+extern volatile uint8_t sim_reg[SIM_REG_MAX];
+
+extern volatile uint8_t *SIM_IO(uint8_t reg);
+extern void SIM_Cli(void);
+extern void SIM_Sei(void);
+extern void SIM_Delay_Us(double us);
+
+/****** Scheduler *******************************************************/
+/* Wakes up the simulation at the given time: the callback is called from the
+ * hook that first reaches it. One entry per source, re-arm from the callback. */
+typedef struct SIM_Event_s
+{
+    uint64_t time;
+    uint8_t  armed;
+    void     (*callback)(void);
+} SIM_Event_t;
+
+extern void SIM_Event_Set(SIM_Event_t *ev, uint64_t time);
+extern void SIM_Event_Clear(SIM_Event_t *ev);
+extern void SIM_Step(uint32_t cycles);
+
+/****** Interrupts ******************************************************/
+enum SIM_Irq { SIM_IRQ_INT1 = 0,
+               SIM_IRQ_TIMER0_OVF,
+               SIM_IRQ_USART_RXC,
+               SIM_IRQ_USART_UDRE,
+               SIM_IRQ_TWI,
+               SIM_IRQ_MAX
+             };
+extern void SIM_Irq_Set(uint8_t irq);
+
+/* INT_TWI (PD3 / INT1): open drain line shared by the slaves, low while one
+ * of the sources is active; edges raise INT1 as selected in MCUCR */
+#define SIM_INT_TWI_EXPANDER    0x01
+extern void SIM_Int_TWI(uint8_t src, uint8_t active);
+
+/****** Peripherals (sim_core.c, sim_twi.c) *****************************/
+extern void SIM_Core_Init(void);
+extern void SIM_Uart_Input(uint64_t time, const char *s);
+extern uint8_t sim_uart_echo;
+
+extern void SIM_TWI_Init(void);
+extern void SIM_TWI_Commit(void);
+extern uint8_t SIM_TWI_Irq_Pending(void);
+extern void SIM_TWI_Report(FILE *f);
+extern uint64_t SIM_TWI_Bytes(void);
+
+/****** TWI slaves ******************************************************/
+typedef struct SIM_Dev_s
+{
+    uint8_t     addr;
+    const char  *name;
+    void        (*start)(struct SIM_Dev_s *dev, uint8_t read);
+    uint8_t     (*write)(struct SIM_Dev_s *dev, uint8_t data);  // 1: ACK
+    uint8_t     (*read)(struct SIM_Dev_s *dev);
+    void        (*stop)(struct SIM_Dev_s *dev);
+    void        *priv;
+    // traffic counters (maintained by sim_twi.c)
+    uint32_t    transactions;
+    uint32_t    bytes;
+    uint64_t    busy;
+} SIM_Dev_t;
+
+extern void SIM_TWI_Attach(SIM_Dev_t *dev);
+
+/****** Device models ***************************************************/
+extern void     SIM_TMC222_Init(void);
+extern double   SIM_TMC222_Angle(uint8_t addr);
+extern uint8_t  SIM_TMC222_Moving(uint8_t addr);
+extern void     SIM_TMC222_Tick(double dt);
+extern void     SIM_TMC222_Report(FILE *f);
+
+extern void     SIM_ADJD_S311_Init(void);
+extern void     SIM_TLC59116_Init(void);
+extern double   SIM_TLC59116_Light(uint8_t channel);
+
+extern void     SIM_Expander_Init(void);
+extern uint8_t  SIM_Expander_Outputs(void);
+extern void     SIM_Expander_Tick(void);
+
+extern void     SIM_LCD_Init(void);
+extern void     SIM_LCD_Report(FILE *f);
+
+/****** Sorter mechanics (sim_sorter.c) *********************************/
+#define SIM_COLORS              9       // same order as enum COLOR
+
+extern void     SIM_Sorter_Init(uint32_t seed);
+extern void     SIM_Sorter_Mix(const char *weights);
+extern void     SIM_Sorter_Tick(void);
+extern void     SIM_Sorter_View(double refl[3]);
+extern uint8_t  SIM_Sorter_Catcher_At_Reference(void);
+extern uint8_t  SIM_Sorter_Conveyor_At_Reference(void);
+extern void     SIM_Sorter_Solenoid(uint8_t on);
+extern void     SIM_Sorter_Report(FILE *f);
+extern uint32_t SIM_Sorter_Sorted(void);
+
+/****** EEPROM **********************************************************/
+#define SIM_EEPROM_SIZE         1024
+extern uint8_t  sim_eeprom[SIM_EEPROM_SIZE];
+
+/****** Statistics ******************************************************/
+extern void     *sim_loop_fn;           // function called once per main loop iteration
+extern uint64_t sim_loop_cnt;           // main loop iterations
+extern uint64_t sim_loop_max;           // longest main loop iteration (cycles)
+
+extern void SIM_Report(FILE *f);
+extern void SIM_Exit(void);
+
+#endif // _SIM_H
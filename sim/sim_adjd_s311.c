@@ -0,0 +1,184 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_adjd_s311.c
+ *    Description:  Model of the ADJD-S311 colour sensor at 0x74 (see sim.h).
+ *                  Register file with auto-increment pointer. Writing GSSR or GOFS to
+ *                  CTRL starts a conversion that takes the longest integration time
+ *                  of the four channels; the bit reads back as 1 until it is done.
+ *                  A channel reads
+ *                      Int / (Cap + 1) * (dark + K * light * reflectance)
+ *                  with the light of the LEDs at the end of the conversion and the
+ *                  reflectance of whatever the sorter model puts under the sensor.
+ *
+ * =====================================================================================
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define ADJD_CTRL               0x00
+#define ADJD_CONFIG             0x01
+#define ADJD_CAP                0x06
+#define ADJD_INT                0x0A
+#define ADJD_DATA               0x40
+#define ADJD_OFFSET             0x48
+#define ADJD_REGS               0x50
+
+#define ADJD_GSSR               0x01
+#define ADJD_GOFS               0x02
+#define ADJD_TOFS               0x01
+
+#define ADJD_DARK               2.5     // dark current per gain unit
+#define ADJD_CROSS_CLEAR        0.8     // response of the clear channel to each LED
+
+enum { CH_RED = 0, CH_GREEN, CH_BLUE, CH_CLEAR };
+
+/* full scale response to the LEDs of the channel at PWM 255 (per gain unit) */
+static const double sim_adjd_k[3] = { 70.0, 60.0, 52.0 };
+
+static SIM_Dev_t    sim_adjd_dev;
+static uint8_t      sim_adjd_reg[ADJD_REGS];
+static uint8_t      sim_adjd_ptr;
+static uint8_t      sim_adjd_first;     // next written byte is the register pointer
+static SIM_Event_t  sim_adjd_ev;
+static uint32_t     sim_adjd_noise = 0x2545F491;
+static uint32_t     sim_adjd_conversions;
+
+static double
+SIM_ADJD_Gain(uint8_t ch)
+{
+    uint16_t integ = sim_adjd_reg[ADJD_INT + 2 * ch]
+                     | ((sim_adjd_reg[ADJD_INT + 2 * ch + 1] & 0x0F) << 8);
+
+    return (double)integ / ((sim_adjd_reg[ADJD_CAP + ch] & 0x0F) + 1);
+}
+
+/* +-2 counts of deterministic noise */
+static double
+SIM_ADJD_Noise(void)
+{
+    sim_adjd_noise ^= sim_adjd_noise << 13;
+    sim_adjd_noise ^= sim_adjd_noise >> 17;
+    sim_adjd_noise ^= sim_adjd_noise << 5;
+    return (double)(sim_adjd_noise % 5) - 2.0;
+}
+
+static void
+SIM_ADJD_Done(void)
+{
+    uint8_t ctrl = sim_adjd_reg[ADJD_CTRL];
+    uint8_t ch;
+
+    if (ctrl & ADJD_GOFS)
+    {
+        for (ch=0; ch<4; ch++)
+        {
+            double off = SIM_ADJD_Gain(ch) * ADJD_DARK;
+            sim_adjd_reg[ADJD_OFFSET + ch] = off > 127 ? 127 : (uint8_t)lround(off);
+        }
+    }
+    if (ctrl & ADJD_GSSR)
+    {
+        double refl[3], light[3], sum = 0, v;
+
+        SIM_Sorter_View(refl);
+        light[CH_RED] = SIM_TLC59116_Light(4) + SIM_TLC59116_Light(5);
+        light[CH_GREEN] = SIM_TLC59116_Light(2) + SIM_TLC59116_Light(3);
+        light[CH_BLUE] = SIM_TLC59116_Light(0) + SIM_TLC59116_Light(1);
+
+        for (ch=0; ch<4; ch++)
+        {
+            if (ch < 3)
+            {
+                sum += sim_adjd_k[ch] * light[ch] * refl[ch];
+                v = SIM_ADJD_Gain(ch) * (ADJD_DARK + sim_adjd_k[ch] * light[ch] * refl[ch]);
+            }
+            else
+                v = SIM_ADJD_Gain(ch) * (ADJD_DARK + ADJD_CROSS_CLEAR * sum);
+            v += SIM_ADJD_Noise();
+            if (sim_adjd_reg[ADJD_CONFIG] & ADJD_TOFS)
+                v -= (int8_t)sim_adjd_reg[ADJD_OFFSET + ch];
+            if (v < 0)
+                v = 0;
+            if (v > 1023)
+                v = 1023;
+            sim_adjd_reg[ADJD_DATA + 2 * ch] = (uint16_t)v & 0xFF;
+            sim_adjd_reg[ADJD_DATA + 2 * ch + 1] = (uint16_t)v >> 8;
+        }
+    }
+    sim_adjd_conversions++;
+    sim_adjd_reg[ADJD_CTRL] = 0;
+}
+
+static void
+SIM_ADJD_Start_Conversion(void)
+{
+    double t = 0;
+    uint8_t ch;
+
+    for (ch=0; ch<4; ch++)
+    {
+        double integ = SIM_ADJD_Gain(ch) * ((sim_adjd_reg[ADJD_CAP + ch] & 0x0F) + 1);
+        if (integ > t)
+            t = integ;
+    }
+    SIM_Event_Set(&sim_adjd_ev, sim_now + SIM_US(t * 10 + 100));
+}
+
+static void
+SIM_ADJD_Start(SIM_Dev_t *dev, uint8_t read)
+{
+    (void)dev;
+    sim_adjd_first = !read;
+}
+
+static uint8_t
+SIM_ADJD_Write(SIM_Dev_t *dev, uint8_t data)
+{
+    (void)dev;
+    if (sim_adjd_first)
+    {
+        sim_adjd_ptr = data;
+        sim_adjd_first = 0;
+        return 1;
+    }
+    if (sim_adjd_ptr >= ADJD_REGS)
+        return 0;
+    if (sim_adjd_ptr == ADJD_CTRL)
+    {
+        // a running conversion can't be restarted
+        if (!sim_adjd_ev.armed && (data & (ADJD_GSSR | ADJD_GOFS)))
+        {
+            sim_adjd_reg[ADJD_CTRL] = data & (ADJD_GSSR | ADJD_GOFS);
+            SIM_ADJD_Start_Conversion();
+        }
+    }
+    else if (sim_adjd_ptr < ADJD_DATA)
+        sim_adjd_reg[sim_adjd_ptr] = data;
+    sim_adjd_ptr++;
+    return 1;
+}
+
+static uint8_t
+SIM_ADJD_Read(SIM_Dev_t *dev)
+{
+    (void)dev;
+    if (sim_adjd_ptr >= ADJD_REGS)
+        return 0xFF;
+    return sim_adjd_reg[sim_adjd_ptr++];
+}
+
+void
+SIM_ADJD_S311_Init(void)
+{
+    sim_adjd_dev.addr = 0x74;
+    sim_adjd_dev.name = "ADJD-S311";
+    sim_adjd_dev.start = SIM_ADJD_Start;
+    sim_adjd_dev.write = SIM_ADJD_Write;
+    sim_adjd_dev.read = SIM_ADJD_Read;
+    sim_adjd_ev.callback = SIM_ADJD_Done;
+    SIM_TWI_Attach(&sim_adjd_dev);
+}
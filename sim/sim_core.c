@@ -0,0 +1,592 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_core.c
+ *    Description:  Virtual clock, register file, interrupt dispatch, Timer0, USART
+ *                  and EEPROM of the simulated ATmega32 (see sim.h).
+ *
+ *                  Simplifications:
+ *                  - the USART transmits instantly (the firmware spins on its tx ring
+ *                    buffer without touching a register, so a rate limit would hang)
+ *                  - TCNT0 is taken over when Timer0 is started and after every
+ *                    TIMER0_OVF interrupt (the only places the firmware writes it),
+ *                    as written at the entry of the ISR
+ *
+ * =====================================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define SREG_I                  0x80
+
+uint64_t sim_now;
+volatile uint8_t sim_reg[SIM_REG_MAX];
+
+uint64_t sim_end = ~0ULL;               // end of the simulation run
+void    *sim_loop_fn;                   // function that marks a main loop iteration
+uint64_t sim_loop_cnt;
+uint64_t sim_loop_max;
+static uint64_t sim_loop_first, sim_loop_last;
+
+static uint8_t sim_in_isr;
+
+/* interrupt vectors of the firmware, missing ones are never enabled */
+extern void __vector_2(void)  __attribute__((weak));
+extern void __vector_11(void) __attribute__((weak));
+extern void __vector_13(void) __attribute__((weak));
+extern void __vector_14(void) __attribute__((weak));
+extern void __vector_19(void) __attribute__((weak));
+
+/******** Scheduler ******************************************************/
+
+#define SIM_EVENTS_MAX          16
+
+static SIM_Event_t *sim_events[SIM_EVENTS_MAX];
+static uint8_t      sim_events_cnt;
+static uint64_t     sim_next = ~0ULL;   // time of the next armed event
+
+static void
+SIM_Event_Update(void)
+{
+    uint8_t i;
+
+    sim_next = ~0ULL;
+    for (i=0; i<sim_events_cnt; i++)
+        if (sim_events[i]->armed && sim_events[i]->time < sim_next)
+            sim_next = sim_events[i]->time;
+}
+
+void
+SIM_Event_Set(SIM_Event_t *ev, uint64_t time)
+{
+    uint8_t i;
+
+    for (i=0; i<sim_events_cnt; i++)
+        if (sim_events[i] == ev)
+            break;
+    if (i == sim_events_cnt)
+    {
+        if (sim_events_cnt == SIM_EVENTS_MAX)
+        {
+            fprintf(stderr, "sim: too many event sources\n");
+            exit(2);
+        }
+        sim_events[sim_events_cnt++] = ev;
+    }
+    ev->time = time;
+    ev->armed = 1;
+    if (time < sim_next)
+        sim_next = time;
+}
+
+void
+SIM_Event_Clear(SIM_Event_t *ev)
+{
+    ev->armed = 0;
+    SIM_Event_Update();
+}
+
+static void
+SIM_Event_Run(void)
+{
+    uint8_t i;
+
+    while (sim_now >= sim_next)
+    {
+        for (i=0; i<sim_events_cnt; i++)
+        {
+            SIM_Event_t *ev = sim_events[i];
+            if (ev->armed && ev->time <= sim_now)
+            {
+                ev->armed = 0;
+                ev->callback();
+            }
+        }
+        SIM_Event_Update();
+    }
+}
+
+/******** Timer0 *********************************************************/
+
+static const uint16_t sim_t0_prescaler[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+static uint8_t      sim_t0_cs;          // running clock select
+static uint64_t     sim_t0_base;        // time when TCNT0 had the value sim_t0_cnt
+static uint8_t      sim_t0_cnt;
+static SIM_Event_t  sim_t0_ev;
+
+static void
+SIM_Timer0_Schedule(void)
+{
+    uint16_t presc = sim_t0_prescaler[sim_t0_cs];
+
+    if (presc)
+        SIM_Event_Set(&sim_t0_ev, sim_t0_base + (uint64_t)(256 - sim_t0_cnt) * presc);
+    else
+        SIM_Event_Clear(&sim_t0_ev);
+}
+
+static void
+SIM_Timer0_Overflow(void)
+{
+    sim_t0_base = sim_t0_ev.time;
+    sim_t0_cnt = 0;
+    sim_reg[SIM_TIFR] |= 1 << 0;        // TOV0
+    SIM_Timer0_Schedule();
+}
+
+static void
+SIM_Timer0_Commit(void)
+{
+    uint8_t cs = sim_reg[SIM_TCCR0] & 0x07;
+
+    if (cs != sim_t0_cs)
+    {
+        sim_t0_cs = cs;
+        sim_t0_base = sim_now;
+        sim_t0_cnt = sim_reg[SIM_TCNT0];
+        SIM_Timer0_Schedule();
+    }
+}
+
+static uint8_t
+SIM_Timer0_Count(void)
+{
+    uint16_t presc = sim_t0_prescaler[sim_t0_cs];
+
+    if (!presc)
+        return sim_t0_cnt;
+    return (uint8_t)(sim_t0_cnt + (sim_now - sim_t0_base) / presc);
+}
+
+/******** USART **********************************************************/
+
+#define SIM_UART_CHAR           SIM_US(1042)    // 10 bits at 9600 baud
+
+typedef struct SIM_Uart_Chunk_s
+{
+    uint64_t time;
+    char     *s;
+    struct SIM_Uart_Chunk_s *next;
+} SIM_Uart_Chunk_t;
+
+uint8_t sim_uart_echo = 1;
+static SIM_Uart_Chunk_t *sim_uart_in;
+static const char       *sim_uart_rd;
+static SIM_Event_t      sim_uart_ev;
+static uint32_t         sim_uart_tx_cnt, sim_uart_rx_cnt;
+
+static void
+SIM_Uart_Schedule(uint64_t earliest)
+{
+    if (sim_uart_rd && *sim_uart_rd)
+        SIM_Event_Set(&sim_uart_ev, earliest);
+    else if (sim_uart_in)
+    {
+        sim_uart_rd = sim_uart_in->s;
+        SIM_Event_Set(&sim_uart_ev,
+                      sim_uart_in->time > earliest ? sim_uart_in->time : earliest);
+        sim_uart_in = sim_uart_in->next;
+    }
+}
+
+static void
+SIM_Uart_Receive(void)
+{
+    if (sim_reg[SIM_UCSRB] & (1 << 4))  // RXEN
+    {
+        sim_reg[SIM_UDR] = (uint8_t)*sim_uart_rd;
+        sim_reg[SIM_UCSRA] |= 1 << 7;   // RXC
+        sim_uart_rx_cnt++;
+    }
+    sim_uart_rd++;
+    SIM_Uart_Schedule(sim_now + SIM_UART_CHAR);
+}
+
+/*
+ * Queues a string for the receiver, sent back to back from the given time on.
+ * Chunks have to be added in chronological order.
+ */
+void
+SIM_Uart_Input(uint64_t time, const char *s)
+{
+    SIM_Uart_Chunk_t *chunk = calloc(1, sizeof(*chunk)), **pp = &sim_uart_in;
+
+    chunk->time = time;
+    chunk->s = strdup(s);
+    while (*pp)
+        pp = &(*pp)->next;
+    *pp = chunk;
+    if (!sim_uart_ev.armed && !(sim_uart_rd && *sim_uart_rd))
+        SIM_Uart_Schedule(sim_now);
+}
+
+/******** Interrupts *****************************************************/
+
+static uint8_t
+SIM_Irq_Pending(void)
+{
+    if ((sim_reg[SIM_GIFR] & (1 << 7)) && (sim_reg[SIM_GICR] & (1 << 7)))
+        return SIM_IRQ_INT1;
+    if ((sim_reg[SIM_TIFR] & (1 << 0)) && (sim_reg[SIM_TIMSK] & (1 << 0)))
+        return SIM_IRQ_TIMER0_OVF;
+    if ((sim_reg[SIM_UCSRA] & (1 << 7)) && (sim_reg[SIM_UCSRB] & (1 << 7)))
+        return SIM_IRQ_USART_RXC;
+    if ((sim_reg[SIM_UCSRB] & ((1 << 5) | (1 << 3))) == ((1 << 5) | (1 << 3)))
+        return SIM_IRQ_USART_UDRE;
+    if (SIM_TWI_Irq_Pending())
+        return SIM_IRQ_TWI;
+    return SIM_IRQ_MAX;
+}
+
+void
+SIM_Irq_Set(uint8_t irq)
+{
+    switch (irq)
+    {
+    case SIM_IRQ_INT1:
+        sim_reg[SIM_GIFR] |= 1 << 7;
+        break;
+    case SIM_IRQ_TIMER0_OVF:
+        sim_reg[SIM_TIFR] |= 1 << 0;
+        break;
+    }
+}
+
+void
+SIM_Int_TWI(uint8_t src, uint8_t active)
+{
+    static uint8_t sources;
+    uint8_t was_low = sources != 0, isc = (sim_reg[SIM_MCUCR] >> 2) & 0x03;
+
+    if (active)
+        sources |= src;
+    else
+        sources &= ~src;
+    if ((sources != 0) == was_low)
+        return;
+
+    if (sources)
+        sim_reg[SIM_PIND] &= ~(1 << 3);
+    else
+        sim_reg[SIM_PIND] |= 1 << 3;
+    // ISC1: 1 any change, 2 falling edge, 3 rising edge (0: low level, not modelled)
+    if (isc == 1 || (isc == 2 && sources) || (isc == 3 && !sources))
+        SIM_Irq_Set(SIM_IRQ_INT1);
+}
+
+static void
+SIM_Irq_Dispatch(void)
+{
+    uint8_t irq;
+    uint64_t t0_entry;
+
+    while ((sim_reg[SIM_SREG] & SREG_I) && (irq = SIM_Irq_Pending()) != SIM_IRQ_MAX)
+    {
+        sim_in_isr = 1;
+        sim_reg[SIM_SREG] &= ~SREG_I;
+        sim_now += SIM_CYCLES_ISR;
+
+        switch (irq)
+        {
+        case SIM_IRQ_INT1:
+            sim_reg[SIM_GIFR] &= ~(1 << 7);
+            if (__vector_2)
+                __vector_2();
+            break;
+        case SIM_IRQ_TIMER0_OVF:
+            sim_reg[SIM_TIFR] &= ~(1 << 0);
+            t0_entry = sim_now + SIM_CYCLES_CALL;
+            if (__vector_11)
+                __vector_11();
+            // the reload is the first thing the ISR writes, the rest of
+            // the ISR doesn't stretch the tick
+            sim_t0_base = t0_entry;
+            sim_t0_cnt = sim_reg[SIM_TCNT0];
+            SIM_Timer0_Schedule();
+            break;
+        case SIM_IRQ_USART_RXC:
+            if (__vector_13)
+                __vector_13();
+            sim_reg[SIM_UCSRA] &= ~(1 << 7);
+            break;
+        case SIM_IRQ_USART_UDRE:
+            if (__vector_14)
+                __vector_14();
+            else
+                sim_reg[SIM_UCSRB] &= ~(1 << 5);
+            if (sim_reg[SIM_UCSRB] & (1 << 5))  // UDRIE still set: UDR was written
+            {
+                sim_uart_tx_cnt++;
+                if (sim_uart_echo)
+                    putchar(sim_reg[SIM_UDR]);
+            }
+            break;
+        case SIM_IRQ_TWI:
+            if (__vector_19)
+                __vector_19();
+            break;
+        }
+
+        sim_reg[SIM_SREG] |= SREG_I;
+        sim_in_isr = 0;
+        SIM_TWI_Commit();
+        SIM_Event_Run();
+    }
+}
+
+/******** Hooks **********************************************************/
+
+static void
+SIM_Service(void)
+{
+    SIM_TWI_Commit();
+    SIM_Timer0_Commit();
+    SIM_Event_Run();
+    if (sim_now >= sim_end)
+        SIM_Exit();
+    if (!sim_in_isr)
+        SIM_Irq_Dispatch();
+}
+
+void
+SIM_Step(uint32_t cycles)
+{
+    sim_now += cycles;
+    SIM_Service();
+}
+
+void
+SIM_Pgm_Read(void)
+{
+    SIM_Step(SIM_CYCLES_PGM);
+}
+
+volatile uint8_t *
+SIM_IO(uint8_t reg)
+{
+    SIM_Step(SIM_CYCLES_IO);
+    if (reg == SIM_TCNT0)
+        sim_reg[SIM_TCNT0] = SIM_Timer0_Count();
+    return &sim_reg[reg];
+}
+
+void
+SIM_Cli(void)
+{
+    sim_reg[SIM_SREG] &= ~SREG_I;
+    SIM_Step(1);
+}
+
+void
+SIM_Sei(void)
+{
+    sim_reg[SIM_SREG] |= SREG_I;
+    SIM_Step(1);
+}
+
+void
+SIM_Delay_Us(double us)
+{
+    uint64_t end = sim_now + (uint64_t)(us * (SIM_F_CPU / 1000000.0));
+
+    while (sim_now < end)
+    {
+        uint64_t step = (sim_next < end ? sim_next : end);
+        SIM_Step(step > sim_now ? (uint32_t)(step - sim_now) : 1);
+    }
+}
+
+/*
+ * Function entry hook of -finstrument-functions: charges the call and
+ * counts the iterations of the main loop.
+ */
+void __attribute__((no_instrument_function))
+__cyg_profile_func_enter(void *this_fn, void *call_site)
+{
+    (void)call_site;
+    if (this_fn == sim_loop_fn && !sim_in_isr)
+    {
+        if (sim_loop_cnt++ == 0)
+            sim_loop_first = sim_now;
+        else if (sim_now - sim_loop_last > sim_loop_max)
+            sim_loop_max = sim_now - sim_loop_last;
+        sim_loop_last = sim_now;
+    }
+    SIM_Step(SIM_CYCLES_CALL);
+}
+
+void __attribute__((no_instrument_function))
+__cyg_profile_func_exit(void *this_fn, void *call_site)
+{
+    (void)this_fn;
+    (void)call_site;
+}
+
+/******** EEPROM *********************************************************/
+
+#define SIM_EEPROM_WRITE        8500.0  // us per byte
+
+uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+extern const char __start_sim_eeprom[] __attribute__((weak));
+
+static uint8_t *
+SIM_Eeprom_Ptr(const void *addr, size_t n)
+{
+    size_t offs = (const char *)addr - __start_sim_eeprom;
+
+    if (!__start_sim_eeprom || offs + n > SIM_EEPROM_SIZE)
+    {
+        fprintf(stderr, "sim: eeprom access out of range\n");
+        exit(2);
+    }
+    return &sim_eeprom[offs];
+}
+
+void
+eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, SIM_Eeprom_Ptr(src, n), n);
+    SIM_Step(n * 4);
+}
+
+void
+eeprom_write_block(const void *src, void *dst, size_t n)
+{
+    memcpy(SIM_Eeprom_Ptr(dst, n), src, n);
+    SIM_Delay_Us(n * SIM_EEPROM_WRITE);
+}
+
+void
+eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    uint8_t *p = SIM_Eeprom_Ptr(dst, n);
+    const uint8_t *s = src;
+    size_t i, changed = 0;
+
+    for (i=0; i<n; i++)
+        if (p[i] != s[i])
+        {
+            p[i] = s[i];
+            changed++;
+        }
+    SIM_Delay_Us(changed * SIM_EEPROM_WRITE + n * 0.5);
+}
+
+uint8_t
+eeprom_read_byte(const uint8_t *addr)
+{
+    uint8_t value;
+    eeprom_read_block(&value, addr, 1);
+    return value;
+}
+
+void
+eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    eeprom_write_block(&value, addr, 1);
+}
+
+void
+eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    eeprom_update_block(&value, addr, 1);
+}
+
+uint16_t
+eeprom_read_word(const uint16_t *addr)
+{
+    uint16_t value;
+    eeprom_read_block(&value, addr, 2);
+    return value;
+}
+
+void
+eeprom_write_word(uint16_t *addr, uint16_t value)
+{
+    eeprom_write_block(&value, addr, 2);
+}
+
+void
+eeprom_update_word(uint16_t *addr, uint16_t value)
+{
+    eeprom_update_block(&value, addr, 2);
+}
+
+/******** avr-libc conversions ******************************************/
+
+char *
+ultoa(unsigned long value, char *s, int radix)
+{
+    char tmp[8 * sizeof(value) + 1], *p = tmp, *d = s;
+
+    do
+    {
+        unsigned digit = value % radix;
+        *p++ = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= radix;
+    }
+    while (value);
+    while (p != tmp)
+        *d++ = *--p;
+    *d = 0;
+    return s;
+}
+
+char *
+ltoa(long value, char *s, int radix)
+{
+    if (value < 0 && radix == 10)
+    {
+        s[0] = '-';
+        ultoa(-(unsigned long)value, s + 1, radix);
+        return s;
+    }
+    return ultoa((unsigned long)value, s, radix);
+}
+
+char *
+utoa(unsigned int value, char *s, int radix)
+{
+    return ultoa(value, s, radix);
+}
+
+/* int is 16 bit on the target */
+char *
+itoa(int value, char *s, int radix)
+{
+    return ltoa((int16_t)value, s, radix);
+}
+
+/******** Init / report **************************************************/
+
+void
+SIM_Core_Init(void)
+{
+    memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+    sim_reg[SIM_UCSRA] = 1 << 5;            // UDRE
+    sim_reg[SIM_PINA] = sim_reg[SIM_PINB] = 0xFF;
+    sim_reg[SIM_PINC] = sim_reg[SIM_PIND] = 0xFF;
+    sim_reg[SIM_TWSR] = 0xF8;
+    sim_t0_ev.callback = SIM_Timer0_Overflow;
+    sim_uart_ev.callback = SIM_Uart_Receive;
+}
+
+void
+SIM_Report(FILE *f)
+{
+    double secs = (double)sim_now / SIM_F_CPU;
+
+    fprintf(f, "simulated time          %10.3f s\n", secs);
+    if (sim_loop_cnt > 1)
+        fprintf(f, "main loop               %10llu iterations, mean %.3f ms, max %.1f ms\n",
+                (unsigned long long)sim_loop_cnt,
+                (double)(sim_loop_last - sim_loop_first) / (sim_loop_cnt - 1) * 1000.0 / SIM_F_CPU,
+                (double)sim_loop_max * 1000.0 / SIM_F_CPU);
+    fprintf(f, "uart                    %10u bytes out, %u bytes in\n",
+            sim_uart_tx_cnt, sim_uart_rx_cnt);
+}
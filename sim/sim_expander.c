@@ -0,0 +1,84 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_expander.c
+ *    Description:  Model of the PCF8574 IO expander at 0x20 (see sim.h).
+ *                  Quasi-bidirectional port: a read returns the output latch ANDed
+ *                  with the inputs. The light barriers of catcher (bit 0) and conveyor
+ *                  (bit 1) pull their pin low at the reference mark, bit 4 drives the
+ *                  solenoid of the silo and bit 5 the vibrator (active low).
+ *                  /INT pulls INT_TWI low while the port differs from its state at
+ *                  the last read or write.
+ *
+ * =====================================================================================
+ */
+
+#include "sim.h"
+
+#define EXP_CATCHER             0
+#define EXP_CONVEYOR            1
+#define EXP_SOLENOID            4
+
+static SIM_Dev_t    sim_exp_dev;
+static uint8_t      sim_exp_latch = 0xFF;
+static uint8_t      sim_exp_port = 0xFF;    // port at the last read or write
+
+static uint8_t
+SIM_Exp_Port(void)
+{
+    uint8_t in = 0xFF;
+
+    if (SIM_Sorter_Catcher_At_Reference())
+        in &= ~(1 << EXP_CATCHER);
+    if (SIM_Sorter_Conveyor_At_Reference())
+        in &= ~(1 << EXP_CONVEYOR);
+    return sim_exp_latch & in;
+}
+
+static uint8_t
+SIM_Exp_Write(SIM_Dev_t *dev, uint8_t data)
+{
+    uint8_t changed = sim_exp_latch ^ data;
+
+    (void)dev;
+    sim_exp_latch = data;
+    if (changed & (1 << EXP_SOLENOID))
+        SIM_Sorter_Solenoid((data >> EXP_SOLENOID) & 1);
+    sim_exp_port = SIM_Exp_Port();
+    SIM_Int_TWI(SIM_INT_TWI_EXPANDER, 0);
+    return 1;
+}
+
+static uint8_t
+SIM_Exp_Read(SIM_Dev_t *dev)
+{
+    (void)dev;
+    sim_exp_port = SIM_Exp_Port();
+    SIM_Int_TWI(SIM_INT_TWI_EXPANDER, 0);
+    return sim_exp_port;
+}
+
+/*
+ * Called every ms after the mechanics have moved.
+ */
+void
+SIM_Expander_Tick(void)
+{
+    SIM_Int_TWI(SIM_INT_TWI_EXPANDER, SIM_Exp_Port() != sim_exp_port);
+}
+
+uint8_t
+SIM_Expander_Outputs(void)
+{
+    return sim_exp_latch;
+}
+
+void
+SIM_Expander_Init(void)
+{
+    sim_exp_dev.addr = 0x20;
+    sim_exp_dev.name = "PCF8574";
+    sim_exp_dev.write = SIM_Exp_Write;
+    sim_exp_dev.read = SIM_Exp_Read;
+    SIM_TWI_Attach(&sim_exp_dev);
+}
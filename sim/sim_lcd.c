@@ -0,0 +1,165 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_lcd.c
+ *    Description:  Model of the TWI LCD / MMI board at address 18 (see sim.h and
+ *                  twi_slave.h). The register file is the twi_t union of the slave;
+ *                  a command written into the first LCD block is executed at the STOP
+ *                  on a virtual 2x24 display, so both buffers always read as empty.
+ *
+ * =====================================================================================
+ */
+
+#include <string.h>
+
+#include "sim.h"
+
+#define LCD_REG_STATUS          0
+#define LCD_REG_BLOCK0          4
+#define LCD_BLOCK_SIZE          33
+#define LCD_REGS                (4 + 2 * LCD_BLOCK_SIZE)
+
+#define LCD_INIT                0x01
+#define LCD_COMMAND             0x02
+#define LCD_DATA                0x03
+#define LCD_PUTC                0x04
+#define LCD_PUTS                0x05
+
+#define LCD_LINES               2
+#define LCD_COLS                24
+
+static SIM_Dev_t    sim_lcd_dev;
+static uint8_t      sim_lcd_reg[LCD_REGS];
+static uint8_t      sim_lcd_ptr;
+static uint8_t      sim_lcd_first;
+static uint8_t      sim_lcd_written;
+static char         sim_lcd_text[LCD_LINES][LCD_COLS + 1];
+static uint8_t      sim_lcd_x, sim_lcd_y;
+
+static void
+SIM_LCD_Clear(void)
+{
+    memset(sim_lcd_text, ' ', sizeof(sim_lcd_text));
+    sim_lcd_text[0][LCD_COLS] = 0;
+    sim_lcd_text[1][LCD_COLS] = 0;
+    sim_lcd_x = sim_lcd_y = 0;
+}
+
+static void
+SIM_LCD_Putc(char c)
+{
+    if (c == '\n')
+    {
+        sim_lcd_x = 0;
+        sim_lcd_y = (sim_lcd_y + 1) % LCD_LINES;
+        return;
+    }
+    if (sim_lcd_x < LCD_COLS)
+        sim_lcd_text[sim_lcd_y][sim_lcd_x] = c;
+    sim_lcd_x++;
+}
+
+/* HD44780 instruction */
+static void
+SIM_LCD_Command(uint8_t cmd)
+{
+    if (cmd & 0x80)                     // set DDRAM address
+    {
+        sim_lcd_y = (cmd & 0x40) ? 1 : 0;
+        sim_lcd_x = cmd & 0x3F;
+    }
+    else if (cmd == 0x01)
+        SIM_LCD_Clear();
+    else if ((cmd & 0xFE) == 0x02)
+        sim_lcd_x = sim_lcd_y = 0;
+}
+
+static void
+SIM_LCD_Execute(void)
+{
+    uint8_t *blk = &sim_lcd_reg[LCD_REG_BLOCK0];
+    uint8_t i;
+
+    switch (blk[0])
+    {
+    case LCD_INIT:
+        SIM_LCD_Clear();
+        break;
+    case LCD_COMMAND:
+        SIM_LCD_Command(blk[1]);
+        break;
+    case LCD_DATA:
+    case LCD_PUTC:
+        SIM_LCD_Putc(blk[1]);
+        break;
+    case LCD_PUTS:
+        for (i=1; i<LCD_BLOCK_SIZE && blk[i]; i++)
+            SIM_LCD_Putc(blk[i]);
+        break;
+    }
+    blk[0] = 0;
+}
+
+static void
+SIM_LCD_Start(SIM_Dev_t *dev, uint8_t read)
+{
+    (void)dev;
+    sim_lcd_first = !read;
+    sim_lcd_written = 0;
+}
+
+static uint8_t
+SIM_LCD_Write(SIM_Dev_t *dev, uint8_t data)
+{
+    (void)dev;
+    if (sim_lcd_first)
+    {
+        sim_lcd_ptr = data;
+        sim_lcd_first = 0;
+        return 1;
+    }
+    if (sim_lcd_ptr >= LCD_REGS)
+        return 0;
+    sim_lcd_reg[sim_lcd_ptr++] = data;
+    sim_lcd_written = 1;
+    return 1;
+}
+
+static uint8_t
+SIM_LCD_Read(SIM_Dev_t *dev)
+{
+    (void)dev;
+    if (sim_lcd_ptr >= LCD_REGS)
+        return 0xFF;
+    return sim_lcd_reg[sim_lcd_ptr++];
+}
+
+static void
+SIM_LCD_Stop(SIM_Dev_t *dev)
+{
+    (void)dev;
+    if (sim_lcd_written)
+        SIM_LCD_Execute();
+    sim_lcd_written = 0;
+}
+
+void
+SIM_LCD_Report(FILE *f)
+{
+    fprintf(f, "lcd                     |%s|\n", sim_lcd_text[0]);
+    fprintf(f, "                        |%s|\n", sim_lcd_text[1]);
+}
+
+void
+SIM_LCD_Init(void)
+{
+    sim_lcd_dev.addr = 18;
+    sim_lcd_dev.name = "TWI LCD";
+    sim_lcd_dev.start = SIM_LCD_Start;
+    sim_lcd_dev.write = SIM_LCD_Write;
+    sim_lcd_dev.read = SIM_LCD_Read;
+    sim_lcd_dev.stop = SIM_LCD_Stop;
+    sim_lcd_reg[LCD_REG_STATUS] = (1 << 0) | (1 << 2);    // both buffers empty
+    SIM_LCD_Clear();
+    SIM_TWI_Attach(&sim_lcd_dev);
+}
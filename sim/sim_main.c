@@ -0,0 +1,158 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_main.c
+ *    Description:  Entry point of the host simulation (see sim.h).
+ *                  Sets up the peripherals and the sorter, runs the firmware's main()
+ *                  (renamed SC_Main for the host build) for the given virtual time and
+ *                  prints the report.
+ *
+ *                  smarties_controller_sim [-t s] [-i ms:chars]... [-s seed] [-c mix]
+ *                                          [-e file] [-q]
+ *                    -t  simulated time in seconds (default 120)
+ *                    -i  characters received by the UART at the given time
+ *                        (default "100:np": start sorting and leave the pause)
+ *                    -s  seed of the smarties silo
+ *                    -c  relative frequencies of red..brown in the silo, e.g.
+ *                        "4,1,1,3,1,1,1,2" (default: all the same)
+ *                    -e  EEPROM image, loaded before and saved after the run
+ *                    -q  don't echo the UART output
+ *
+ * =====================================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+extern int  SC_Main(void);
+extern void FSM_Check_State(void);
+
+static const char   *sim_eeprom_file;
+static SIM_Event_t  sim_mech_ev;
+
+/* motors and mechanics run on a 1 ms grid */
+static void
+SIM_Mechanics(void)
+{
+    SIM_TMC222_Tick(0.001);
+    SIM_Sorter_Tick();
+    SIM_Expander_Tick();
+    SIM_Event_Set(&sim_mech_ev, sim_mech_ev.time + SIM_MS(1));
+}
+
+static void
+SIM_Eeprom_Load(void)
+{
+    FILE *f = fopen(sim_eeprom_file, "rb");
+
+    if (!f)
+        return;
+    if (fread(sim_eeprom, 1, sizeof(sim_eeprom), f) != sizeof(sim_eeprom))
+        fprintf(stderr, "sim: %s: short EEPROM image\n", sim_eeprom_file);
+    fclose(f);
+}
+
+static void
+SIM_Eeprom_Save(void)
+{
+    FILE *f = fopen(sim_eeprom_file, "wb");
+
+    if (!f || fwrite(sim_eeprom, 1, sizeof(sim_eeprom), f) != sizeof(sim_eeprom))
+        fprintf(stderr, "sim: can't write %s\n", sim_eeprom_file);
+    if (f)
+        fclose(f);
+}
+
+void
+SIM_Exit(void)
+{
+    fflush(stdout);
+    fprintf(stderr, "\n");
+    SIM_Report(stderr);
+    SIM_TWI_Report(stderr);
+    SIM_TMC222_Report(stderr);
+    SIM_Sorter_Report(stderr);
+    if (SIM_Sorter_Sorted())
+        fprintf(stderr, "twi bytes / smartie     %10.0f\n",
+                (double)SIM_TWI_Bytes() / SIM_Sorter_Sorted());
+    SIM_LCD_Report(stderr);
+    if (sim_eeprom_file)
+        SIM_Eeprom_Save();
+    exit(0);
+}
+
+static void
+SIM_Usage(void)
+{
+    fprintf(stderr, "usage: smarties_controller_sim [-t s] [-i ms:chars]... "
+            "[-s seed] [-c mix] [-e file] [-q]\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    double run = 120;
+    uint32_t seed = 1;
+    uint8_t input = 0;
+    int opt;
+
+    SIM_Core_Init();
+    SIM_TWI_Init();
+    SIM_TMC222_Init();
+    SIM_ADJD_S311_Init();
+    SIM_TLC59116_Init();
+    SIM_Expander_Init();
+    SIM_LCD_Init();
+
+    while ((opt = getopt(argc, argv, "t:i:s:c:e:q")) != -1)
+    {
+        char *colon;
+
+        switch (opt)
+        {
+        case 't':
+            run = atof(optarg);
+            break;
+        case 'i':
+            colon = strchr(optarg, ':');
+            if (!colon)
+                SIM_Usage();
+            SIM_Uart_Input(SIM_US(atof(optarg) * 1000), colon + 1);
+            input = 1;
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            SIM_Sorter_Mix(optarg);
+            break;
+        case 'e':
+            sim_eeprom_file = optarg;
+            break;
+        case 'q':
+            sim_uart_echo = 0;
+            break;
+        default:
+            SIM_Usage();
+        }
+    }
+    if (!input)
+        SIM_Uart_Input(SIM_MS(100), "np");
+    if (sim_eeprom_file)
+        SIM_Eeprom_Load();
+
+    SIM_Sorter_Init(seed);
+    sim_mech_ev.callback = SIM_Mechanics;
+    SIM_Event_Set(&sim_mech_ev, SIM_MS(1));
+
+    sim_end = SIM_US(run * 1e6);
+    sim_loop_fn = (void *)FSM_Check_State;
+    SC_Main();
+    SIM_Exit();
+    return 0;
+}
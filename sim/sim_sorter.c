@@ -0,0 +1,296 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_sorter.c
+ *    Description:  Mechanics of the smarties sorter (see sim.h).
+ *                  The conveyor wheel has 10 slots (320 microsteps apart); the offset
+ *                  of a slot is its distance downstream from the colour sensor. The
+ *                  silo drops a smartie into the slot one position upstream of the
+ *                  sensor when the solenoid is pulled, a smartie falls into the catcher
+ *                  when its slot passes the drop point. The catcher has 9 bins,
+ *                  3200/9 microsteps apart. A bin is sorted correctly as long as it
+ *                  collects one colour only (the firmware may assign the colours to
+ *                  any bin).
+ *                  Both wheels have a reference mark in front of a light barrier.
+ *
+ * =====================================================================================
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define CONVEYOR_ADDR           0x60
+#define CATCHER_ADDR            0x61
+
+#define REV                     3200.0  // microsteps per revolution
+#define SLOTS                   10
+#define SLOT                    (REV / SLOTS)
+#define BIN                     (REV / SIM_COLORS)
+
+#define SILO_OFFSET             (REV - SLOT)
+#define DROP_OFFSET             (6.5 * SLOT)
+#define SILO_WINDOW             60.0    // max. misalignment of the slot at the silo
+#define BIN_WINDOW              60.0    // max. misalignment of the bin at the drop
+#define VIEW_EDGE               60.0    // sensor sees only the slot up to here ...
+#define VIEW_FADE               40.0    // ... and the white wheel beyond this
+#define CATCHER_MARK            48.0
+#define CONVEYOR_MARK           16.0
+#define SILO_EMPTY_PERCENT      8
+
+/* sensor readings of the colours in the firmware's default table, used as
+ * reflectance of the smarties (and the empty slot) */
+static const double sim_sorter_color[SIM_COLORS][3] =
+{
+    {52, 57, 46}, {351, 137, 97}, {408, 219, 137}, {421, 376, 169}, {247, 319, 164},
+    {279, 377, 374}, {211, 197, 212}, {350, 198, 204}, {212, 142, 94}
+};
+
+static const char *sim_sorter_name[SIM_COLORS] =
+{
+    "none", "red", "orange", "yellow", "green", "blue", "violet", "pink", "brown"
+};
+
+typedef struct SIM_Slot_s
+{
+    uint8_t     color;                  // 0: empty
+    double      jitter;                 // reflectance factor of this smartie
+    uint64_t    loaded;                 // time of the eject
+} SIM_Slot_t;
+
+static SIM_Slot_t   sim_slot[SLOTS];
+static int8_t       sim_bin_color[SIM_COLORS];  // colour collected in the bin (-1: none)
+static int8_t       sim_color_bin[SIM_COLORS];  // bin of the colour (-1: none)
+static unsigned     sim_mix[SIM_COLORS] = { 0, 1, 1, 1, 1, 1, 1, 1, 1 };
+static unsigned     sim_mix_sum = SIM_COLORS - 1;
+static double       sim_conveyor_last;
+static uint32_t     sim_rand;
+
+// statistics
+static uint32_t     sim_ejects, sim_silo_empty, sim_spilled;
+static uint32_t     sim_sorted, sim_correct, sim_wrong, sim_missed;
+static uint32_t     sim_color_cnt[SIM_COLORS], sim_color_wrong[SIM_COLORS];
+static uint64_t     sim_first_sorted, sim_last_sorted;
+
+static uint32_t
+SIM_Sorter_Rand(void)
+{
+    sim_rand ^= sim_rand << 13;
+    sim_rand ^= sim_rand >> 17;
+    sim_rand ^= sim_rand << 5;
+    return sim_rand;
+}
+
+static double
+SIM_Wrap(double x, double period)
+{
+    x = fmod(x, period);
+    return x < 0 ? x + period : x;
+}
+
+/* distance of the slot downstream from the sensor */
+static double
+SIM_Slot_Offset(uint8_t s, double angle)
+{
+    return SIM_Wrap(angle - SLOT * s, REV);
+}
+
+/* distance to the nearest point of a periodic grid (signed) */
+static double
+SIM_Grid_Error(double x, double pitch)
+{
+    double e = SIM_Wrap(x, pitch);
+    return e > pitch / 2 ? e - pitch : e;
+}
+
+/* colour of a new smartie, weighted by sim_mix */
+static uint8_t
+SIM_Sorter_Color(void)
+{
+    unsigned r = SIM_Sorter_Rand() % sim_mix_sum;
+    uint8_t c;
+
+    for (c=1; c<SIM_COLORS-1 && r >= sim_mix[c]; c++)
+        r -= sim_mix[c];
+    return c;
+}
+
+/* relative frequencies of the colours red..brown, comma separated */
+void
+SIM_Sorter_Mix(const char *weights)
+{
+    uint8_t c;
+
+    sim_mix_sum = 0;
+    for (c=1; c<SIM_COLORS; c++)
+    {
+        sim_mix[c] = *weights ? (unsigned)strtoul(weights, (char **)&weights, 0) : 0;
+        sim_mix_sum += sim_mix[c];
+        if (*weights == ',')
+            weights++;
+    }
+    if (!sim_mix_sum)
+    {
+        fprintf(stderr, "sim: no colours in the mix\n");
+        exit(1);
+    }
+}
+
+uint8_t
+SIM_Sorter_Catcher_At_Reference(void)
+{
+    return SIM_Wrap(SIM_TMC222_Angle(CATCHER_ADDR), REV) < CATCHER_MARK;
+}
+
+uint8_t
+SIM_Sorter_Conveyor_At_Reference(void)
+{
+    return SIM_Wrap(SIM_TMC222_Angle(CONVEYOR_ADDR), SLOT) < CONVEYOR_MARK;
+}
+
+void
+SIM_Sorter_Solenoid(uint8_t on)
+{
+    double a = SIM_TMC222_Angle(CONVEYOR_ADDR);
+    uint8_t s;
+
+    if (!on)
+        return;
+    sim_ejects++;
+    if (SIM_Sorter_Rand() % 100 < SILO_EMPTY_PERCENT)
+    {
+        sim_silo_empty++;
+        return;
+    }
+    for (s=0; s<SLOTS; s++)
+    {
+        if (fabs(SIM_Slot_Offset(s, a) - SILO_OFFSET) < SILO_WINDOW
+                && !SIM_TMC222_Moving(CONVEYOR_ADDR))
+        {
+            if (sim_slot[s].color)      // slot already full: falls beside
+                break;
+            sim_slot[s].color = SIM_Sorter_Color();
+            sim_slot[s].jitter = 0.97 + (SIM_Sorter_Rand() % 61) / 1000.0;
+            sim_slot[s].loaded = sim_now;
+            return;
+        }
+    }
+    sim_spilled++;
+}
+
+static void
+SIM_Sorter_Drop(SIM_Slot_t *slot)
+{
+    double c = SIM_TMC222_Angle(CATCHER_ADDR);
+    uint8_t bin = (uint8_t)((long)lround(SIM_Wrap(c, REV) / BIN) % SIM_COLORS);
+
+    sim_sorted++;
+    sim_color_cnt[slot->color]++;
+    if (!sim_first_sorted)
+        sim_first_sorted = sim_now;
+    sim_last_sorted = sim_now;
+
+    if (SIM_TMC222_Moving(CATCHER_ADDR) || fabs(SIM_Grid_Error(c, BIN)) > BIN_WINDOW)
+        sim_missed++;
+    else if (sim_bin_color[bin] < 0 && sim_color_bin[slot->color] < 0)
+    {
+        // first smartie of the colour in an empty bin
+        sim_bin_color[bin] = slot->color;
+        sim_color_bin[slot->color] = bin;
+        sim_correct++;
+    }
+    else if (sim_bin_color[bin] == slot->color)
+        sim_correct++;
+    else
+    {
+        sim_wrong++;
+        sim_color_wrong[slot->color]++;
+    }
+    slot->color = 0;
+}
+
+/*
+ * Called every ms after the motors have moved.
+ */
+void
+SIM_Sorter_Tick(void)
+{
+    double a = SIM_TMC222_Angle(CONVEYOR_ADDR);
+    uint8_t s;
+
+    for (s=0; s<SLOTS; s++)
+    {
+        double before = SIM_Slot_Offset(s, sim_conveyor_last);
+        double moved = a - sim_conveyor_last;
+
+        // passes the drop point going downstream (the wheel moves < 1 slot per ms)
+        if (sim_slot[s].color && moved > 0
+                && before < DROP_OFFSET && before + moved >= DROP_OFFSET)
+            SIM_Sorter_Drop(&sim_slot[s]);
+    }
+    sim_conveyor_last = a;
+}
+
+/*
+ * Reflectance of red, green and blue under the sensor: the nearest slot with its
+ * content, faded to the white wheel when the slot is off the sensor.
+ */
+void
+SIM_Sorter_View(double refl[3])
+{
+    double a = SIM_TMC222_Angle(CONVEYOR_ADDR);
+    double u = fabs(SIM_Grid_Error(a, SLOT));
+    uint8_t s = (uint8_t)((long)lround(a / SLOT) % SLOTS + SLOTS) % SLOTS;
+    SIM_Slot_t *slot = &sim_slot[s];
+    double w = (u - VIEW_EDGE) / VIEW_FADE;
+    uint8_t ch;
+
+    if (w < 0)
+        w = 0;
+    if (w > 1)
+        w = 1;
+    for (ch=0; ch<3; ch++)
+    {
+        double r = (sim_sorter_color[slot->color][ch] - 31.0) / 569.0;
+        if (slot->color)
+            r *= slot->jitter;
+        refl[ch] = (1 - w) * r + w * 1.0;
+    }
+}
+
+void
+SIM_Sorter_Init(uint32_t seed)
+{
+    sim_rand = seed ? seed : 1;
+    memset(sim_slot, 0, sizeof(sim_slot));
+    memset(sim_bin_color, -1, sizeof(sim_bin_color));
+    memset(sim_color_bin, -1, sizeof(sim_color_bin));
+    sim_conveyor_last = SIM_TMC222_Angle(CONVEYOR_ADDR);
+}
+
+void
+SIM_Sorter_Report(FILE *f)
+{
+    double minutes = (double)(sim_last_sorted - sim_first_sorted) / SIM_F_CPU / 60;
+    uint8_t c;
+
+    fprintf(f, "ejects                  %10u (silo empty %u, spilled %u)\n",
+            sim_ejects, sim_silo_empty, sim_spilled);
+    fprintf(f, "sorted                  %10u (correct %u, wrong %u, missed %u)\n",
+            sim_sorted, sim_correct, sim_wrong, sim_missed);
+    fprintf(f, "smarties / min          %10.1f\n",
+            sim_sorted > 1 && minutes > 0 ? (sim_sorted - 1) / minutes : 0.0);
+    for (c=1; c<SIM_COLORS; c++)
+        if (sim_color_cnt[c])
+            fprintf(f, "  %-21s %10u (wrong %u, bin %d)\n",
+                    sim_sorter_name[c], sim_color_cnt[c], sim_color_wrong[c],
+                    sim_color_bin[c]);
+}
+
+uint32_t
+SIM_Sorter_Sorted(void)
+{
+    return sim_sorted;
+}
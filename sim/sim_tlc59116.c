@@ -0,0 +1,146 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_tlc59116.c
+ *    Description:  Model of the TLC59116 LED driver at 0x62 (see sim.h).
+ *                  Control byte with the auto-increment options of the data sheet,
+ *                  LEDOUT modes off / on / PWM / PWM and group dimming and the sleep
+ *                  bit of MODE1. The light of a channel follows its setting with the
+ *                  time constant of the LED and the diffusor.
+ *
+ * =====================================================================================
+ */
+
+#include <math.h>
+
+#include "sim.h"
+
+#define TLC_MODE1               0x00
+#define TLC_PWM0                0x02
+#define TLC_GRPPWM              0x12
+#define TLC_LEDOUT0             0x14
+#define TLC_REGS                0x1E
+
+#define TLC_SLEEP               0x10
+#define TLC_TAU                 0.0005  // s
+
+static SIM_Dev_t    sim_tlc_dev;
+static uint8_t      sim_tlc_reg[TLC_REGS];
+static uint8_t      sim_tlc_ptr;
+static uint8_t      sim_tlc_ai;         // auto-increment option (control byte bits 7..5)
+static uint8_t      sim_tlc_first;
+static double       sim_tlc_light[16];
+static uint64_t     sim_tlc_time;
+
+/* setting of a channel as fraction of the full current */
+static double
+SIM_TLC_Target(uint8_t ch)
+{
+    uint8_t mode = (sim_tlc_reg[TLC_LEDOUT0 + ch / 4] >> (2 * (ch % 4))) & 0x03;
+
+    if (sim_tlc_reg[TLC_MODE1] & TLC_SLEEP)
+        return 0;
+    switch (mode)
+    {
+    case 1:
+        return 1;
+    case 2:
+        return sim_tlc_reg[TLC_PWM0 + ch] / 255.0;
+    case 3:
+        return sim_tlc_reg[TLC_PWM0 + ch] / 255.0 * sim_tlc_reg[TLC_GRPPWM] / 255.0;
+    }
+    return 0;
+}
+
+/* lets the light of all channels settle up to now */
+static void
+SIM_TLC_Update(void)
+{
+    double a = 1 - exp(-(double)(sim_now - sim_tlc_time) / SIM_F_CPU / TLC_TAU);
+    uint8_t ch;
+
+    for (ch=0; ch<16; ch++)
+        sim_tlc_light[ch] += (SIM_TLC_Target(ch) - sim_tlc_light[ch]) * a;
+    sim_tlc_time = sim_now;
+}
+
+double
+SIM_TLC59116_Light(uint8_t ch)
+{
+    SIM_TLC_Update();
+    return sim_tlc_light[ch];
+}
+
+static void
+SIM_TLC_Increment(void)
+{
+    switch (sim_tlc_ai)
+    {
+    case 4:                             // all registers
+        sim_tlc_ptr = sim_tlc_ptr + 1 >= TLC_REGS ? 0 : sim_tlc_ptr + 1;
+        break;
+    case 5:                             // brightness registers
+        sim_tlc_ptr = sim_tlc_ptr + 1 > 0x11 ? 0x02 : sim_tlc_ptr + 1;
+        break;
+    case 6:                             // global control registers
+        sim_tlc_ptr = sim_tlc_ptr + 1 > 0x13 ? 0x12 : sim_tlc_ptr + 1;
+        break;
+    case 7:                             // brightness and global control registers
+        sim_tlc_ptr = sim_tlc_ptr + 1 > 0x13 ? 0x02 : sim_tlc_ptr + 1;
+        break;
+    }
+}
+
+static void
+SIM_TLC_Start(SIM_Dev_t *dev, uint8_t read)
+{
+    (void)dev;
+    sim_tlc_first = !read;
+}
+
+static uint8_t
+SIM_TLC_Write(SIM_Dev_t *dev, uint8_t data)
+{
+    (void)dev;
+    if (sim_tlc_first)
+    {
+        sim_tlc_ptr = data & 0x1F;
+        sim_tlc_ai = data >> 5;
+        sim_tlc_first = 0;
+        return 1;
+    }
+    if (sim_tlc_ptr < TLC_REGS)
+    {
+        SIM_TLC_Update();
+        if (sim_tlc_ptr == TLC_MODE1)   // AI bits are read only
+            data = (data & 0x1F) | 0x80;
+        sim_tlc_reg[sim_tlc_ptr] = data;
+    }
+    SIM_TLC_Increment();
+    return 1;
+}
+
+static uint8_t
+SIM_TLC_Read(SIM_Dev_t *dev)
+{
+    uint8_t data;
+
+    (void)dev;
+    data = sim_tlc_ptr < TLC_REGS ? sim_tlc_reg[sim_tlc_ptr] : 0xFF;
+    SIM_TLC_Increment();
+    return data;
+}
+
+void
+SIM_TLC59116_Init(void)
+{
+    sim_tlc_dev.addr = 0x62;
+    sim_tlc_dev.name = "TLC59116";
+    sim_tlc_dev.start = SIM_TLC_Start;
+    sim_tlc_dev.write = SIM_TLC_Write;
+    sim_tlc_dev.read = SIM_TLC_Read;
+    // power-on defaults: oscillator off, group dimming at full scale, LEDs off
+    sim_tlc_reg[TLC_MODE1] = 0x91;
+    sim_tlc_reg[TLC_GRPPWM] = 0xFF;
+    SIM_TWI_Attach(&sim_tlc_dev);
+}
@@ -0,0 +1,374 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_tmc222.c
+ *    Description:  Behavioural model of the TMC222 stepper controllers of the conveyor
+ *                  (0x60) and the catcher (0x61) (see sim.h).
+ *                  Implements the commands used by TMC222.c with the velocity and
+ *                  acceleration tables of the data sheet (trapezoidal ramps, constant
+ *                  VMin run with AccShape = 1). Besides the position counter every
+ *                  motor has a mechanical angle that is never reset; the sorter model
+ *                  uses it for the light barriers, slots and bins.
+ *
+ * =====================================================================================
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define SIM_TMC222_MOTORS       2
+
+/* full steps / s for VMax 0..15 */
+static const double sim_tmc222_vmax[16] =
+{
+    99, 136, 167, 197, 213, 228, 243, 273, 303, 334, 364, 395, 456, 546, 729, 973
+};
+
+/* full steps / s^2 for Acc 0..15 */
+static const double sim_tmc222_acc[16] =
+{
+    49, 218, 1004, 3609, 6228, 8848, 11409, 13970,
+    16531, 19092, 21886, 24447, 27008, 29570, 34925, 40047
+};
+
+typedef struct SIM_TMC222_s
+{
+    SIM_Dev_t   dev;
+    double      angle;                  // mechanical position in microsteps
+    double      pos;                    // position counter
+    double      v;                      // microsteps / s
+    int16_t     target;
+    int16_t     secpos;
+    uint8_t     irun, ihold, vmax, vmin, acc, shaft, stepmode, accshape;
+    uint8_t     motion;
+    uint8_t     vddreset;
+    uint8_t     cmd[12];                // command received in the write phase
+    uint8_t     cmd_cnt;
+    uint8_t     resp[9];                // answer of the last GetFullStatus command
+    uint8_t     resp_cnt;
+    uint8_t     resp_idx;
+    // statistics
+    uint32_t    moves;
+    double      distance;
+    uint64_t    moving;
+} SIM_TMC222_t;
+
+static SIM_TMC222_t sim_tmc222[SIM_TMC222_MOTORS];
+
+static SIM_TMC222_t *
+SIM_TMC222_Get(uint8_t addr)
+{
+    uint8_t i;
+
+    for (i=0; i<SIM_TMC222_MOTORS; i++)
+        if (sim_tmc222[i].dev.addr == addr)
+            return &sim_tmc222[i];
+    return NULL;
+}
+
+static double
+SIM_TMC222_Microsteps(SIM_TMC222_t *m)
+{
+    return 2 << m->stepmode;
+}
+
+static double
+SIM_TMC222_VMax(SIM_TMC222_t *m)
+{
+    return sim_tmc222_vmax[m->vmax] * SIM_TMC222_Microsteps(m);
+}
+
+static double
+SIM_TMC222_VMin(SIM_TMC222_t *m)
+{
+    return m->vmin ? SIM_TMC222_VMax(m) * m->vmin / 32.0 : SIM_TMC222_VMax(m);
+}
+
+static double
+SIM_TMC222_Acc(SIM_TMC222_t *m)
+{
+    return sim_tmc222_acc[m->acc] * SIM_TMC222_Microsteps(m);
+}
+
+static void
+SIM_TMC222_Status1(SIM_TMC222_t *m)
+{
+    m->resp[0] = m->dev.addr;
+    m->resp[1] = (m->irun << 4) | m->ihold;
+    m->resp[2] = (m->vmax << 4) | m->vmin;
+    m->resp[3] = (m->accshape << 7) | (m->stepmode << 5) | (m->shaft << 4) | m->acc;
+    m->resp[4] = m->vddreset << 7;
+    m->resp[5] = (m->motion << 5) | 0x02;
+    m->resp[6] = 0xFF;
+    m->resp[7] = 0xFF;
+    m->resp_cnt = 8;
+    m->vddreset = 0;                    // flags are cleared by reading them
+}
+
+static void
+SIM_TMC222_Status2(SIM_TMC222_t *m)
+{
+    int16_t actual = (int16_t)lround(m->pos);
+
+    m->resp[0] = m->dev.addr;
+    m->resp[1] = (uint8_t)(actual >> 8);
+    m->resp[2] = (uint8_t)actual;
+    m->resp[3] = (uint8_t)(m->target >> 8);
+    m->resp[4] = (uint8_t)m->target;
+    m->resp[5] = (uint8_t)m->secpos;
+    m->resp[6] = (uint8_t)(m->secpos >> 8) & 0x07;
+    m->resp[7] = 0xFF;
+    m->resp[8] = 0xFF;
+    m->resp_cnt = 9;
+}
+
+static void
+SIM_TMC222_Stop(SIM_TMC222_t *m, uint8_t soft)
+{
+    double d = 0;
+
+    if (soft && !m->accshape && m->v != 0)
+        d = m->v * m->v / (2 * SIM_TMC222_Acc(m)) * (m->v > 0 ? 1 : -1);
+    else
+        m->v = 0;
+    m->target = (int16_t)lround(m->pos + d);
+}
+
+/* executes the command of the last write phase */
+static void
+SIM_TMC222_Execute(SIM_TMC222_t *m)
+{
+    uint8_t *c = m->cmd;
+
+    if (!m->cmd_cnt)
+        return;
+
+    switch (c[0])
+    {
+    case 0x81:                          // GetFullStatus1
+        SIM_TMC222_Status1(m);
+        break;
+    case 0xfc:                          // GetFullStatus2
+        SIM_TMC222_Status2(m);
+        break;
+    case 0x89:                          // SetMotorParameters
+        if (m->cmd_cnt < 8)
+            break;
+        m->ihold = c[3] & 0x0F;
+        m->irun = c[3] >> 4;
+        m->vmin = c[4] & 0x0F;
+        m->vmax = c[4] >> 4;
+        m->acc = c[5] & 0x0F;
+        m->shaft = (c[5] >> 4) & 1;
+        m->secpos = ((c[5] >> 5) << 8) | c[6];
+        m->stepmode = (c[7] >> 2) & 0x03;
+        m->accshape = (c[7] >> 4) & 1;
+        break;
+    case 0x8b:                          // SetPosition
+        if (m->cmd_cnt < 5)
+            break;
+        m->target = (int16_t)((c[3] << 8) | c[4]);
+        m->moves++;
+        break;
+    case 0x88:                          // RunInit: simplified to a move to position 2
+        if (m->cmd_cnt < 8)
+            break;
+        m->target = (int16_t)((c[6] << 8) | c[7]);
+        m->moves++;
+        break;
+    case 0x86:                          // ResetPosition
+        m->pos = 0;
+        m->target = 0;
+        break;
+    case 0x84:                          // GotoSecurePosition
+        m->target = m->secpos;
+        m->moves++;
+        break;
+    case 0x85:                          // HardStop
+        SIM_TMC222_Stop(m, 0);
+        break;
+    case 0x8f:                          // SoftStop
+        SIM_TMC222_Stop(m, 1);
+        break;
+    case 0x87:                          // ResetToDefault
+        break;
+    }
+    m->cmd_cnt = 0;
+    // a new target is reported as motion at once, not only from the next tick on
+    if (!m->motion && m->target != m->pos)
+        m->motion = 1 | (m->target < m->pos ? 4 : 0);
+}
+
+static void
+SIM_TMC222_Start(SIM_Dev_t *dev, uint8_t read)
+{
+    SIM_TMC222_t *m = dev->priv;
+
+    SIM_TMC222_Execute(m);              // repeated start after the command byte
+    m->resp_idx = 0;
+    (void)read;
+}
+
+static uint8_t
+SIM_TMC222_Write(SIM_Dev_t *dev, uint8_t data)
+{
+    SIM_TMC222_t *m = dev->priv;
+
+    if (m->cmd_cnt < sizeof(m->cmd))
+        m->cmd[m->cmd_cnt++] = data;
+    return 1;
+}
+
+static uint8_t
+SIM_TMC222_Read(SIM_Dev_t *dev)
+{
+    SIM_TMC222_t *m = dev->priv;
+
+    if (m->resp_idx < m->resp_cnt)
+        return m->resp[m->resp_idx++];
+    return 0xFF;
+}
+
+static void
+SIM_TMC222_Stop_Cond(SIM_Dev_t *dev)
+{
+    SIM_TMC222_Execute(dev->priv);
+}
+
+/*
+ * Advances all motors by dt seconds.
+ */
+void
+SIM_TMC222_Tick(double dt)
+{
+    uint8_t i;
+
+    for (i=0; i<SIM_TMC222_MOTORS; i++)
+    {
+        SIM_TMC222_t *m = &sim_tmc222[i];
+        double d = m->target - m->pos;
+        double vmax = SIM_TMC222_VMax(m), vmin = SIM_TMC222_VMin(m);
+        double acc = SIM_TMC222_Acc(m);
+        double old = m->pos, speed = fabs(m->v);
+        int dir = d > 0 ? 1 : -1;
+        uint8_t phase;                  // 1 acc, 2 dec, 3 max speed
+
+        if (d == 0 && m->v == 0)
+        {
+            m->motion = 0;
+            continue;
+        }
+
+        if (m->accshape)
+        {
+            speed = vmin;
+            phase = 3;
+        }
+        else if (m->v != 0 && (m->v > 0 ? 1 : -1) != dir)
+        {
+            // wrong direction: brake first
+            speed -= acc * dt;
+            if (speed < vmin)
+                speed = 0;
+            m->v = speed * (m->v > 0 ? 1 : -1);
+            m->pos += m->v * dt;
+            m->motion = 2 | (m->v < 0 ? 4 : 0);
+            goto moved;
+        }
+        else if (speed * speed / (2 * acc) >= fabs(d))
+        {
+            speed -= acc * dt;
+            if (speed < vmin)
+                speed = vmin;
+            phase = 2;
+        }
+        else if (speed < vmax)
+        {
+            speed += acc * dt;
+            if (speed < vmin)
+                speed = vmin;
+            if (speed > vmax)
+                speed = vmax;
+            phase = 1;
+        }
+        else
+            phase = 3;
+
+        if (fabs(d) <= speed * dt)
+        {
+            m->pos = m->target;
+            m->v = 0;
+            m->motion = 0;
+        }
+        else
+        {
+            m->v = speed * dir;
+            m->pos += m->v * dt;
+            m->motion = phase | (dir < 0 ? 4 : 0);
+        }
+moved:
+        m->angle += (m->pos - old) * (m->shaft ? -1 : 1);
+        m->distance += fabs(m->pos - old);
+        if (m->motion)
+            m->moving += SIM_MS(1) * dt * 1000;
+    }
+}
+
+double
+SIM_TMC222_Angle(uint8_t addr)
+{
+    return SIM_TMC222_Get(addr)->angle;
+}
+
+uint8_t
+SIM_TMC222_Moving(uint8_t addr)
+{
+    return SIM_TMC222_Get(addr)->motion != 0;
+}
+
+static void
+SIM_TMC222_Setup(SIM_TMC222_t *m, uint8_t addr, const char *name, double angle)
+{
+    m->dev.addr = addr;
+    m->dev.name = name;
+    m->dev.start = SIM_TMC222_Start;
+    m->dev.write = SIM_TMC222_Write;
+    m->dev.read = SIM_TMC222_Read;
+    m->dev.stop = SIM_TMC222_Stop_Cond;
+    m->dev.priv = m;
+    m->angle = angle;
+    // OTP defaults
+    m->irun = 15;
+    m->ihold = 8;
+    m->vmax = 2;
+    m->vmin = 1;
+    m->acc = 2;
+    m->stepmode = 3;
+    m->vddreset = 1;
+    SIM_TWI_Attach(&m->dev);
+}
+
+void
+SIM_TMC222_Init(void)
+{
+    // arbitrary power-up positions, so that the reference search has to work
+    SIM_TMC222_Setup(&sim_tmc222[0], 0x60, "conveyor TMC222", 100.0);
+    SIM_TMC222_Setup(&sim_tmc222[1], 0x61, "catcher TMC222", 1000.0);
+}
+
+void
+SIM_TMC222_Report(FILE *f)
+{
+    uint8_t i;
+
+    for (i=0; i<SIM_TMC222_MOTORS; i++)
+    {
+        SIM_TMC222_t *m = &sim_tmc222[i];
+        fprintf(f, "%-23s %10u moves, %.0f microsteps, moving %.1f %% of the time\n",
+                m->dev.name, m->moves, m->distance,
+                sim_now ? 100.0 * m->moving / sim_now : 0.0);
+    }
+}
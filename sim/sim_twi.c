@@ -0,0 +1,270 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sim_twi.c
+ *    Description:  TWI unit of the simulated ATmega32 and the bus with its slaves
+ *                  (see sim.h).
+ *                  A command written to TWCR (TWINT set) is executed with the bus
+ *                  timing given by TWBR/TWSR; when it is done TWSR and TWDR are
+ *                  updated and TWINT is set again, which raises the TWI interrupt.
+ *                  TWINT as set by the hardware is kept out of the register file, so
+ *                  a TWINT bit there always is a write of the firmware.
+ *
+ * =====================================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWEN    2
+#define TWIE    0
+
+#define SIM_TWI_DEVS            8
+
+enum SIM_TWI_State { TWI_IDLE = 0,      // bus free
+                     TWI_ADDR,          // START sent, waiting for SLA+R/W
+                     TWI_MT,            // master transmitter
+                     TWI_MR,            // master receiver
+                     TWI_HOLD           // address not acknowledged, waiting for STOP
+                   };
+
+enum SIM_TWI_Op { OP_START = 0, OP_STOP, OP_STOP_START, OP_ADDR, OP_WRITE, OP_READ };
+
+static SIM_Dev_t    *sim_twi_dev[SIM_TWI_DEVS];
+static uint8_t      sim_twi_dev_cnt;
+
+static uint8_t      sim_twi_state;
+static SIM_Dev_t    *sim_twi_cur;       // addressed slave
+static uint8_t      sim_twi_int;        // TWINT as set by the hardware
+static uint8_t      sim_twi_op;         // operation in progress
+static uint8_t      sim_twi_data;       // TWDR / TWEA latched with the command
+static uint8_t      sim_twi_ack;
+static uint64_t     sim_twi_op_start;
+static SIM_Event_t  sim_twi_ev;
+
+// statistics
+static uint32_t     sim_twi_starts, sim_twi_rep_starts, sim_twi_nacks;
+static uint64_t     sim_twi_bytes, sim_twi_busy;
+
+void
+SIM_TWI_Attach(SIM_Dev_t *dev)
+{
+    sim_twi_dev[sim_twi_dev_cnt++] = dev;
+}
+
+static SIM_Dev_t *
+SIM_TWI_Find(uint8_t addr)
+{
+    uint8_t i;
+
+    for (i=0; i<sim_twi_dev_cnt; i++)
+        if (sim_twi_dev[i]->addr == addr)
+            return sim_twi_dev[i];
+    return NULL;
+}
+
+/* duration of one SCL period in cpu cycles */
+static uint64_t
+SIM_TWI_Bit(void)
+{
+    return 16 + 2 * (uint64_t)sim_reg[SIM_TWBR] * (1 << (2 * (sim_reg[SIM_TWSR] & 0x03)));
+}
+
+static void
+SIM_TWI_Status(uint8_t status)
+{
+    sim_reg[SIM_TWSR] = status | (sim_reg[SIM_TWSR] & 0x03);
+}
+
+static void
+SIM_TWI_Stop(void)
+{
+    if (sim_twi_cur && sim_twi_cur->stop)
+        sim_twi_cur->stop(sim_twi_cur);
+    sim_twi_cur = NULL;
+    sim_twi_state = TWI_IDLE;
+}
+
+/* end of the operation in progress */
+static void
+SIM_TWI_Done(void)
+{
+    uint64_t busy = sim_now - sim_twi_op_start;
+
+    sim_twi_busy += busy;
+    if (sim_twi_cur)
+        sim_twi_cur->busy += busy;
+
+    switch (sim_twi_op)
+    {
+    case OP_STOP:
+        sim_reg[SIM_TWCR] &= ~(1 << TWSTO);
+        SIM_TWI_Status(0xF8);
+        return;                             // no TWINT after a STOP
+
+    case OP_STOP_START:
+        sim_reg[SIM_TWCR] &= ~(1 << TWSTO);
+        // fall through
+    case OP_START:
+        sim_reg[SIM_TWCR] &= ~(1 << TWSTA);
+        if (sim_twi_state == TWI_IDLE)
+        {
+            sim_twi_starts++;
+            SIM_TWI_Status(0x08);           // TW_START
+        }
+        else
+        {
+            sim_twi_rep_starts++;
+            SIM_TWI_Status(0x10);           // TW_REP_START
+        }
+        sim_twi_state = TWI_ADDR;
+        break;
+
+    case OP_ADDR:
+        sim_twi_bytes++;
+        sim_twi_cur = SIM_TWI_Find(sim_twi_data >> 1);
+        if (sim_twi_cur)
+        {
+            sim_twi_cur->transactions++;
+            sim_twi_cur->bytes++;
+            if (sim_twi_cur->start)
+                sim_twi_cur->start(sim_twi_cur, sim_twi_data & 1);
+            sim_twi_state = (sim_twi_data & 1) ? TWI_MR : TWI_MT;
+            SIM_TWI_Status((sim_twi_data & 1) ? 0x40 : 0x18);
+        }
+        else
+        {
+            sim_twi_nacks++;
+            sim_twi_state = TWI_HOLD;
+            SIM_TWI_Status((sim_twi_data & 1) ? 0x48 : 0x20);
+        }
+        break;
+
+    case OP_WRITE:
+        sim_twi_bytes++;
+        sim_twi_cur->bytes++;
+        if (sim_twi_cur->write(sim_twi_cur, sim_twi_data))
+            SIM_TWI_Status(0x28);           // TW_MT_DATA_ACK
+        else
+        {
+            sim_twi_nacks++;
+            SIM_TWI_Status(0x30);           // TW_MT_DATA_NACK
+        }
+        break;
+
+    case OP_READ:
+        sim_twi_bytes++;
+        sim_twi_cur->bytes++;
+        sim_reg[SIM_TWDR] = sim_twi_cur->read(sim_twi_cur);
+        SIM_TWI_Status(sim_twi_ack ? 0x50 : 0x58);
+        break;
+    }
+    sim_twi_int = 1;
+}
+
+static void
+SIM_TWI_Begin(uint8_t op, uint64_t bits)
+{
+    sim_twi_op = op;
+    sim_twi_op_start = sim_now;
+    SIM_Event_Set(&sim_twi_ev, sim_now + bits * SIM_TWI_Bit());
+}
+
+/*
+ * Takes over a command written to TWCR since the last hook.
+ */
+void
+SIM_TWI_Commit(void)
+{
+    uint8_t cr = sim_reg[SIM_TWCR];
+
+    if (!(cr & (1 << TWEN)))                // unit disabled: release the bus
+    {
+        if (sim_twi_state != TWI_IDLE || sim_twi_ev.armed)
+        {
+            SIM_Event_Clear(&sim_twi_ev);
+            SIM_TWI_Stop();
+            sim_reg[SIM_TWCR] &= ~((1 << TWSTA) | (1 << TWSTO));
+        }
+        sim_twi_int = 0;
+    }
+    if (!(cr & (1 << TWINT)))
+        return;
+
+    sim_reg[SIM_TWCR] = cr & ~(1 << TWINT);
+    sim_twi_int = 0;
+    if (!(cr & (1 << TWEN)))
+        return;
+
+    if (cr & (1 << TWSTO))
+    {
+        SIM_TWI_Stop();
+        SIM_TWI_Begin((cr & (1 << TWSTA)) ? OP_STOP_START : OP_STOP,
+                      (cr & (1 << TWSTA)) ? 2 : 1);
+    }
+    else if (cr & (1 << TWSTA))
+        SIM_TWI_Begin(OP_START, 1);
+    else
+    {
+        sim_twi_data = sim_reg[SIM_TWDR];
+        sim_twi_ack = (cr >> TWEA) & 1;
+        switch (sim_twi_state)
+        {
+        case TWI_ADDR:
+            SIM_TWI_Begin(OP_ADDR, 9);
+            break;
+        case TWI_MT:
+            SIM_TWI_Begin(OP_WRITE, 9);
+            break;
+        case TWI_MR:
+            SIM_TWI_Begin(OP_READ, 9);
+            break;
+        default:                            // nothing to do for the unit
+            break;
+        }
+    }
+}
+
+uint8_t
+SIM_TWI_Irq_Pending(void)
+{
+    return sim_twi_int
+           && (sim_reg[SIM_TWCR] & ((1 << TWIE) | (1 << TWEN))) == ((1 << TWIE) | (1 << TWEN));
+}
+
+void
+SIM_TWI_Report(FILE *f)
+{
+    double secs = (double)sim_now / SIM_F_CPU;
+    uint8_t i;
+
+    fprintf(f, "twi                     %10llu bytes, %u starts, %u repeated starts, %u nacks\n",
+            (unsigned long long)sim_twi_bytes, sim_twi_starts, sim_twi_rep_starts, sim_twi_nacks);
+    fprintf(f, "twi bus load            %10.1f %%\n",
+            secs > 0 ? 100.0 * sim_twi_busy / sim_now : 0.0);
+    for (i=0; i<sim_twi_dev_cnt; i++)
+    {
+        SIM_Dev_t *dev = sim_twi_dev[i];
+        fprintf(f, "  0x%02x %-16s %10llu bytes, %8u transactions, %6.1f %% bus\n",
+                dev->addr, dev->name, (unsigned long long)dev->bytes, dev->transactions,
+                secs > 0 ? 100.0 * dev->busy / sim_now : 0.0);
+    }
+}
+
+uint64_t
+SIM_TWI_Bytes(void)
+{
+    return sim_twi_bytes;
+}
+
+void
+SIM_TWI_Init(void)
+{
+    sim_twi_ev.callback = SIM_TWI_Done;
+}
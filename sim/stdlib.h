@@ -0,0 +1,20 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  stdlib.h
+ *    Description:  Adds the avr-libc conversion functions to the host <stdlib.h>
+ *                  (see sim.h).
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_STDLIB_H
+#define _SIM_STDLIB_H
+
+#include_next <stdlib.h>
+
+extern char *itoa(int value, char *s, int radix);
+extern char *utoa(unsigned int value, char *s, int radix);
+extern char *ltoa(long value, char *s, int radix);
+extern char *ultoa(unsigned long value, char *s, int radix);
+
+#endif // _SIM_STDLIB_H
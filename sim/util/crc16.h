@@ -0,0 +1,25 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  util/crc16.h
+ *    Description:  Host replacement of <util/crc16.h> (see sim.h).
+ *                  C versions of the avr-libc CRC routines used by the firmware.
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_UTIL_CRC16_H
+#define _SIM_UTIL_CRC16_H
+
+#include <stdint.h>
+
+/* CRC-CCITT, polynomial 0x1021, as documented in avr-libc */
+static inline uint16_t
+_crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= crc & 0xFF;
+    data ^= data << 4;
+    return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+            ^ ((uint16_t)data << 3));
+}
+
+#endif // _SIM_UTIL_CRC16_H
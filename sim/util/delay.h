@@ -0,0 +1,19 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  util/delay.h
+ *    Description:  Host replacement of <util/delay.h> (see sim.h).
+ *                  The busy wait advances the virtual clock; interrupts are served
+ *                  meanwhile as on the target.
+ *
+ * =====================================================================================
+ */
+#ifndef _SIM_UTIL_DELAY_H
+#define _SIM_UTIL_DELAY_H
+
+#include "../sim.h"
+
+#define _delay_us(us)           SIM_Delay_Us(us)
+#define _delay_ms(ms)           SIM_Delay_Us((ms) * 1000.0)
+
+#endif // _SIM_UTIL_DELAY_H
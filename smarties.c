@@ -158,6 +158,30 @@ SM_Color_Correct(ADJD_S311_Data_t* p_smartie_color,enum COLOR color)
 }
 
 
+/********** SM_Empty_Clear ***********************************************
+Function:   SM_Empty_Clear()
+Purpose:    clear channel that separates an empty slot from a smartie:
+            half way between the empty slot (sm_color_table[Unknown])
+            and the darkest smartie of the color_table
+Input:      none
+Returns:    clear value, use as cs_empty_clear
+**************************************************************************/
+uint16_t
+SM_Empty_Clear(void)
+{
+    uint16_t darkest = UINT16_MAX;
+
+    for(uint8_t col=Unknown+1; col < COLOR_MAX; col++)
+    {
+        if(sm_color_table[col].clear < darkest)
+            darkest = sm_color_table[col].clear;
+    }
+    // no margin to an empty slot left: don't check
+    if(darkest <= sm_color_table[Unknown].clear)
+        return 0;
+    return (sm_color_table[Unknown].clear + darkest) >> 1;
+}
+
 /********** SM_Colors_Store *********************************************
 Function:   SM_Colors_Store()
 Purpose:    Call this function to store the actual color table to the EEPROM
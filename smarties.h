@@ -57,6 +57,18 @@ Returns:    COLOR
 **************************************************************************/
 extern void //enum COLOR
 SM_Color_Correct(ADJD_S311_Data_t* p_smartie_color,enum COLOR color);
+
+/********** SM_Empty_Clear ***********************************************
+Function:   SM_Empty_Clear()
+Purpose:    clear channel that separates an empty slot from a smartie:
+            half way between the empty slot (sm_color_table[Unknown])
+            and the darkest smartie of the color_table
+Input:      none
+Returns:    clear value, use as cs_empty_clear
+**************************************************************************/
+extern uint16_t
+SM_Empty_Clear(void);
+
 /********** SM_Colors_Store *********************************************
 Function:   SM_Colors_Store()
 Purpose:    Call this function to store the actual color table to the EEPROM
@@ -24,7 +24,7 @@
 @brief Main file of the Smarties-Controller
 
 This file is the main file of the Smarties-Controller.
-After inintialising the Smarties-Sorter, the main function just calls the execution functions of the three statmachines.
+After inintialising the Smarties-Sorter, the main function runs the statemachines, the console and the displays as tasks of the scheduler (scheduler.h).
 Statemachine one controlls the whole sorting process including initialising and error handling.
 Statemachine two handles the menue for the communcation with the user
 Statemachine three is just a small statemachine to controll the timing of the smartiessilo
@@ -38,6 +38,7 @@ Statemachine three is just a small statemachine to controll the timing of the sm
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/signal.h>
@@ -57,6 +58,7 @@ Statemachine three is just a small statemachine to controll the timing of the sm
 #include "color_sensor.h"
 #include "motion_controll.h"
 #include "fsm.h"
+#include "scheduler.h"
 
 /**
 /* define CPU frequency in Mhz here if not defined in Makefile */
@@ -71,11 +73,32 @@ Statemachine three is just a small statemachine to controll the timing of the sm
 #define TWI_BAUDRATE 	    100UL
 
 
+#if FSM_LATENCY
+/* names of enum fsm_stage for the latency report ('t') */
+static const char sc_stage_name[sg_max][10] PROGMEM =
+{
+    "eject", "transport", "settle", "integrate", "classify", "catcher", "drop", "total"
+};
+#endif
+
+
 /*
  * === Prototypes  =====================================================================
  */
 
 void SC_Init(void);
+void SC_Console(void);
+void SC_Lcd_Latency(void);
+void SC_Telemetry(void);
+
+/*
+ * === Tasks  ==========================================================================
+ */
+
+#define SC_DEADLINE_FSM     2       // [ms] between two runs of the state machines
+#define SC_LCD_COLS         24
+
+static SCH_Task_t sc_task_motion, sc_task_sort, sc_task_console, sc_task_lcd, sc_task_telemetry;
 
 /*
  * === MAIN ============================================================================
@@ -84,18 +107,6 @@ void SC_Init(void);
 int
 main ( void )
 {
-    static uint16_t c16,cs_cnt=0;
-    uint8_t buffer[16];
-
-    static TMC222_Status_t Sorter_Status,Revolver_Status;
-    static TMC222_Parameters_t Sorter_Parameter, Revolver_Parameter;
-
-    static ADJD_S311_Data_t cs_data;
-    static ADJD_S311_Offset_t cs_offset;
-    static ADJD_S311_Param_t cs_parameter;
-
-    static CS_Sensor_LED_t pwm_values;
-
     sei();
     SC_Init();
 
@@ -107,19 +118,53 @@ main ( void )
 
     MC_Timer0_Init();
 
+    MC_Outputs_Init();
+
+    MC_Catcher_Bins_Restore();
+
     TLC59116_Init();
 
+    // the state machines on every pass, the rest at their rate
+    SCH_Task_Add(&sc_task_motion,PSTR("motion"),MC_FSM_Execute,SCH_POLL,SC_DEADLINE_FSM);
+    SCH_Task_Add(&sc_task_sort,PSTR("sort fsm"),FSM_Check_State,SCH_POLL,SC_DEADLINE_FSM);
+    SCH_Task_Add(&sc_task_console,PSTR("console"),SC_Console,10,20);
+    SCH_Task_Add(&sc_task_lcd,PSTR("lcd"),SC_Lcd_Latency,500,50);
+    SCH_Task_Add(&sc_task_telemetry,PSTR("telemetry"),SC_Telemetry,1000,100);
+    SCH_Task_Stop(&sc_task_telemetry);     // 'j'
 
     while(1)
     {
+        SCH_Run();
+    }
+    return 0;
+}		/* -----  end of function main  ----- */
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  SC_Console
+ *         Description:  executes the commands received on the UART
+ * =====================================================================================
+ */
+void
+SC_Console ( void )
+{
+    static uint16_t c16,cs_cnt=0;
+    uint8_t buffer[16];
 
-        //TODO: the following lines of code should be sepperated in an extra modul
+    static TMC222_Status_t Sorter_Status,Revolver_Status;
+    static TMC222_Parameters_t Sorter_Parameter, Revolver_Parameter;
 
-        MC_FSM_Execute();
+    static ADJD_S311_Data_t cs_data;
+    static ADJD_S311_Offset_t cs_offset;
+    static ADJD_S311_Param_t cs_parameter;
 
-        FSM_Check_State();
+    static CS_Sensor_LED_t pwm_values;
 
-        uint8_t command = ((uint8_t)uart_getc());
+    uint16_t c;
+
+    while(!((c = uart_getc()) & UART_NO_DATA))
+    {
+        uint8_t command = (uint8_t)c;
 
         switch(command)
         {
@@ -131,6 +176,10 @@ main ( void )
             break;
         case 'W':
             CS_LED_Addapt(&pwm_values,600);
+            uart_puts_P("\n\rLED addapt conversions: ");
+            uart_put_uint16(cs_led_addapt_conv);
+            uart_puts_P(" ms: ");
+            uart_put_uint16(cs_led_addapt_ms);
             break;
         case 'D':
             uart_puts_P("\n\rData:\n");
@@ -173,6 +222,82 @@ main ( void )
             break;
 
 
+        case 'I':
+            uart_puts_P("\n\rLED settle [ms]: ");
+            uart_put_uint16(cs_led_settle_ms);
+            uart_puts_P(" last: ");
+            uart_put_uint16(cs_led_settle_last);
+            uart_puts_P("\n\rLED addapt conversions: ");
+            uart_put_uint16(cs_led_addapt_conv);
+            uart_puts_P(" ms: ");
+            uart_put_uint16(cs_led_addapt_ms);
+            break;
+        case 'P':
+            for(uint8_t ui8=1; ui8<MC_CATCHER_PROFILES; ui8++)
+            {
+                uint16_t moves, ms_default;
+                uint16_t ms = MC_Catcher_Move_Stat_Get(ui8,&moves,&ms_default);
+
+                uart_puts_P("\n\rCatcher bins: ");
+                uart_put_uint16(ui8);
+                uart_puts_P(" moves: ");
+                uart_put_uint16(moves);
+                uart_puts_P(" ms: ");
+                uart_put_uint16(ms);
+                uart_puts_P(" (default ramp ");
+                uart_put_uint16(ms_default);
+                uart_putc(')');
+            }
+            break;
+        case 'Q':
+            uart_puts_P("\n\rCatcher plan (slot color steps ms):");
+            for(uint8_t ui8=0; ui8<MC_CATCHER_PLAN_LEN; ui8++)
+            {
+                uart_puts_P("\n\r");
+                uart_put_uint16(mc_catcher_plan[ui8].slot);
+                uart_putc(' ');
+                uart_put_uint16(mc_catcher_plan[ui8].color);
+                uart_putc(' ');
+                if(mc_catcher_plan[ui8].steps < 0)
+                    uart_putc('-');
+                uart_put_uint16(abs(mc_catcher_plan[ui8].steps));
+                uart_putc(' ');
+                uart_put_uint16(mc_catcher_plan[ui8].ms);
+            }
+            break;
+        case 'B':
+        case 'X':
+            {
+                uint8_t bins[COLOR_MAX];
+                uint16_t now, remapped, n;
+
+                n = MC_Catcher_Bins_Optimize(bins,&now,&remapped);
+                uart_puts_P("\n\rBins (color:bin) now:");
+                for(uint8_t ui8=0; ui8<COLOR_MAX; ui8++)
+                {
+                    uart_putc(' ');
+                    uart_put_uint16(mc_catcher_bin[ui8]);
+                }
+                uart_puts_P(" remapped:");
+                for(uint8_t ui8=0; ui8<COLOR_MAX; ui8++)
+                {
+                    uart_putc(' ');
+                    uart_put_uint16(bins[ui8]);
+                }
+                uart_puts_P("\n\rTravel/smartie [steps]: ");
+                uart_put_uint16(now);
+                uart_puts_P(" remapped: ");
+                uart_put_uint16(remapped);
+                uart_puts_P(" transitions: ");
+                uart_put_uint16(n);
+                if(command == 'X')
+                {
+                    // active with the next reset, when the bins are empty
+                    MC_Catcher_Bins_Store(bins);
+                    uart_puts_P("\n\rstored");
+                }
+            }
+            break;
         case 'O':
             uart_puts_P("\n\roffset:\n");
             ADJD_S311_Offset_Get(&cs_offset);
@@ -220,7 +345,9 @@ main ( void )
         case '6':
         case '7':
         case '8':
-            MC_Catcher_Set_Position((uint8_t)(command-'0'));
+            // the answer to "Is Color:" in md_learning, else a catcher move
+            if(!FSM_Learn_Key((uint8_t)(command-'0')))
+                MC_Catcher_Set_Position((uint8_t)(command-'0'));
             break;
         case 'T':
             TMC222_SetMotorParameters(&Revolver_Parameter,0);
@@ -259,20 +386,98 @@ main ( void )
             break;
         case 'p':
             fsm_pause ^= 0x01;
+            FSM_Event_Post(ev_mode);
             break;
         case 'n':
             cur_mode = md_running;
+            FSM_Event_Post(ev_mode);
+            break;
+        case 'N':
+            cur_mode = md_pipelined;
+            FSM_Event_Post(ev_mode);
+            break;
+        case 'r':
+            uart_puts_P("\n\rSmarties/min: ");
+            uart_put_uint16(FSM_Throughput_Get(&c16));
+            uart_puts_P(" sorted: ");
+            uart_put_uint16(c16);
+            uart_puts_P(" empty: ");
+            uart_put_uint16(FSM_Empty_Get());
+            uart_puts_P("\n\rMain loop [1/s]: ");
+            ultoa(FSM_Loop_Rate_Get(),(char *)buffer,10);
+            uart_puts((char *)buffer);
+            uart_puts_P("\n\rStartup [ms]: ");
+            uart_put_uint16(FSM_Startup_Get());
+            uart_puts_P(" homing catcher: ");
+            uart_put_uint16(MC_Homing_Time_Get(MC_AXIS_CATCHER));
+            uart_puts_P(" conveyor: ");
+            uart_put_uint16(MC_Homing_Time_Get(MC_AXIS_CONVEYOR));
+            break;
+        case 't':
+            // throughput and latency of the stages [ms], refreshes the LCD
+            uart_puts_P("\n\rSmarties/min: ");
+            uart_put_uint16(FSM_Throughput_Get(&c16));
+            uart_puts_P(" sorted: ");
+            uart_put_uint16(c16);
+#if FSM_LATENCY
+            uart_puts_P("\n\rstage\t\tn\tavg\tp50\tp90\tmax");
+            for(uint8_t ui8=0; ui8<sg_max; ui8++)
+            {
+                FSM_Latency_t lat;
+
+                FSM_Latency_Get(ui8,&lat);
+                uart_puts_P("\n\r");
+                uart_puts_p(sc_stage_name[ui8]);
+                uart_puts_P("\t");
+                if(strlen_P(sc_stage_name[ui8]) < 8)
+                    uart_puts_P("\t");
+                uart_puts(utoa(lat.cnt,(char *)buffer,10));
+                uart_puts_P("\t");
+                uart_puts(utoa(lat.avg,(char *)buffer,10));
+                uart_puts_P("\t");
+                uart_puts(utoa(lat.p50,(char *)buffer,10));
+                uart_puts_P("\t");
+                uart_puts(utoa(lat.p90,(char *)buffer,10));
+                uart_puts_P("\t");
+                uart_puts(utoa(lat.max,(char *)buffer,10));
+            }
+#endif
+            SCH_Task_Start(&sc_task_lcd,0);
+            break;
+#if FSM_TRACE
+        case 'F':
+            FSM_Trace_Dump();
+            break;
+#endif
+        case 'j':
+            // telemetry once a second on/off
+            if(sc_task_telemetry.active)
+                SCH_Task_Stop(&sc_task_telemetry);
+            else
+            {
+#if FSM_LATENCY
+                uart_puts_P("\n\rms,sorted,per_min,empty,total_p50,loops");
+#else
+                uart_puts_P("\n\rms,sorted,per_min,empty,loops");
+#endif
+                SCH_Task_Start(&sc_task_telemetry,0);
+            }
+            break;
+        case 'k':
+            SCH_Report();
             break;
         case 'm':
             cur_mode = md_learning;
+            FSM_Event_Post(ev_mode);
             break;
         case 'b':
             cur_mode = md_init;
+            FSM_Event_Post(ev_mode);
             break;
         }
     }
-    return 0;
-}		/* -----  end of function main  ----- */
+}
+/* -----  end of function SC_Console  ----- */
 
 /*
  * ===  FUNCTION  ======================================================================
@@ -297,11 +502,112 @@ SC_Init ( void )
 
     // TWI
     TWI_Master_Init(50);    //(uint8_t)TWI_BAUDRATE_CNT(TWI_BAUDRATE,F_CPU));
+    TWI_Master_Int_Init();  // change notification via INT_TWI
 
     // LCD
 
 }
 /* -----  end of function SC_Init  ----- */
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  SC_Lcd_Latency
+ *         Description:  throughput and median total latency [ms] of the smarties
+ *                       on the first line of the LCD, the median of eject,
+ *                       transport, integrate, catcher and drop (by their initial)
+ *                       on the second; one line per call, so a refresh doesn't
+ *                       hold off the other tasks for long. Without FSM_LATENCY
+ *                       throughput and sorted smarties only
+ * =====================================================================================
+ */
+void
+SC_Lcd_Latency ( void )
+{
+#if FSM_LATENCY
+    static const uint8_t stage[] = {sg_eject, sg_transport, sg_integrate, sg_catcher, sg_drop};
+    FSM_Latency_t lat;
+#endif
+    static uint8_t line;
+    uint16_t sorted;
+    char text[SC_LCD_COLS + 12];
+    uint8_t len;
+
+    if(!line)
+    {
+        utoa(FSM_Throughput_Get(&sorted),text,10);
+        strcat_P(text,PSTR("/min"));
+#if FSM_LATENCY
+        strcat_P(text,PSTR(" total "));
+        FSM_Latency_Get(sg_total,&lat);
+        utoa(lat.p50,text + strlen(text),10);
+        strcat_P(text,PSTR("ms"));
+#endif
+    }
+    else
+    {
+#if !FSM_LATENCY
+        FSM_Throughput_Get(&sorted);
+        utoa(sorted,text,10);
+        strcat_P(text,PSTR(" sorted"));
+#else
+        text[0] = '\0';
+        for(uint8_t ui8=0; ui8<sizeof(stage) && strlen(text)<SC_LCD_COLS; ui8++)
+        {
+            FSM_Latency_Get(stage[ui8],&lat);
+            len = strlen(text);
+            if(ui8)
+                text[len++] = ' ';
+            text[len++] = pgm_read_byte(sc_stage_name[stage[ui8]]) - 'a' + 'A';
+            utoa(lat.p50,text + len,10);
+        }
+#endif
+    }
+    // overwrite the rest of the old text instead of clearing the display
+    for(len = strlen(text); len < SC_LCD_COLS; len++)
+        text[len] = ' ';
+    text[SC_LCD_COLS] = '\0';
+    lcd_gotoxy(0,line);
+    lcd_puts(text);
+    line ^= 1;
+}
+/* -----  end of function SC_Lcd_Latency  ----- */
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  SC_Telemetry
+ *         Description:  one CSV line with the ms counter, the sorted smarties, the
+ *                       throughput, the empty slots, the median total latency
+ *                       (only with FSM_LATENCY) and the passes of the main loop per
+ *                       second (header at 'j')
+ * =====================================================================================
+ */
+void
+SC_Telemetry ( void )
+{
+#if FSM_LATENCY
+    FSM_Latency_t lat;
+#endif
+    uint16_t sorted, per_min;
+    char buffer[11];
+
+    per_min = FSM_Throughput_Get(&sorted);
+    uart_puts_P("\n\r");
+    uart_puts(utoa(MC_Ticks_Get(),buffer,10));
+    uart_putc(',');
+    uart_puts(utoa(sorted,buffer,10));
+    uart_putc(',');
+    uart_puts(utoa(per_min,buffer,10));
+    uart_putc(',');
+    uart_puts(utoa(FSM_Empty_Get(),buffer,10));
+    uart_putc(',');
+#if FSM_LATENCY
+    FSM_Latency_Get(sg_total,&lat);
+    uart_puts(utoa(lat.p50,buffer,10));
+    uart_putc(',');
+#endif
+    uart_puts(ultoa(FSM_Loop_Rate_Get(),buffer,10));
+}
+/* -----  end of function SC_Telemetry  ----- */
+
 
 /*@}*/
@@ -58,9 +58,9 @@ Returns: none
 *************************************************************************/
 void lcd_command(uint8_t cmd)
 {
+    lcd_waitbusy();     // also releases twi_lcd_buf from the last message
     twi_lcd_buf[2] = TWI_LCD_COMMAND;
     twi_lcd_buf[3] = cmd;
-    lcd_waitbusy();
     TWI_Master_Transceive_Message(twi_lcd_buf,4);
 }
 
@@ -72,9 +72,9 @@ Returns: none
 *************************************************************************/
 void lcd_data(uint8_t data)
 {
+    lcd_waitbusy();     // also releases twi_lcd_buf from the last message
     twi_lcd_buf[2] = TWI_LCD_DATA;
     twi_lcd_buf[3] = data;
-    lcd_waitbusy();
     TWI_Master_Transceive_Message(twi_lcd_buf,4);
 }
 
@@ -143,10 +143,9 @@ Returns:  none
 *************************************************************************/
 void lcd_putc(char c)
 {
-    lcd_waitbusy();
+    lcd_waitbusy();     // also releases twi_lcd_buf from the last message
     twi_lcd_buf[2] = TWI_LCD_PUTC;
     twi_lcd_buf[3] = c;
-    lcd_waitbusy();
     TWI_Master_Transceive_Message(twi_lcd_buf,4);
 }/* lcd_putc */
 
@@ -162,12 +161,12 @@ void lcd_puts(const char *s)
     register char c;
     uint8_t i = 3;
 
+    lcd_waitbusy();     // also releases twi_lcd_buf from the last message
     twi_lcd_buf[2] = TWI_LCD_PUTS;
     while ( (c = *s++) )
         twi_lcd_buf[i++] = c;
 
     twi_lcd_buf[i++] = 0;
-    lcd_waitbusy();
     TWI_Master_Transceive_Message(twi_lcd_buf,i);
 }/* lcd_puts */
 
@@ -183,13 +182,13 @@ void lcd_puts_p(const char *progmem_s)
     register char c;
     uint8_t i = 3;
 
+    lcd_waitbusy();     // also releases twi_lcd_buf from the last message
     twi_lcd_buf[2] = TWI_LCD_PUTS;
     while ( (c = pgm_read_byte(progmem_s++)) )
     {
         twi_lcd_buf[i++] = c;
     }
     twi_lcd_buf[i++] = 0;
-    lcd_waitbusy();
     TWI_Master_Transceive_Message(twi_lcd_buf,i);
 
 }/* lcd_puts_p */
@@ -218,8 +217,17 @@ Returns:
 *************************************************************************/
 void lcd_waitbusy(void)
 {
-    while (!((TWI_Master_Read_Byte(9))&(_BV(BUF_0_EMPTY)|_BV(BUF_1_EMPTY))));
-}/* lcd_init */
+    uint8_t reg = 0, status;
+
+    // status register (0) of the LCD board, a plain read would return the
+    // register behind the last write; without a board don't wait forever
+    do
+    {
+        if (TWI_Master_Write_Read(TWI_LCD_ADRESS,&reg,1,&status,1))
+            return;
+    }
+    while (!(status&(_BV(BUF_0_EMPTY)|_BV(BUF_1_EMPTY))));
+}/* lcd_waitbusy */
 
 
 /*************************************************************************
@@ -266,7 +274,7 @@ void lcd_rot_enc_get(void)
     static int8_t rot_enc_val_old=0;
     int8_t rot_enc_val_cur;
     uint8_t ui8_tmp=0;
-    ui8_tmp=TWI_Master_Read_Byte(TWI_LCD_ADRESS);
+    ui8_tmp=TWI_Master_Read_Register(0,TWI_LCD_ADRESS);   // status register
     if(ui8_tmp&_BV(ROT_ENC_EVENT))
     {
         rot_enc_val_cur = TWI_Master_Read_Register(3,TWI_LCD_ADRESS);
@@ -17,6 +17,7 @@
  * =====================================================================================
  */
 
+#include <stddef.h>
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/pgmspace.h>
@@ -33,19 +34,29 @@
 
 
 //Variables needed by this library to handle the TWI communication
-static volatile uint8_t twi_buf[TWI_BUF_SIZE];
 static volatile uint8_t twi_buf_ptr;
-static volatile uint8_t twi_buf_cnt;
+static volatile uint8_t twi_rx_phase;
 static volatile uint8_t twi_err;
-static volatile uint8_t twi_status;
 
+// transaction queue: the ISR works on twi_queue[twi_queue_tail]
+static TWI_Msg_t * volatile twi_queue[TWI_QUEUE_SIZE];
+static volatile uint8_t twi_queue_head;
+static volatile uint8_t twi_queue_tail;
+
+// descriptors of the posted writes
+static TWI_Msg_t twi_post_msg[TWI_POST_SIZE];
+static uint8_t   twi_post_idx;
+
+// change notifications of the INT_TWI line (all set until it is enabled)
+static volatile uint8_t twi_int_events = TWI_INT_ALL;
+static uint8_t          twi_int_enabled;
 
 
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Init
  *  Description:  Initialises the TWI-unit
- *  							Sets Baudrate register,  enables TWI-unit,  clears twi_status / errors
+ *  							Sets Baudrate register,  enables TWI-unit,  clears queue / errors
  *  	  	Input: 	none
  *  	  Returns: 	none
  * =====================================================================================
@@ -53,11 +64,15 @@ static volatile uint8_t twi_status;
 void
 TWI_Master_Init (uint8_t twi_baudrate_reg)
 {
+    uint8_t i;
 
     TWBR = (twi_baudrate_reg); 	  	// TWI bit rate:
     TWCR = _BV(TWINT);              // clear interrupt flag!!
     TWCR = _BV(TWEN); 			    // switch on TWI
-    twi_status = TWI_STAT_RDY;      // set twi status
+    twi_queue_head = 0;             // flush transaction queue
+    twi_queue_tail = 0;
+    for (i=0; i<TWI_POST_SIZE; i++)
+        twi_post_msg[i].status = TWI_STAT_RDY;
     twi_err = 0;                    // clear twi error
 #if twi_debug
     uart_puts_P("\n\n\rTWI_Init...\n\rTWBR: ");
@@ -70,158 +85,101 @@ TWI_Master_Init (uint8_t twi_baudrate_reg)
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Transceive_Message
- *  Description: 	Waits until TWI-Int is disabled and copies the message from the
- *  				pointed message to the twi_buf and starts a twi transmission
- *  	  	Input: 	pointer to the message,  message size
- *  	  Returns: 	error
+ *         Name:  TWI_Master_Start_Next
+ *  Description:  Generates the start condition for the message at the queue tail.
+ *                Has to be called with interrupts disabled and the TWI-Int idle.
  * =====================================================================================
  */
-uint8_t
-TWI_Master_Transceive_Message (volatile uint8_t *message, uint8_t messagesize)
+static void
+TWI_Master_Start_Next (void)
 {
-
-    uint8_t i;
-
-#if TWI_DEBUG
-    uart_puts_P("\n\n\rTWI_Tx_Msg! TWCR: \n\r");
-    do
-    {
-        uart_putc('\r');
-        uart_put_bin8(TWCR);
-        uart_putc('\t');
-        uart_put_wait();
-    }
-    while (TWI_Master_Transceiver_Busy());		// Wait until previous transmision is done
-
-#else
-    while (TWI_Master_Transceiver_Busy());		// Wait until previous transmision is done
-#endif
-
-
-    if (messagesize <= TWI_BUF_SIZE ) 				// check messagesize
-    {
-        if(*(uint8_t *)message & TWI_READ_BIT)
-        {
-            twi_buf[0] = *(uint8_t *)message;
-#if TWI_DEBUG
-            uart_puts_P("\n\r\ttwi_buf[0]: ");
-            uart_put_bin8(twi_buf[0]);
-#endif
-        }
-        else
-        {
-            for(i=0; i<messagesize; i++)
-            {
-                twi_buf[i] = *(((uint8_t *) message)+i);
-#if TWI_DEBUG
-                uart_puts_P("\n\r\ttwi_buf[");
-                uart_putc('0'+i);
-                uart_puts_P("]: ");
-                uart_put_bin8(twi_buf[i]);
-#endif
-            }
-        }
-        twi_buf_cnt = messagesize;
-        TWI_Master_Start_Transceiver();
-        return 0;
-    }
-    else
-    {
-        twi_err = TWI_ERR_BUF_OVF;
-        twi_status = TWI_STAT_ERROR;
-#ifdef TWI_DEBUG
-        uart_puts_P("\n\rtwi_err:");
-        uart_put_bin8(twi_err);
-#endif
-        return twi_err;
-    }
-}		/* -----  end of function TWI_Master_Start_Transceiver  ----- */
+    twi_rx_phase = 0;
+    while (TWCR & _BV(TWSTO));                  // last stop condition still pending
+    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+}		/* -----  end of function TWI_Master_Start_Next  ----- */
 
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Start_Transceiver
- *  Description: 	Waits until TWI-Int is disabled and intialises a twi transmission
- *  							with last message (same buffer)
- *  			Input: 	none
- *  	  Returns: 	none
+ *         Name:  TWI_Master_Enqueue
+ *  Description:  Appends a message to the transaction queue and returns at once.
+ *                If the bus is idle the transmission is started immediately,
+ *                otherwise the ISR starts it when the previous messages are done.
+ *  	  	Input: 	pointer to the message descriptor
+ *  	  Returns: 	0 or TWI_ERR_QUEUE_FULL
  * =====================================================================================
  */
-void
-TWI_Master_Start_Transceiver (void)
+uint8_t
+TWI_Master_Enqueue (TWI_Msg_t *msg)
 {
+    uint8_t sreg, head;
 
-#if TWI_DEBUG
-    uart_puts_P("\n\n\rTWI_Tx_Start!\ntwi_err:\n\r");
-    do
+    sreg = SREG;
+    cli();
+    head = (twi_queue_head + 1) & (TWI_QUEUE_SIZE - 1);
+    if (head == twi_queue_tail)
     {
-        uart_putc('\r');
-        uart_put_bin8(twi_err);
-        uart_putc('\t');
-        uart_put_wait();
+        SREG = sreg;
+        return TWI_ERR_QUEUE_FULL;
     }
-    while (TWI_Master_Transceiver_Busy());		// Wait until previous transmision is done
+    msg->status = TWI_STAT_BSY;
+    msg->err = 0;
+    twi_queue[twi_queue_head] = msg;
+    twi_queue_head = head;
 
-#else
-    while (TWI_Master_Transceiver_Busy());		// Wait until previous transmision is done
-#endif
+    if (!TWI_Master_Transceiver_Busy())         // bus idle: kick the ISR
+        TWI_Master_Start_Next();
 
-    twi_status = TWI_STAT_BSY; 					// set twi status (no use : done by TWIE)
-    twi_err = 0; 								// clear twi error
+    SREG = sreg;
+    return 0;
+}		/* -----  end of function TWI_Master_Enqueue  ----- */
 
-    TWCR |= ( _BV(TWEA) | _BV(TWSTA) | _BV(TWIE)); 	// Initialise transmission via
-    // TWI-startcondition,
-    // enable TWI interrupt and
-    // TWCR |= _BV(TWINT);                          // finally clear TWI interrupt flag
 
-#if TWI_DEBUG
-    uart_puts_P("\n\rTWCR: ");
-    uart_put_bin8(TWCR);
-#endif
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Msg_Wait
+ *  Description:  Waits until the given message is done
+ *  	  	Input: 	pointer to the message descriptor
+ *  	  Returns: 	error of the message
+ * =====================================================================================
+ */
+uint8_t
+TWI_Master_Msg_Wait (TWI_Msg_t *msg)
+{
+    // the engine never stops with a queued message, so an idle engine
+    // also ends the wait (e.g. after a TWI_Master_Init() in between)
+    while (TWI_Master_Msg_Busy(msg) && TWI_Master_Transceiver_Busy());
+    return msg->err;
+}		/* -----  end of function TWI_Master_Msg_Wait  ----- */
 
-}		/* -----  end of function TWI_Master_Start_Transceiver ----- */
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Get_State
- *  Description:  Waits until TWI-Int is disabled and returns the TWI_state
- *  			Input: 	none
- *  	  Returns: 	TWI_State
+ *         Name:  TWI_Master_Enqueue_Wait
+ *  Description:  Like TWI_Master_Enqueue, but waits for a free queue entry
  * =====================================================================================
  */
-uint8_t
-TWI_Master_Get_State (void)
+static void
+TWI_Master_Enqueue_Wait (TWI_Msg_t *msg)
 {
-#if TWI_DEBUG
-    uart_puts_P("\n\n\rTWI_Get_Status! twi_status:\n\r");
-    do
-    {
-        uart_putc('\r');
-        uart_put_bin8(twi_status);
-        uart_putc('\t');
-        uart_put_wait();
-    }
-    while(TWI_Master_Transceiver_Busy());
-    return twi_status;
-#else
-    while(TWI_Master_Transceiver_Busy());
-    return twi_status;
-#endif
+    while (TWI_Master_Enqueue(msg) == TWI_ERR_QUEUE_FULL);
+}		/* -----  end of function TWI_Master_Enqueue_Wait  ----- */
 
-}		/* -----  end of function TWI_Master_Get_State  ----- */
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Get_Error(void)
- *  Description:
+ *         Name:  TWI_Master_Flush
+ *  Description:  Waits until all queued messages are done.
+ *                Afterwards all buffers handed over to the driver are free again.
+ *  			Input: 	none
+ *  	  Returns: 	error of the last message
  * =====================================================================================
  */
 uint8_t
-TWI_Master_Get_Error(void )
+TWI_Master_Flush (void)
 {
 #if TWI_DEBUG
-    uart_puts_P("\n\n\rTWI_Get_Error! twi_error:\n\r");
+    uart_puts_P("\n\n\rTWI_Flush! twi_error:\n\r");
     do
     {
         uart_putc('\r');
@@ -230,112 +188,115 @@ TWI_Master_Get_Error(void )
         uart_put_wait();
     }
     while(TWI_Master_Transceiver_Busy());
-    return twi_err;
 #else
     while(TWI_Master_Transceiver_Busy());
-    return twi_err;
 #endif
-}		/* -----  end of function TWI_Master_Get_Error(void)  ----- */
+    return twi_err;
+}		/* -----  end of function TWI_Master_Flush  ----- */
+
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Get_Transceiver_Data
- *  Description:  Waits until TWI-Int is disabled and initiates a TWI-reception
- *  							Call this function after you sent a request of data to the Slave
- *  							The first byte of the message has to be the slave address!!
- *  			Input: 	*message,  message_size
- *  	  Returns: 	none
+ *         Name:  TWI_Master_Post
+ *  Description:  Queues a write of the inline header (copied, max. TWI_HDR_SIZE bytes)
+ *                followed by data_cnt bytes streamed directly from data (not copied!)
+ *                and returns without waiting for the transmission (posted write).
+ *                Waits only if the oldest posted message is still pending.
+ *  	  	Input: 	address, header and size, data and size
+ *  	  Returns: 	error
  * =====================================================================================
  */
 uint8_t
-TWI_Master_Get_Transceiver_Data(volatile uint8_t * message, uint8_t message_size)
+TWI_Master_Post (uint8_t address, const uint8_t *hdr, uint8_t hdr_cnt,
+                 uint8_t *data, uint8_t data_cnt)
 {
+    TWI_Msg_t *msg = &twi_post_msg[twi_post_idx];
     uint8_t i;
-    uint8_t * p_message = message;
 
-#if TWI_DEBUG
-    uart_puts_P("\n\n\rTWI_Get_Tx_Data:  ");
-    while(TWI_Master_Transceiver_Busy())
-        uart_put_wait();
-#else
-    while(TWI_Master_Transceiver_Busy());
-#endif
-
-    switch (twi_status)
+    if (hdr_cnt > TWI_HDR_SIZE)
     {
-    case TWI_STAT_RX_COMPLETE:
-#if TWI_DEBUG
-        uart_puts_P(" RX complete");
-#endif
-        for(i=0; i<message_size; i++)
-        {
-            p_message[i]=twi_buf[i+1];
-        }
-        twi_status = TWI_STAT_RDY;
-        break;
-    case TWI_STAT_TX_COMPLETE:
+        twi_err = TWI_ERR_BUF_OVF;
 #if TWI_DEBUG
-        uart_puts_P(" no RX");
+        uart_puts_P("\n\rtwi_err:");
+        uart_put_bin8(twi_err);
 #endif
-        twi_err = TWI_ERR_NO_RX;
-    default :
-        break;
+        return twi_err;
     }
-    return twi_err;
 
-}		/* -----  end of function TWI_Master_Get_Transceiver_Data ----- */
+    while (TWI_Master_Msg_Busy(msg) && TWI_Master_Transceiver_Busy());  // slot still queued
+    twi_post_idx = (twi_post_idx + 1) % TWI_POST_SIZE;
+
+    for (i=0; i<hdr_cnt; i++)
+        msg->hdr[i] = hdr[i];
+    msg->sla = address;
+    msg->hdr_cnt = hdr_cnt;
+    msg->tx_buf = data;
+    msg->tx_cnt = data_cnt;
+    msg->rx_cnt = 0;
+    msg->callback = NULL;
+    TWI_Master_Enqueue_Wait(msg);
+    return 0;
+}		/* -----  end of function TWI_Master_Post  ----- */
 
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Transceive_Message
+ *  Description: 	Queues the transmission of a message with the slave address
+ *  				(SLA+W) as first byte. The message is streamed directly from
+ *  				the given buffer, so it must not be changed until the
+ *  				transmission is done (see TWI_Master_Post).
+ *  	  	Input: 	pointer to the message,  message size
+ *  	  Returns: 	error
+ * =====================================================================================
+ */
+uint8_t
+TWI_Master_Transceive_Message (volatile uint8_t *message, uint8_t messagesize)
+{
+    return TWI_Master_Post(message[0] >> 1, NULL, 0,
+                           (uint8_t *)message + 1, messagesize - 1);
+}		/* -----  end of function TWI_Master_Transceive_Message  ----- */
 
 
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Write_Register
- *  Description:  Waits until TWI-Int is disabled and sends two bytes (register and value)
- *                to the slave address
+ *  Description:  Queues two bytes (register and value) for the slave address
+ *                and returns without waiting for the transmission (posted write)
  *  	  Input:  message , address
- *      Returns:  none
+ *      Returns:  error
  * =====================================================================================
  */
 uint8_t
 TWI_Master_Write_Register(uint8_t reg, uint8_t value, uint8_t address)
 {
-    while (TWI_Master_Transceiver_Busy());	// Wait until previous transmision is done
-    twi_buf[0] = (address <<1 ) | TW_WRITE;
-    twi_buf[1] = reg;
-    twi_buf[2] = value;
-    twi_buf_cnt = 3;
-    TWI_Master_Start_Transceiver();
-    while (TWI_Master_Transceiver_Busy()); // Wait until previous transmision is done
-    return 0;
+    uint8_t hdr[2];
+
+    hdr[0] = reg;
+    hdr[1] = value;
+    return TWI_Master_Post(address, hdr, 2, NULL, 0);
 }
 
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Write_Byte
- *  Description:  Waits until TWI-Int is disabled and sends one byte
- *                to the slave address
+ *  Description:  Queues one byte for the slave address and returns without
+ *                waiting for the transmission (posted write)
  *  	  Input:  message , address
- *  	Returns:  none
+ *  	Returns:  error
  * =====================================================================================
  */
 uint8_t
 TWI_Master_Write_Byte(uint8_t byte, uint8_t address)
 {
-    while (TWI_Master_Transceiver_Busy());	// Wait until previous transmision is done
-    twi_buf[0] = (address <<1 ) | TW_WRITE;
-    twi_buf[1] = byte;
-    twi_buf_cnt = 2;
-    TWI_Master_Start_Transceiver();
-    while (TWI_Master_Transceiver_Busy());  // Wait until transmision is done
-    return 0;
+    return TWI_Master_Post(address, &byte, 1, NULL, 0);
 }
 
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Read_Byte
- *  Description:  Waits until TWI-Int is disabled and reads a single byte
- *                from the slave address
+ *  Description:  Queues the read of a single byte from the slave address and
+ *                waits for this message (but not for the rest of the queue)
  *  	  Input:  address
  *  	Returns:  byte
  * =====================================================================================
@@ -343,20 +304,51 @@ TWI_Master_Write_Byte(uint8_t byte, uint8_t address)
 uint8_t
 TWI_Master_Read_Byte(uint8_t address)
 {
-    while (TWI_Master_Transceiver_Busy());	// Wait until previous transmision is done
-    twi_buf[0] = (address <<1 ) | TW_READ;
-    twi_buf_cnt = 1;
-    TWI_Master_Start_Transceiver();
-    while (TWI_Master_Transceiver_Busy());  // Wait until transmision is done
-    return (twi_buf[1]);
+    TWI_Msg_t msg;
+    uint8_t byte = 0;
+
+    msg.sla = address;
+    msg.hdr_cnt = 0;
+    msg.tx_cnt = 0;
+    msg.rx_buf = &byte;
+    msg.rx_cnt = 1;
+    msg.callback = NULL;
+    TWI_Master_Enqueue_Wait(&msg);
+    TWI_Master_Msg_Wait(&msg);              // msg lives on the stack!
+    return byte;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Write_Read
+ *  Description:  Writes tx_cnt bytes to the slave and reads rx_cnt bytes back
+ *                within one transaction (START, SLA+W, tx, REP_START, SLA+R, rx, STOP).
+ *                Waits for this message (but not for the rest of the queue).
+ *  	  Input:  address, tx buffer and size, rx buffer and size
+ *  	Returns:  error
+ * =====================================================================================
+ */
+uint8_t
+TWI_Master_Write_Read(uint8_t address, uint8_t *tx, uint8_t tx_cnt, uint8_t *rx, uint8_t rx_cnt)
+{
+    TWI_Msg_t msg;
+
+    msg.sla = address;
+    msg.hdr_cnt = 0;
+    msg.tx_buf = tx;
+    msg.tx_cnt = tx_cnt;
+    msg.rx_buf = rx;
+    msg.rx_cnt = rx_cnt;
+    msg.callback = NULL;
+    TWI_Master_Enqueue_Wait(&msg);
+    return TWI_Master_Msg_Wait(&msg);       // msg lives on the stack!
 }
 
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Read_Register
- *  Description:  Waits until TWI-Int is disabled and addresses a given register.
- *                After transmision it reads the addressed reigster from the slave
- *                address.
+ *  Description:  Addresses a given register and reads it back from the slave
+ *                address using a repeated start.
  *  	  Input:  address
  *  	Returns:  byte
  * =====================================================================================
@@ -364,16 +356,115 @@ TWI_Master_Read_Byte(uint8_t address)
 uint8_t
 TWI_Master_Read_Register(uint8_t reg,uint8_t address)
 {
-    TWI_Master_Write_Byte(reg,address);
-    return (TWI_Master_Read_Byte(address));
+    uint8_t value = 0;
+
+    TWI_Master_Write_Read(address, &reg, 1, &value, 1);
+    return value;
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Msg_Done
+ *  Description:  Called by the ISR when the message at the queue tail is done.
+ *                Signals the message, calls its callback and starts the next one
+ *                or releases the bus.
+ * =====================================================================================
+ */
+static void
+TWI_Master_Msg_Done(uint8_t status, uint8_t err)
+{
+    TWI_Msg_t *msg = twi_queue[twi_queue_tail];
+
+    twi_queue_tail = (twi_queue_tail + 1) & (TWI_QUEUE_SIZE - 1);
+    twi_err = err;
+    msg->err = err;
+    msg->status = status;
+    if (msg->callback != NULL)
+        msg->callback(msg);                 // may queue a follow-up message
+
+    if (twi_queue_tail != twi_queue_head)
+    {
+        twi_rx_phase = 0;
+        // clear TWINT, stop condition followed by start of the next message
+        TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+    }
+    else
+    {
+        // clear TWINT, initiate stop condition disable TW-interrupt
+        TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+    }
+}
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Int_Init
+ *  Description:  Enables the falling edge interrupt (INT1) of the INT_TWI line
+ *                (PD3, input with pull-up). Until then every client sees an event.
+ *  	  Input:  none
+ *  	Returns:  none
+ * =====================================================================================
+ */
+void
+TWI_Master_Int_Init(void)
+{
+    MCUCR = (MCUCR & ~(_BV(ISC11) | _BV(ISC10))) | _BV(ISC11);  // falling edge
+    GIFR  = _BV(INTF1);
+    GICR |= _BV(INT1);
+    twi_int_events = TWI_INT_ALL;   // nobody has read his slave yet
+    twi_int_enabled = 1;
+}
+
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Int_Event
+ *  Description:  Tests and clears the change notification of the clients in mask.
+ *                A client reads its slave only when this returns non zero.
+ *                As the line is shared, it also reports an event as long as the
+ *                line is held low (another slave may hide a new edge).
+ *  	  Input:  TWI_INT_xxx
+ *  	Returns:  the notified clients of mask
+ * =====================================================================================
+ */
+uint8_t
+TWI_Master_Int_Event(uint8_t mask)
+{
+    uint8_t sreg, events;
+
+    if (!twi_int_enabled)
+        return mask;
+
+    sreg = SREG;
+    cli();
+    events = twi_int_events & mask;
+    twi_int_events &= ~mask;
+    SREG = sreg;
+
+    if (!(PIND & _BV(PD3)))
+        events = mask;
+    return events;
+}
+
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:   ISR(INT1_vect)
+ *  Description: 	A slave on the INT_TWI line signals a change: notify all clients
+ * =====================================================================================
+ */
+ISR(INT1_vect)
+{
+    twi_int_events = TWI_INT_ALL;
 }
 
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:   ISR(TWI_vect)
  *  Description: 	This function is the Interrupt Service Routine (ISR), and
  *  							automatically called when the TWI interrupt is triggered;
  *  							that is whenever a TWI event has occurred.
+ *  							It works on the message at the tail of the transaction queue.
  *  							This function should not be called directly from the main application.
  *  			Input: 	none
  *  		Returns: 	none
@@ -382,6 +473,8 @@ TWI_Master_Read_Register(uint8_t reg,uint8_t address)
 
 ISR(TWI_vect)
 {
+    TWI_Msg_t *msg = twi_queue[twi_queue_tail];
+
 #if TWI_DEBUG
     //uart_puts_P("\n\rTWI ISR! TW_STATUS: ");
     //uart_put_bin8(TW_STATUS);
@@ -392,31 +485,50 @@ ISR(TWI_vect)
     case TW_REP_START:                  // repeated start condition transmitted
         // => we are becoming bus master!
         twi_buf_ptr = 0;				// Reset buffer position
+        if (!twi_rx_phase && (msg->hdr_cnt || msg->tx_cnt))
+            TWDR = (msg->sla << 1) | TW_WRITE;
+        else
+        {
+            twi_rx_phase = 1;
+            TWDR = (msg->sla << 1) | TW_READ;
+        }
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+        break;
 
     case TW_MT_SLA_ACK: 				// Slave addresse ack´ed
     case TW_MT_DATA_ACK:                // Slave data receive acked
 
-        if (twi_buf_ptr >= twi_buf_cnt) 	// Buffer pointer at the end???
+        if (twi_buf_ptr < msg->hdr_cnt)
         {
-            twi_status = TWI_STAT_TX_COMPLETE;      // set status
-            twi_err = 0; 							// no error
-            // clear TWINT, initiate stop condition disable TW-interrupt
-            TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+            TWDR = msg->hdr[twi_buf_ptr++]; 	// Copy inline header byte to data register
+            // clear TWINT
+            TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
         }
-        else
+        else if (twi_buf_ptr < msg->hdr_cnt + msg->tx_cnt)
         {
-            TWDR = twi_buf[twi_buf_ptr++]; 	// Copy Data from current buffer position to data rgister
+            // Copy Data from the callers buffer to data rgister
             // Post increment pointer
+            TWDR = msg->tx_buf[twi_buf_ptr++ - msg->hdr_cnt];
             // clear TWINT
             TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
         }
+        else if (msg->rx_cnt)           // write done, continue with the read phase
+        {
+            twi_rx_phase = 1;
+            // clear TWINT, initiate repeated start condition (keep the bus)
+            TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+        }
+        else
+        {
+            TWI_Master_Msg_Done(TWI_STAT_TX_COMPLETE, 0);
+        }
         break; 								// Leave state machine
 
     case TW_MR_DATA_ACK: 					// Data has been received and ACK transmitted
-        twi_buf[twi_buf_ptr++]=TWDR; 		// Copy from data register to current buffer position
+        msg->rx_buf[twi_buf_ptr++]=TWDR; 	// Copy from data register to current buffer position
 
     case TW_MR_SLA_ACK: 					// SLA+R has been transmitted and Ack received
-        if(twi_buf_ptr >= twi_buf_cnt)	    // Buffer pointer at byte befor the end??
+        if(twi_buf_ptr + 1 >= msg->rx_cnt)	// next byte is the last one??
         {
             // clear TWINT and don´t initiate ACK after next reception
             TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
@@ -429,11 +541,8 @@ ISR(TWI_vect)
         break; 								// Leave state machine
 
     case TW_MR_DATA_NACK: 					// Data byte has been received & NACK transmitted
-        twi_buf[twi_buf_ptr] = TWDR; 		// Copy data from data register to current buffer position
-        twi_status = TWI_STAT_RX_COMPLETE; 	// Set status
-        twi_err = 0; 						// clear error
-        // clear TWINT, initiate a stop condition and disable TW-interrupt
-        TWCR = _BV(TWINT) | _BV(TWSTO)| _BV(TWEN);
+        msg->rx_buf[twi_buf_ptr] = TWDR; 	// Copy data from data register to current buffer position
+        TWI_Master_Msg_Done(TWI_STAT_RX_COMPLETE, 0);
         break;                              // Leave state machine
 
 // posible errors
@@ -448,11 +557,9 @@ ISR(TWI_vect)
     case TW_MT_DATA_NACK:               // Data byte has been transmitted and NACK has been received
     case TW_BUS_ERROR:                  // general
     default:
-        twi_status = TWI_STAT_ERROR;    // set twi status to error!!
-        twi_err = (TW_STATUS + 1);      // write TWI_Staus and LSB to the twi error register
+        // write TWI_Staus and LSB to the twi error register
         // LSB is added because TW_BUS_ERROR = 0; (no usefull error code)
-        // clear TWINT, generate stop condition and disable TW interrupt
-        TWCR = (_BV(TWINT)|_BV(TWSTO));     // initialise a stop condition, clear interrupt flag
+        // the message is dropped, the queue goes on with the next one
+        TWI_Master_Msg_Done(TWI_STAT_ERROR, TW_STATUS + 1);
     }
 }
-
@@ -65,10 +65,27 @@ This library is based on the ATMEL Apliction Note AN315
 #define TWI_BAUDRATE_CNT(baudRate,xtalCpu)     ((xtalCpu/(8*baudRate))-2)
 
 /**
- *  @name  Definition for the TWI buffer size
- *  This buffer determines the length of the messages that can be received or transmitted.
+ *  @name  Definition for the TWI header size
+ *  Number of bytes (command / register address) a message carries inline.
+ *  All other data is streamed directly from / to the buffers of the caller.
  */
-#define TWI_BUF_SIZE 			64
+#define TWI_HDR_SIZE 			5
+
+/**
+ *  @name  Definition for the TWI transaction queue
+ *  Number of message descriptors that can be pending at the same time (power of 2).
+ */
+#ifndef TWI_QUEUE_SIZE
+#define TWI_QUEUE_SIZE          8
+#endif
+
+/**
+ *  @name  Definition for the posted writes
+ *  Number of writes that can be in flight without blocking the caller.
+ */
+#ifndef TWI_POST_SIZE
+#define TWI_POST_SIZE           4
+#endif
 
 #define TWI_READ_BIT   1
 #define TWI_WRITE_BIT  0
@@ -87,26 +104,42 @@ This library is based on the ATMEL Apliction Note AN315
 // Bit0 = 1 -> transmission error occoured in TWI-ISR
 // Bit1 = 1 -> error occoured in stack-handling e.g: buf_ovf, rx-buf empty etc.
 
-#define TWI_ERR_BUF_OVF 		2	// Message longer than buffer!!
-#define TWI_ERR_NO_RX 			6   // No message received
+#define TWI_ERR_BUF_OVF 		2	// Header longer than TWI_HDR_SIZE!!
+#define TWI_ERR_QUEUE_FULL      10  // No free entry in the transaction queue
+
+// change notification of the slaves via the INT_TWI line (PD3 / INT1),
+// one bit per client of TWI_Master_Int_Event()
+#define TWI_INT_EXPANDER        0x01    // IO expander of the light barriers
+#define TWI_INT_MMI             0x02    // rotary encoder / keys of the LCD modul
+#define TWI_INT_ALL             0x03
 
 
 /* -----  end of Defines  ----- */
 
 
-// TODO :
-// somthing like this!!
-/*
-typedef struct TWI_send_header_s{
-    unsigned direction: 1;
-    unsigned address:   7;
-    unsigned reg:       8;
-    unsigned data[];
-}TWI_send_header_t;
-
-typedef union {
-    TWI_send_header_t send_header}
-*/
+/**
+ *  @name  Message descriptor of the transaction queue
+ *  A message writes the hdr_cnt bytes of hdr followed by tx_cnt bytes from tx_buf
+ *  and afterwards reads rx_cnt bytes into rx_buf after a repeated start
+ *  (any count may be 0, but not all of them).
+ *  The ISR streams directly from / to tx_buf and rx_buf: the buffers and the
+ *  descriptor itself belong to the driver until status leaves TWI_STAT_BSY,
+ *  so they must neither be changed nor live on a stack frame that returns earlier.
+ *  The callback is called from the TWI interrupt when the message is done.
+ */
+typedef struct TWI_Msg_s
+{
+    uint8_t             sla;        /**< 7 bit slave address */
+    uint8_t             hdr_cnt;    /**< number of inline bytes to write first */
+    uint8_t             tx_cnt;     /**< number of bytes to write from tx_buf */
+    uint8_t             rx_cnt;     /**< number of bytes to read */
+    volatile uint8_t    status;     /**< TWI_STAT_xxx */
+    volatile uint8_t    err;        /**< twi error of this message, 0 if ok */
+    uint8_t             hdr[TWI_HDR_SIZE];
+    uint8_t             *tx_buf;
+    uint8_t             *rx_buf;
+    void                (*callback)(struct TWI_Msg_s *msg);
+} TWI_Msg_t;
 
 
 /*
@@ -147,72 +180,97 @@ TWI_Master_Init (uint8_t baudrate);
 */
 #define TWI_Master_Transceiver_Busy() 	(TWCR & _BV(TWIE))
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Msg_Busy()
+ *  Description:  Call this macro to test if a queued message is still pending.
+ *  			Input: 	pointer to the message
+ *  		Returns: 	1 while queued or transceiving, 0 else
+ * =====================================================================================
+ */
+#define TWI_Master_Msg_Busy(msg)        ((msg)->status == TWI_STAT_BSY)
+
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Transceive_Message
- *  Description: 	Waits until TWI-Int is disabled and copies the message from the
- *  							pointed message to the twi_buf and starts a twi transmission
- *  	  	Input: 	pointer to the message,  message size
- *  	  Returns: 	error
+ *         Name:  TWI_Master_Enqueue
+ *  Description:  Appends a message to the transaction queue and returns at once.
+ *                If the bus is idle the transmission is started immediately,
+ *                otherwise the ISR starts it when the previous messages are done.
+ *  	  	Input: 	pointer to the message descriptor
+ *  	  Returns: 	0 or TWI_ERR_QUEUE_FULL
  * =====================================================================================
  */
 extern uint8_t
-TWI_Master_Transceive_Message (volatile uint8_t *message, uint8_t messagesize);
-
-/* -----  end of function TWI_Master_Start_Transceiver  ----- */
+TWI_Master_Enqueue (TWI_Msg_t *msg);
 
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Start_Transceiver
- *  Description: 	Waits until TWI-Int is disabled and intialises a twi transmission
- *  							with last message (same buffer)
- *  			Input: 	none
- *  	  Returns: 	none
+ *         Name:  TWI_Master_Msg_Wait
+ *  Description:  Waits until the given message is done
+ *  	  	Input: 	pointer to the message descriptor
+ *  	  Returns: 	error of the message
  * =====================================================================================
  */
-extern void
-TWI_Master_Start_Transceiver (void);
+extern uint8_t
+TWI_Master_Msg_Wait (TWI_Msg_t *msg);
 
-/* -----  end of function TWI_Master_Restart_Transceiver ----- */
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Get_State
- *  Description:  Waits until TWI-Int is disabled and returns the TWI_state
+ *         Name:  TWI_Master_Flush
+ *  Description:  Waits until all queued messages are done.
+ *                Afterwards all buffers handed over to the driver are free again.
  *  			Input: 	none
- *  	  Returns: 	TWI_State
+ *  	  Returns: 	error of the last message
  * =====================================================================================
  */
 extern uint8_t
-TWI_Master_Get_State (void);
+TWI_Master_Flush (void);
+
 
-/* -----  end of function TWI_Master_Get_State  ----- */
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Post
+ *  Description:  Queues a write of the inline header (copied, max. TWI_HDR_SIZE bytes)
+ *                followed by data_cnt bytes streamed directly from data (not copied!)
+ *                and returns without waiting for the transmission (posted write).
+ *                data must not be changed until the message is done, i.e. until
+ *                the next blocking read / TWI_Master_Flush() returns.
+ *  	  	Input: 	address, header and size, data and size
+ *  	  Returns: 	error
+ * =====================================================================================
+ */
+extern uint8_t
+TWI_Master_Post (uint8_t address, const uint8_t *hdr, uint8_t hdr_cnt,
+                 uint8_t *data, uint8_t data_cnt);
 
 
 /*
  * ===  FUNCTION  ======================================================================
- *         Name:  TWI_Master_Get_Transceiver_Data
- *  Description:  Waits until TWI-Int is disabled and initiates a TWI-reception
- *  							Call this function after you sent a request of data to the Slave
- *  							The first byte of the message has to be the slave address!!
- *  			Input: 	*message,  message_size*
- *  	  Returns: 	none
+ *         Name:  TWI_Master_Transceive_Message
+ *  Description: 	Queues the transmission of a message with the slave address
+ *  							(SLA+W) as first byte. The message is streamed directly from
+ *  							the given buffer, so it must not be changed until the
+ *  							transmission is done (see TWI_Master_Post).
+ *  	  	Input: 	pointer to the message,  message size
+ *  	  Returns: 	error
  * =====================================================================================
  */
 extern uint8_t
-TWI_Master_Get_Transceiver_Data(volatile uint8_t * message, uint8_t message_size);
+TWI_Master_Transceive_Message (volatile uint8_t *message, uint8_t messagesize);
+
+/* -----  end of function TWI_Master_Transceive_Message  ----- */
 
-/* -----  end of function TWI_Master_Get_Transceiver_Data ----- */
 
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Write_Register
- *  Description:  Waits until TWI-Int is disabled and sends two bytes (register and value)
- *                to the slave address
+ *  Description:  Queues two bytes (register and value) for the slave address
+ *                and returns without waiting for the transmission (posted write)
  *  	  Input:  message , address
- *      Returns:  none
+ *      Returns:  error
  * =====================================================================================
  */
 extern uint8_t
@@ -221,10 +279,10 @@ TWI_Master_Write_Register(uint8_t reg, uint8_t value, uint8_t address);
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Write_Byte
- *  Description:  Waits until TWI-Int is disabled and sends one byte
- *                to the slave address
+ *  Description:  Queues one byte for the slave address and returns without
+ *                waiting for the transmission (posted write)
  *  	  Input:  message , address
- *  	Returns:  none
+ *  	Returns:  error
  * =====================================================================================
  */
 extern uint8_t
@@ -242,12 +300,24 @@ TWI_Master_Write_Byte(uint8_t byte, uint8_t address);
 extern uint8_t
 TWI_Master_Read_Byte(uint8_t address);
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Write_Read
+ *  Description:  Writes tx_cnt bytes to the slave and reads rx_cnt bytes back
+ *                within one transaction (START, SLA+W, tx, REP_START, SLA+R, rx, STOP).
+ *                Waits for this message (but not for the rest of the queue).
+ *  	  Input:  address, tx buffer and size, rx buffer and size
+ *  	Returns:  error
+ * =====================================================================================
+ */
+extern uint8_t
+TWI_Master_Write_Read(uint8_t address, uint8_t *tx, uint8_t tx_cnt, uint8_t *rx, uint8_t rx_cnt);
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:  TWI_Master_Read_Register
- *  Description:  Waits until TWI-Int is disabled and addresses a given register.
- *                After transmision it reads the addressed reigster from the slave
- *                address.
+ *  Description:  Addresses a given register and reads it back from the slave
+ *                address using a repeated start.
  *  	  Input:  address
  *  	Returns:  byte
  * =====================================================================================
@@ -256,6 +326,34 @@ extern uint8_t
 TWI_Master_Read_Register(uint8_t reg,uint8_t address);
 
 
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Int_Init
+ *  Description:  Enables the falling edge interrupt (INT1) of the INT_TWI line
+ *                (PD3, input with pull-up). Until then every client sees an event.
+ *  	  Input:  none
+ *  	Returns:  none
+ * =====================================================================================
+ */
+extern void
+TWI_Master_Int_Init(void);
+
+
+/*
+ * ===  FUNCTION  ======================================================================
+ *         Name:  TWI_Master_Int_Event
+ *  Description:  Tests and clears the change notification of the clients in mask.
+ *                A client reads its slave only when this returns non zero.
+ *                As the line is shared, it also reports an event as long as the
+ *                line is held low (another slave may hide a new edge).
+ *  	  Input:  TWI_INT_xxx
+ *  	Returns:  the notified clients of mask
+ * =====================================================================================
+ */
+extern uint8_t
+TWI_Master_Int_Event(uint8_t mask);
+
+
 /*
  * ===  FUNCTION  ======================================================================
  *         Name:   ISR(TWI_vect)
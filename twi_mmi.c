@@ -34,6 +34,26 @@
 
 volatile int8_t rot_enc_dir=0;
 
+// event bits of the status register that are not handled yet
+static uint8_t mmi_events=0;
+
+/*************************************************************************
+Function: MMI_Events_Update()
+Purpose:  reads the status register of the LCD modul, but only when it
+          signaled a change on the INT_TWI line
+Input:    none
+Returns:  none
+**************************************************************************/
+static void
+MMI_Events_Update(void)
+{
+    if(TWI_Master_Int_Event(TWI_INT_MMI))
+        // status register (0), a plain read returns the register behind
+        // the last LCD write
+        mmi_events |= TWI_Master_Read_Register(0,TWI_LCD_ADRESS)
+                      & (_BV(ROT_ENC_EVENT)|_BV(PORT_X_EVENT));
+}
+
 /*************************************************************************
 Function: RotEnc_Get_Dir()
 Purpose:
@@ -45,8 +65,10 @@ RotEnc_Get_Dir(void)
 {
     static int8_t old_value=0,new_value=0;
     int8_t dif_value;
-    if((TWI_Master_Read_Byte(TWI_LCD_ADRESS))&(_BV(ROT_ENC_EVENT)))
+    MMI_Events_Update();
+    if(mmi_events & _BV(ROT_ENC_EVENT))
     {
+        mmi_events &= ~_BV(ROT_ENC_EVENT);
         new_value = TWI_Master_Read_Register(0x02,TWI_LCD_ADRESS);
         if((dif_value = new_value - old_value)>0) rot_enc_dir = 1;
         else if(dif_value<0) rot_enc_dir = -1;
@@ -65,10 +87,12 @@ uint8_t
 RotEnc_Pushed(void)
 {
     uint8_t tmp_value;
-    if((TWI_Master_Read_Byte(TWI_LCD_ADRESS))&(_BV(PORT_X_EVENT)))
+    MMI_Events_Update();
+    if(mmi_events & _BV(PORT_X_EVENT))
     {
+        mmi_events &= ~_BV(PORT_X_EVENT);
         tmp_value = TWI_Master_Read_Register(0x01,TWI_LCD_ADRESS);
         if(tmp_value & _BV(5)) return 1;
-        else return 0;
     }
+    return 0;
 }